@@ -21,19 +21,8 @@
 
 #include "mcc_generated_files/mcc.h"
 #include <command.h>
-#include <ctype.h>
 #include <hal.h>
 
-//
-//! Length of our input line buffer
-//
-#define BUFFERLEN 20
-
-//
-//! The number of loop iterations we need to flash at approx 1Hz
-//
-#define ERRORFLASHDURATION 1000
-
 ///////////////////////////////////////////////////////////////////////////////
 //!
 //! \brief  Device main loop
@@ -65,134 +54,51 @@ void main( void )
 #define VERSION_STR( x ) VERSION_STR1( x )
 #define VERSION_STR1( x ) #x
 
-    HAL_PrintText( "FuelGauge Version " VERSION_STR(
-        GIT_VERSION ) "\r\n\r\nPress \"u\" for usage\r\n\r\n" );
+#define BANNER                                        \
+    "FuelGauge Version " VERSION_STR( GIT_VERSION ) \
+    "\r\n\r\nPress \"u\" for usage\r\n\r\n"
 
     //
     // Check to see if we have experienced a watchdog reset.
     // Note: This needs the -mresetbits compiler option set otherwise this
     // information is clobbered by the normal start up code
     //
-    if ( __timeout == 0 )
-    {
-        HAL_PrintText( "Watchdog timeout\r\n\r\n" );
-    }
+    bool watchdogReset = ( __timeout == 0 );
 
     //
-    // Start the PWM output
+    // Get the gauge going before anything else. The maps are loaded and the
+    // tank input filters seeded so the first pass of the main loop sets the
+    // gauge to the right level rather than it climbing from empty. The ticks
+    // come first as their interrupt takes the samples the filters are seeded
+    // from.
     //
     TMR2_StartTimer();
-
+    HAL_StartSerial();
+    HAL_StartTicks();
     InitialiseGauge();
 
-    char        rxData;
-    char        lineBuffer[ BUFFERLEN ];
-    const char* lineBufferBegin = &lineBuffer[ 0 ];
-    const char* lineBufferEnd = lineBufferBegin + BUFFERLEN;
-    char*       bufferPos = (char*)lineBufferBegin;
-    int         errorCount = 0;
+    //
+    // The banner takes around 60ms at 9600 baud so send it from the main
+    // loop instead of waiting
+    //
+    if ( watchdogReset )
+    {
+        HAL_QueueText( BANNER "Watchdog timeout\r\n\r\n" );
+    }
+    else
+    {
+        HAL_QueueText( BANNER );
+    }
 
-    *bufferPos = '\0';
+    //
+    // Everything the gauge does runs as a task at its own period. None of
+    // them wait so the main loop rate doesn't depend on what is going on.
+    //
+    StartGaugeTasks();
 
     while ( 1 )
     {
-        //
-        // Check to see if we have a character waiting
-        //
-        if ( EUSART_is_rx_ready() )
-        {
-            rxData = EUSART_Read();
-
-            if ( rxData == '\r' )
-            {
-                //
-                // Echo the CR before doing any work
-                //
-                HAL_PrintNewline();
-
-                *bufferPos = '\0';
-
-                //
-                // Process our line buffer as a new command
-                //
-                if ( ProcessCommand( lineBuffer ) )
-                {
-                    HAL_PrintText( "OK" );
-                    HAL_PrintNewline();
-                }
-                else
-                {
-                    HAL_PrintText( "Command Error" );
-                    HAL_PrintNewline();
-                }
-                bufferPos = (char*)lineBufferBegin;
-                *bufferPos = '\0';
-            }
-            else if ( isprint( rxData ) )
-            {
-                //
-                // Local echo
-                //
-                if ( EUSART_is_tx_ready() )
-                {
-                    EUSART_Write( rxData );
-                }
-
-                //
-                // Store the character in our line buffer and check for length
-                //
-                *bufferPos = rxData;
-                bufferPos++;
-                if ( bufferPos == lineBufferEnd )
-                {
-                    HAL_PrintNewline();
-                    HAL_PrintText( "Line too long" );
-                    HAL_PrintNewline();
-                    bufferPos = (char*)lineBufferBegin;
-                    *bufferPos = '\0';
-                }
-            }
-        }
-
-        //
-        // Run the gauge main loop
-        //
-        if ( !RunGauge() )
-        {
-            //
-            // If we don't already have an error flash in progress start a
-            // new one
-            //
-            if ( errorCount == 0 )
-            {
-                //
-                // The error flash will have a 50% duty cycle so double the
-                // interations
-                //
-                errorCount = ERRORFLASHDURATION * 2;
-                lowFuel_SetHigh();
-            }
-        }
-
-        //
-        // If we have an outstanding error take care of flashing the low fuel
-        // LED
-        //
-        if ( errorCount > 0 )
-        {
-            if ( errorCount == ERRORFLASHDURATION )
-            {
-                lowFuel_SetLow();
-            }
-            errorCount--;
-
-            //
-            // Wait for 1ms which should be enough to keep the main loop
-            // responsive but not require huge numbers of iterations to build
-            // longer delays for the error flash
-            //
-            __delay_ms( 1 );
-        }
+        RunGaugeTasks();
 
         //
         // Strobe the watchdog every time round the main loop so we don't reboot
@@ -20,80 +20,281 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "mcc_generated_files/mcc.h"
+#include <filter.h>
 #include <hal.h>
+#include <lookup.h>
 #include <mapper.h>
+#include <sampler.h>
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <textqueue.h>
 #include <xc.h>
 
+//
+// The maps and low fuel level are stored as 16-bit values in the data EEPROM
+// followed by the filter strength and the mapping and output rates
+//
+#if ( 4 * MAPSIZE + 5 ) > 256
+#error "The maps don't fit in the data EEPROM"
+#endif
+
+//
+//! Fault detection, slosh rejection and smoothing for the tank input. The
+//! filters are off until the core sets the setting saved with the maps.
+//
+static TankFilter s_tankFilter;
+
 ///////////////////////////////////////////////////////////////////////////////
 //!
-//! \brief  Apply an Exponential Moving Average filter
+//! \brief  Set the strength of the tank input smoothing filter, whether it
+//!         adapts to the input and whether the median filter is used
 //!
-//! This applies an exponential moving average filter to the supplied value. The
-//! filter is of the form:
+///////////////////////////////////////////////////////////////////////////////
+void HAL_SetTankFilter( uint8_t setting )
+{
+    SetTankFilter( &s_tankFilter, setting );
+}
+
+//
+//! Conversions of the tank input being added up for the next sample. Only
+//! the interrupt uses this.
+//
+static Oversampler s_sampler;
+
+//
+//! Samples waiting for the main loop to filter them
+//
+static SampleRing s_samples;
+
+//
+//! Ticks counted by the TMR0 interrupt. TMR0 counts instruction cycles through
+//! a 1:2 prescaler so overflows every 256 * 2 / 8MHz = 64us. A tick is
+//! counted every OVERSAMPLE_COUNT overflows, every 1.024ms, and each overflow
+//! in a tick that is sampled converts the tank input once.
+//
+static volatile uint16_t s_ticks;
+static uint8_t           s_tickOverflows;
+
+//
+//! Flag to indicate the tank input is being converted for this tick's sample
+//
+static bool s_converting;
+
+//
+//! Sizes of the serial port queues. Each must be a power of two. The transmit
+//! queue covers short replies and the echo so printing them doesn't wait, and
+//! the receive queue covers a few characters typed while the main loop is
+//! busy. Both are kept small as RAM is tight.
+//
+#ifndef TX_QUEUE_SIZE
+#define TX_QUEUE_SIZE 8
+#endif
+
+#ifndef RX_QUEUE_SIZE
+#define RX_QUEUE_SIZE 4
+#endif
+
+#if ( TX_QUEUE_SIZE & ( TX_QUEUE_SIZE - 1 ) ) != 0 || TX_QUEUE_SIZE > 128
+#error "TX_QUEUE_SIZE must be a power of two no bigger than 128"
+#endif
+
+#if ( RX_QUEUE_SIZE & ( RX_QUEUE_SIZE - 1 ) ) != 0 || RX_QUEUE_SIZE > 128
+#error "RX_QUEUE_SIZE must be a power of two no bigger than 128"
+#endif
+
+//
+//! Characters waiting to be sent by the transmit interrupt
+//
+static char      s_txText[ TX_QUEUE_SIZE ];
+static TextQueue s_txQueue = TEXT_QUEUE( s_txText );
+
+//
+//! Characters received by the receive interrupt waiting to be read
+//
+static char      s_rxText[ RX_QUEUE_SIZE ];
+static TextQueue s_rxQueue = TEXT_QUEUE( s_rxText );
+
+///////////////////////////////////////////////////////////////////////////////
 //!
-//! y[n] = alpha * x[n] + (1 - alpha) * y[n-1]
+//! \brief  Sample the tank input and service the serial port
 //!
-//! where "alpha" is a value between 0 and 1 indicating the historical weight
+//! Each time TMR0 overflows the conversion started by the last overflow has
+//! long finished, so its result is collected and the next conversion started
+//! straight away. The conversions are started within a few cycles of each
+//! overflow so the samples are evenly spaced whatever the main loop is
+//! doing. The 64us between them leaves the ADC plenty of time to acquire the
+//! input. While the tank input is steady the filters back the rate off and
+//! the ticks that aren't sampled start no conversions at all.
 //!
-//! This implementation uses just addition subtraction and bit-shift to do this:
+//! The transmit interrupt is only enabled while there is something to send.
+//! A receive overrun loses the characters in the EUSART so they are counted
+//! with those that didn't fit in the queue.
 //!
-//! alpha = 1 / (2^k)
+///////////////////////////////////////////////////////////////////////////////
+void __interrupt() Interrupt( void )
+{
+    if ( INTCONbits.TMR0IE && INTCONbits.TMR0IF )
+    {
+        INTCONbits.TMR0IF = 0;
+
+        bool full = s_converting &&
+            AccumulateSample( &s_sampler, ADC_GetConversionResult() );
+
+        s_tickOverflows++;
+        if ( s_tickOverflows == OVERSAMPLE_COUNT )
+        {
+            s_tickOverflows = 0;
+            s_ticks++;
+            s_converting = SampleDue( &s_samples, s_ticks );
+        }
+        if ( s_converting )
+        {
+            ADC_StartConversion();
+        }
+
+        if ( full )
+        {
+            //
+            // If the main loop has fallen so far behind that the ring is full
+            // this sample is lost, just as it would be if it were never taken
+            //
+            PushSample( &s_samples, DumpOversample( &s_sampler ) );
+        }
+    }
+
+    if ( PIE1bits.RCIE && PIR1bits.RCIF )
+    {
+        if ( RCSTAbits.OERR )
+        {
+            RCSTAbits.CREN = 0;
+            RCSTAbits.CREN = 1;
+            LoseCharacter( &s_rxQueue );
+        }
+        PutCharacter( &s_rxQueue, RCREG );
+    }
+
+    if ( PIE1bits.TXIE && PIR1bits.TXIF )
+    {
+        char character;
+        if ( GetCharacter( &s_txQueue, &character ) )
+        {
+            TXREG = character;
+        }
+        else
+        {
+            PIE1bits.TXIE = 0;
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
 //!
-//! Algorithm and performance from
-//! https://tttapa.github.io/Pages/Mathematics/Systems-and-Control-Theory/Digital-filters/Exponential%20Moving%20Average/Exponential-Moving-Average.html
+//! \brief  Start TMR0 and its interrupt sampling the tank input and counting
+//!         ticks
+//!
+//! MCC doesn't set up TMR0 so this is done here. The tank input is the only
+//! channel used so it stays selected. The first conversion is started here so
+//! there is a result for the first interrupt to collect.
 //!
 ///////////////////////////////////////////////////////////////////////////////
-static uint16_t Filter( uint16_t x, uint8_t k )
+void HAL_StartTicks( void )
 {
-    //
-    // Historic store of the last filtered value
-    static uint32_t z = 0;
+    ADC_SelectChannel( tank );
+    ADC_StartConversion();
+    s_converting = true;
 
-    z += x;
-    uint32_t y = ( z + ( 1 << ( k - 1 ) ) ) >> k;
-    z -= y;
-
-    return y;
+    OPTION_REGbits.TMR0CS = 0; // Fosc/4
+    OPTION_REGbits.PSA = 0;
+    OPTION_REGbits.PS = 0b000; // 1:2
+    TMR0 = 0;
+    INTCONbits.TMR0IF = 0;
+    INTCONbits.TMR0IE = 1;
+    INTCONbits.GIE = 1;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 //!
-//! \brief  Start and wait for an ADC conversion from the tank input
+//! \brief  Return the number of ticks since they were started
 //!
-//! \note   The value read from the ADC is 10-bit but LH justified
+//! The tick interrupt is held off while both bytes are read so they match
 //!
 ///////////////////////////////////////////////////////////////////////////////
-uint16_t HAL_GetTankInput()
+uint16_t HAL_GetTicks( void )
 {
-    //
-    // Read the ADC and run through our smoothing filter
-    //
-    // k = 5 results in a -3dB roll off of 5Hz @ 1kHz sample rate
-    // k = 6 results in a -3dB roll off of 2.5Hz @ 1kHz sample rate
-    // k = 7 results in a -3dB roll off of 1.25Hz @ 1kHz sample rate
-    // k = 8 results in a -3dB roll off of 0.62Hz @ 1kHz sample rate
-    //
-    uint16_t value = Filter( ADC_GetConversion( tank ), 8 );
+    INTCONbits.TMR0IE = 0;
+    uint16_t ticks = s_ticks;
+    INTCONbits.TMR0IE = 1;
 
-    //
-    // Limit our sampling frequency to around 1kHz at a maximum
-    //
-    __delay_ms( 1 );
+    return ticks;
+}
 
-    //
-    // If we consistently indicate full-scale on the ADC this means we have
-    // an open input or another error - force this to be the error value
-    //
-    if ( value >= 0xffc0 )
+//
+//! The last filtered tank input
+//
+static uint16_t s_tankInput;
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Start the tank input filters from the current tank input
+//!
+//! The filters would otherwise climb from empty for several seconds after
+//! power on. The newest sample from the interrupt is used, waiting for one if
+//! need be, and any older ones are passed over. As an oversampled reading it
+//! averages a burst of conversions so a single noisy one can't throw the
+//! gauge off. The ticks must have been started.
+//!
+///////////////////////////////////////////////////////////////////////////////
+void HAL_SeedTankFilter( void )
+{
+    while ( !TakeSample( &s_samples, &s_tankInput ) )
     {
-        return TANK_INPUT_ERROR;
     }
-    else
+    while ( TakeSample( &s_samples, &s_tankInput ) )
     {
-        return value;
     }
+
+    SeedTankFilter( &s_tankFilter, s_tankInput );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Run the samples taken since the last drain through the sample path
+//!
+//! This is called every SAMPLE_DRAIN_TICKS from the main loop. The filters
+//! check for a faulty sender before our slosh and smoothing filters. An open
+//! or shorted sender is reported as TANK_INPUT_ERROR within a few samples.
+//!
+///////////////////////////////////////////////////////////////////////////////
+void HAL_DrainTankSamples( void )
+{
+    DrainSamples( &s_samples, &s_tankFilter, &s_tankInput );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Return the last filtered tank input
+//!
+//! \note   The value is oversampled to 12-bits and LH justified
+//!
+///////////////////////////////////////////////////////////////////////////////
+uint16_t HAL_GetTankInput()
+{
+    return s_tankInput;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Return the rate the tank input is changing at in counts per hour
+//!
+//! This is only tracked when the level estimator is used and is zero
+//! otherwise
+//!
+///////////////////////////////////////////////////////////////////////////////
+int32_t HAL_GetTankRate()
+{
+    return TankFilterRate( &s_tankFilter );
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -135,21 +336,113 @@ void HAL_SetLowFuelLight( bool newState )
 
 ///////////////////////////////////////////////////////////////////////////////
 //!
-//! \brief  Send the text to the USART
+//! \brief  Start the serial port interrupts
+//!
+//! MCC sets up the EUSART but not its interrupts. Global interrupts are turned
+//! on by HAL_StartTicks().
 //!
 ///////////////////////////////////////////////////////////////////////////////
-void HAL_PrintText( const char* text )
+void HAL_StartSerial( void )
+{
+    PIE1bits.RCIE = 1;
+    INTCONbits.PEIE = 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Add a character to the transmit queue, waiting for space if it is
+//!         full
+//!
+//! Replies to commands mustn't be lost so a full queue holds the main loop
+//! up until the transmit interrupt has made room. Tank input samples are
+//! still filtered while waiting so none are lost if it takes a while.
+//!
+///////////////////////////////////////////////////////////////////////////////
+static void SendCharacter( char character )
+{
+    while ( TextQueueSpace( &s_txQueue ) == 0 )
+    {
+        DrainSamples( &s_samples, &s_tankFilter, &s_tankInput );
+        CLRWDT();
+    }
+
+    PutCharacter( &s_txQueue, character );
+    PIE1bits.TXIE = 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Add text to the transmit queue, waiting for space as need be
+//!
+///////////////////////////////////////////////////////////////////////////////
+static void SendText( const char* text )
 {
     while ( *text )
     {
-        while ( !EUSART_is_tx_ready() )
+        SendCharacter( *text );
+        text++;
+    }
+}
+
+//
+//! The rest of the text queued to be sent in the background or NULL
+//
+static const char* s_queuedText;
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Queue text to be sent by HAL_ServiceText()
+//!
+//! Only the pointer is kept so the text must stay put until it has been sent.
+//! Anything already queued is sent first.
+//!
+///////////////////////////////////////////////////////////////////////////////
+void HAL_QueueText( const char* text )
+{
+    if ( s_queuedText != NULL )
+    {
+        HAL_PrintText( "" );
+    }
+    s_queuedText = *text != '\0' ? text : NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Move as much of the queued text into the transmit queue as will
+//!         fit without waiting
+//!
+///////////////////////////////////////////////////////////////////////////////
+void HAL_ServiceText( void )
+{
+    while ( s_queuedText != NULL && TextQueueSpace( &s_txQueue ) > 0 )
+    {
+        SendCharacter( *s_queuedText );
+        s_queuedText++;
+        if ( *s_queuedText == '\0' )
         {
+            s_queuedText = NULL;
         }
-        EUSART_Write( *text );
-        text++;
     }
 }
 
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Send the text to the USART
+//!
+//! Any queued text is sent first so the output stays in order
+//!
+///////////////////////////////////////////////////////////////////////////////
+void HAL_PrintText( const char* text )
+{
+    if ( s_queuedText != NULL )
+    {
+        SendText( s_queuedText );
+        s_queuedText = NULL;
+    }
+
+    SendText( text );
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 //!
 //! \brief  Just send a carriage-return and line-feed
@@ -160,6 +453,26 @@ void HAL_PrintNewline( void )
     HAL_PrintText( "\r\n" );
 }
 
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Take a received character from the receive queue if there is one
+//!
+///////////////////////////////////////////////////////////////////////////////
+bool HAL_ReadCharacter( char* character )
+{
+    return GetCharacter( &s_rxQueue, character );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Return the number of received characters that have been lost
+//!
+///////////////////////////////////////////////////////////////////////////////
+uint8_t HAL_GetLostCharacters( void )
+{
+    return s_rxQueue.lost;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 //!
 //! \brief  Load the input and output maps from the beginning of EEPROM
@@ -167,7 +480,13 @@ void HAL_PrintNewline( void )
 //! \note   The map values are stored in big-endian order
 //!
 ///////////////////////////////////////////////////////////////////////////////
-void HAL_LoadMaps( uint16_t* input, uint16_t* output, uint16_t* lowFuelLevel )
+void HAL_LoadMaps(
+    uint16_t* input,
+    uint16_t* output,
+    uint16_t* lowFuelLevel,
+    uint8_t*  filterSetting,
+    uint8_t*  mappingTicks,
+    uint8_t*  outputTicks )
 {
     uint16_t value;
     uint8_t  addr = 0;
@@ -200,6 +519,20 @@ void HAL_LoadMaps( uint16_t* input, uint16_t* output, uint16_t* lowFuelLevel )
     value += DATAEE_ReadByte( addr );
     addr++;
     *lowFuelLevel = value;
+
+    //
+    // The filter strength is a single byte. Erased EEPROM reads as 0xFF
+    // which the core replaces with its default.
+    //
+    *filterSetting = DATAEE_ReadByte( addr );
+    addr++;
+
+    //
+    // As are the mapping and output rates
+    //
+    *mappingTicks = DATAEE_ReadByte( addr );
+    addr++;
+    *outputTicks = DATAEE_ReadByte( addr );
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -212,7 +545,10 @@ void HAL_LoadMaps( uint16_t* input, uint16_t* output, uint16_t* lowFuelLevel )
 void HAL_SaveMaps(
     const uint16_t* input,
     const uint16_t* output,
-    uint16_t        lowFuelLevel )
+    uint16_t        lowFuelLevel,
+    uint8_t         filterSetting,
+    uint8_t         mappingTicks,
+    uint8_t         outputTicks )
 {
     uint16_t value;
     uint8_t  addr = 0;
@@ -246,4 +582,77 @@ void HAL_SaveMaps(
     addr++;
     DATAEE_WriteByte( addr, value & 0xFF );
     addr++;
+
+    DATAEE_WriteByte( addr, filterSetting );
+    addr++;
+    DATAEE_WriteByte( addr, mappingTicks );
+    addr++;
+    DATAEE_WriteByte( addr, outputTicks );
+}
+
+//
+//! Start of the program flash reserved for the lookup table. The linker is
+//! told to keep code out of 0xEE0-0xFFF which holds LOOKUP_STORAGE_SIZE
+//! entries rounded up to whole erase rows.
+//
+#define LOOKUP_TABLE_ADDRESS 0x0EE0
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Read a lookup table entry from program flash
+//!
+///////////////////////////////////////////////////////////////////////////////
+uint16_t HAL_ReadLookupEntry( uint16_t index )
+{
+    return FLASH_ReadWord( LOOKUP_TABLE_ADDRESS + index );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Write a lookup table entry to program flash
+//!
+//! Entries are written in order so each row is erased when its first entry
+//! arrives and the row latches are committed with the last entry of the row
+//! or of the table. This avoids holding a whole row in RAM as
+//! FLASH_WriteBlock() would need.
+//!
+///////////////////////////////////////////////////////////////////////////////
+void HAL_WriteLookupEntry( uint16_t index, uint16_t value )
+{
+    uint16_t addr = LOOKUP_TABLE_ADDRESS + index;
+    uint8_t  GIEBitValue = INTCONbits.GIE;
+
+    if ( ( addr & ( ERASE_FLASH_BLOCKSIZE - 1 ) ) == 0 )
+    {
+        FLASH_EraseBlock( addr );
+    }
+
+    INTCONbits.GIE = 0;
+
+    EECON1bits.EEPGD = 1;
+    EECON1bits.CFGS = 0;
+    EECON1bits.FREE = 0;
+    EECON1bits.WREN = 1;
+
+    //
+    // Only load the write latch unless this completes the row or the table
+    //
+    EECON1bits.LWLO =
+        ( ( addr & ( WRITE_FLASH_BLOCKSIZE - 1 ) ) !=
+          ( WRITE_FLASH_BLOCKSIZE - 1 ) ) &&
+        ( index != LOOKUP_STORAGE_SIZE - 1 );
+
+    EEADRL = addr & 0xFF;
+    EEADRH = addr >> 8;
+    EEDATL = value & 0xFF;
+    EEDATH = value >> 8;
+
+    EECON2 = 0x55;
+    EECON2 = 0xAA;
+    EECON1bits.WR = 1;
+    NOP();
+    NOP();
+
+    EECON1bits.WREN = 0;
+    INTCONbits.GIE = GIEBitValue;
 }
@@ -0,0 +1,416 @@
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \file
+//! \brief  Benchmark the tank input filter on the host
+//!
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2019 David J. Fiddes
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <benchmark/benchmark.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+
+#include "filter.h"
+
+//
+//! Rate the tank input is sampled and filtered at on the gauge
+//
+const double TankSampleRate = 1000.0;
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Count the samples a filter takes to settle within 1% of full
+//!         scale after a full scale step
+//!
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t SettlingSamples( uint8_t k )
+{
+    FilterState filter;
+    InitialiseFilter( &filter, k );
+
+    uint32_t settled = 0;
+    for ( uint32_t i = 1; i <= ( 64UL << k ); i++ )
+    {
+        if ( abs( Filter( &filter, 0xFFFF ) - 0xFFFF ) > 0xFFFF / 100 )
+        {
+            settled = i;
+        }
+    }
+
+    return settled;
+}
+
+// Filter a noisy tank input with each strength
+static void BM_Filter( benchmark::State& state )
+{
+    uint8_t                 k = state.range( 0 );
+    std::vector< uint16_t > inputs( 4096 );
+    uint32_t                seed = 0x12345678;
+
+    for ( uint16_t& input : inputs )
+    {
+        seed = seed * 1664525 + 1013904223;
+        input = 0x8000 + ( (int16_t)( seed >> 16 ) >> 4 );
+    }
+
+    FilterState filter;
+    InitialiseFilter( &filter, k );
+
+    for ( auto _ : state )
+    {
+        for ( uint16_t input : inputs )
+        {
+            benchmark::DoNotOptimize( Filter( &filter, input ) );
+        }
+    }
+
+    uint32_t settling = SettlingSamples( k );
+
+    state.SetItemsProcessed( state.iterations() * inputs.size() );
+    state.counters[ "NsPerSample" ] = benchmark::Counter(
+        state.iterations() * inputs.size(),
+        benchmark::Counter::kIsRate | benchmark::Counter::kInvert );
+    state.counters[ "SettlingSamples" ] = settling;
+    state.counters[ "SettlingMs" ] = settling * 1000.0 / TankSampleRate;
+}
+BENCHMARK( BM_Filter )->DenseRange( 0, 12 );
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  A minute of tank input sampled during hard driving
+//!
+//! The clean trace drains slowly with a little ADC noise. The sloshing trace
+//! adds the short spikes the float sender throws out when it is swung about
+//! by cornering and braking.
+//!
+///////////////////////////////////////////////////////////////////////////////
+struct SloshTrace
+{
+    std::vector< uint16_t > clean;
+    std::vector< uint16_t > slosh;
+
+    SloshTrace() : clean( 60000 ), slosh( 60000 )
+    {
+        uint32_t seed = 0x12345678;
+        size_t   spikeEnd = 0;
+        int32_t  spike = 0;
+
+        for ( size_t i = 0; i < clean.size(); i++ )
+        {
+            seed = seed * 1664525 + 1013904223;
+            int32_t level = 0x9000 - (int32_t)( i / 4 );
+            clean[ i ] = level + ( (int32_t)( seed >> 28 ) - 8 ) * 16;
+
+            //
+            // A burst of spikes every few hundred samples, each shorter
+            // than half the median window
+            //
+            if ( i >= spikeEnd && ( seed & 0xFF ) == 0 )
+            {
+                spike = ( seed & 0x100 ) ? 0x3000 : -0x3000;
+                spikeEnd = i + 1 + ( seed >> 9 ) % ( MEDIAN_SIZE / 2 );
+            }
+            slosh[ i ] = clean[ i ] + ( i < spikeEnd ? spike : 0 );
+        }
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Run a trace through the tank filters with a filter setting as the
+//!         HAL does
+//!
+///////////////////////////////////////////////////////////////////////////////
+static std::vector< uint16_t > FilterTrace(
+    const std::vector< uint16_t >& trace,
+    uint8_t                        setting )
+{
+    FilterState  filter;
+    MedianFilter medianFilter;
+    InitialiseFilter( &filter, setting & FILTER_K_MASK );
+    SetFilterAdaptive( &filter, ( setting & FILTER_ADAPTIVE_FLAG ) != 0 );
+    InitialiseMedian( &medianFilter, 0 );
+
+    bool median = ( setting & FILTER_MEDIAN_FLAG ) != 0;
+
+    std::vector< uint16_t > output( trace.size() );
+    for ( size_t i = 0; i < trace.size(); i++ )
+    {
+        uint16_t value = trace[ i ];
+        if ( median )
+        {
+            value = Median( &medianFilter, value );
+        }
+        output[ i ] = Filter( &filter, value );
+    }
+
+    return output;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Count the samples the tank filters take to pass half of a step
+//!
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t HalfStepSamples( uint8_t k, bool median )
+{
+    std::vector< uint16_t > step( 64UL << k, 0x8000 );
+    std::vector< uint16_t > output =
+        FilterTrace( step, k | ( median ? FILTER_MEDIAN_FLAG : 0 ) );
+
+    uint32_t samples = 0;
+    while ( samples < output.size() && output[ samples ] < 0x4000 )
+    {
+        samples++;
+    }
+
+    return samples + 1;
+}
+
+// Filter a sloshing tank input with and without the median filter
+static void BM_FilterSlosh( benchmark::State& state )
+{
+    uint8_t    k = state.range( 0 );
+    bool       median = state.range( 1 );
+    SloshTrace trace;
+
+    std::vector< uint16_t > output;
+    for ( auto _ : state )
+    {
+        output = FilterTrace(
+            trace.slosh, k | ( median ? FILTER_MEDIAN_FLAG : 0 ) );
+        benchmark::DoNotOptimize( output.data() );
+    }
+
+    //
+    // Compare with the clean trace once the filters have settled
+    //
+    std::vector< uint16_t > reference = FilterTrace( trace.clean, k );
+    double                  maxError = 0.0;
+    double                  sumSquares = 0.0;
+    size_t                  compared = 0;
+    for ( size_t i = 4096; i < output.size(); i++ )
+    {
+        double error = fabs( (double)output[ i ] - reference[ i ] );
+        maxError = error > maxError ? error : maxError;
+        sumSquares += error * error;
+        compared++;
+    }
+
+    size_t samples = state.iterations() * trace.slosh.size();
+    state.SetItemsProcessed( samples );
+    state.counters[ "NsPerSample" ] = benchmark::Counter(
+        samples, benchmark::Counter::kIsRate | benchmark::Counter::kInvert );
+    state.counters[ "MaxSloshError" ] = maxError;
+    state.counters[ "RmsSloshError" ] = sqrt( sumSquares / compared );
+    state.counters[ "AddedLatency" ] =
+        (double)HalfStepSamples( k, median ) - HalfStepSamples( k, false );
+}
+BENCHMARK( BM_FilterSlosh )
+    ->ArgNames( { "k", "median" } )
+    ->ArgsProduct( { { 0, 4, 6, 8 }, { 0, 1 } } );
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Ten seconds of tank input after switching on with a tank that has
+//!         just been filled
+//!
+//! The filters start from empty at power on so this is when a fixed filter
+//! lags furthest behind the real level.
+//!
+///////////////////////////////////////////////////////////////////////////////
+static std::vector< uint16_t > RefuelTrace()
+{
+    std::vector< uint16_t > input( 10000 );
+    uint32_t                seed = 0x87654321;
+
+    for ( uint16_t& sample : input )
+    {
+        seed = seed * 1664525 + 1013904223;
+        sample = 0xD000 + ( (int32_t)( seed >> 28 ) - 8 ) * 16;
+    }
+
+    return input;
+}
+
+// Filter the tank input after refuelling with a fixed and an adaptive
+// strength
+static void BM_FilterRefuel( benchmark::State& state )
+{
+    uint8_t                 k = state.range( 0 );
+    bool                    adaptive = state.range( 1 );
+    std::vector< uint16_t > trace = RefuelTrace();
+    uint8_t setting = k | ( adaptive ? FILTER_ADAPTIVE_FLAG : 0 );
+
+    std::vector< uint16_t > output;
+    for ( auto _ : state )
+    {
+        output = FilterTrace( trace, setting );
+        benchmark::DoNotOptimize( output.data() );
+    }
+
+    //
+    // Settling is until the output stays within 1% of the level. The noise
+    // is measured over the last half of the trace.
+    //
+    size_t settled = 0;
+    for ( size_t i = 0; i < output.size(); i++ )
+    {
+        if ( abs( output[ i ] - 0xD000 ) > 0xFFFF / 100 )
+        {
+            settled = i + 1;
+        }
+    }
+
+    double sumSquares = 0.0;
+    size_t half = output.size() / 2;
+    for ( size_t i = half; i < output.size(); i++ )
+    {
+        double error = (double)output[ i ] - 0xD000;
+        sumSquares += error * error;
+    }
+
+    size_t samples = state.iterations() * trace.size();
+    state.SetItemsProcessed( samples );
+    state.counters[ "NsPerSample" ] = benchmark::Counter(
+        samples, benchmark::Counter::kIsRate | benchmark::Counter::kInvert );
+    state.counters[ "SettlingMs" ] = settled * 1000.0 / TankSampleRate;
+    state.counters[ "NoiseRms" ] =
+        sqrt( sumSquares / ( output.size() - half ) );
+}
+BENCHMARK( BM_FilterRefuel )
+    ->ArgNames( { "k", "adaptive" } )
+    ->ArgsProduct( { { 6, 8, 10 }, { 0, 1 } } );
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Ten minutes of tank input sampled on a spirited drive
+//!
+//! The level drains steadily by an eighth of full scale an hour. Every few
+//! seconds a corner sets the fuel sloshing from side to side at around 1Hz,
+//! as much as a sixteenth of full scale either way. There is a little ADC
+//! noise on top.
+//!
+///////////////////////////////////////////////////////////////////////////////
+struct DriveTrace
+{
+    std::vector< uint16_t > input;
+    std::vector< double >   level;
+    double                  ratePerHour;
+
+    DriveTrace() : input( 600000 ), level( 600000 )
+    {
+        const double drain = 0x2000 / 3600000.0;
+        uint32_t     seed = 0x13579bdf;
+        size_t       cornerEnd = 0;
+        double       slosh = 0.0;
+        double       period = 1000.0;
+
+        ratePerHour = -drain * 3600000.0;
+
+        for ( size_t i = 0; i < input.size(); i++ )
+        {
+            seed = seed * 1664525 + 1013904223;
+            level[ i ] = 0xA000 - drain * i;
+
+            if ( i >= cornerEnd + 3000 && ( seed & 0x3FF ) == 0 )
+            {
+                cornerEnd = i + 2000 + ( seed >> 10 ) % 6000;
+                slosh = ( seed >> 20 ) % 0x1000;
+                period = 800.0 + ( seed >> 8 ) % 600;
+            }
+
+            double wave =
+                i < cornerEnd ? slosh * sin( 2.0 * M_PI * i / period ) : 0.0;
+            input[ i ] = lround(
+                level[ i ] + wave + ( (int32_t)( seed >> 28 ) * 2 - 15 ) * 8 );
+        }
+    }
+};
+
+// Filter a drive with the EMA and the level estimator at each strength
+static void BM_FilterDrive( benchmark::State& state )
+{
+    uint8_t           k = state.range( 0 );
+    bool              estimate = state.range( 1 );
+    static DriveTrace trace;
+    uint8_t setting = k | ( estimate ? FILTER_ESTIMATOR_FLAG : 0 );
+
+    //
+    // Run the sample path as the gauge does from power on, keeping the
+    // burn rate every second
+    //
+    std::vector< uint16_t > output( trace.input.size() );
+    std::vector< int32_t >  rate( trace.input.size() / 1000 );
+    for ( auto _ : state )
+    {
+        TankFilter filter = {};
+        SetTankFilter( &filter, setting );
+        SeedTankFilter( &filter, trace.input[ 0 ] );
+
+        for ( size_t i = 0; i < trace.input.size(); i++ )
+        {
+            output[ i ] = FilterTankInput( &filter, trace.input[ i ] );
+            if ( i % 1000 == 999 )
+            {
+                rate[ i / 1000 ] = TankFilterRate( &filter );
+            }
+        }
+        benchmark::DoNotOptimize( output.data() );
+    }
+
+    //
+    // Compare with the real level once the filters have had a minute to
+    // settle. Lag is the mean error and noise is what is left over.
+    //
+    double sum = 0.0;
+    double sumSquares = 0.0;
+    double maxError = 0.0;
+    size_t compared = 0;
+    for ( size_t i = 60000; i < output.size(); i++ )
+    {
+        double error = (double)output[ i ] - trace.level[ i ];
+        sum += error;
+        sumSquares += error * error;
+        maxError = fabs( error ) > maxError ? fabs( error ) : maxError;
+        compared++;
+    }
+    double lag = sum / compared;
+
+    double burnSquares = 0.0;
+    for ( size_t i = 60; i < rate.size(); i++ )
+    {
+        double error = rate[ i ] - trace.ratePerHour;
+        burnSquares += error * error;
+    }
+
+    size_t samples = state.iterations() * trace.input.size();
+    state.SetItemsProcessed( samples );
+    state.counters[ "NsPerSample" ] = benchmark::Counter(
+        samples, benchmark::Counter::kIsRate | benchmark::Counter::kInvert );
+    state.counters[ "Lag" ] = lag;
+    state.counters[ "NoiseRms" ] = sqrt( sumSquares / compared - lag * lag );
+    state.counters[ "MaxError" ] = maxError;
+    state.counters[ "BurnRmsPercent" ] = estimate
+        ? 100.0 * sqrt( burnSquares / ( rate.size() - 60 ) ) /
+            -trace.ratePerHour
+        : 0.0;
+}
+BENCHMARK( BM_FilterDrive )
+    ->ArgNames( { "k", "estimator" } )
+    ->ArgsProduct( { { 8, 10, 12, 14, 15 }, { 0, 1 } } );
@@ -0,0 +1,400 @@
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \file
+//! \brief  Benchmark the value mapper module on the host
+//!
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2019 David J. Fiddes
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <benchmark/benchmark.h>
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <x86intrin.h>
+#define READ_CYCLES() __rdtsc()
+#else
+#define READ_CYCLES() 0
+#endif
+
+#include "mapper.h"
+
+const uint16_t LinearFullScale[ MAPSIZE ] = { 0x0000, 0x2000, 0x4000,
+                                              0x6000, 0x8000, 0xA000,
+                                              0xC000, 0xE000, 0xFFFF };
+
+const uint16_t RealInputMap[ MAPSIZE ] = { 0xbb9f, 0xb6b9, 0xa2e1,
+                                           0x8f39, 0x7abc, 0x667b,
+                                           0x4d7e, 0x2cfc, 0x0bfb };
+
+const uint16_t RealOutputMap[ MAPSIZE ] = { 0x1900, 0x3a40, 0x5200,
+                                            0x6d80, 0x8640, 0x9f00,
+                                            0xb7c0, 0xd540, 0xf000 };
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Generate a repeatable spread of tank input values
+//!
+///////////////////////////////////////////////////////////////////////////////
+static std::vector< uint16_t > TankInputs()
+{
+    std::vector< uint16_t > inputs( 4096 );
+    uint32_t                seed = 0x12345678;
+
+    for ( uint16_t& input : inputs )
+    {
+        seed = seed * 1664525 + 1013904223;
+        input = seed >> 16;
+    }
+
+    return inputs;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Generate a drive's worth of filtered tank input values
+//!
+//! The tank drains from full to empty with some sloshing noise on top, much
+//! like the filtered ADC readings logged from a real drive.
+//!
+///////////////////////////////////////////////////////////////////////////////
+static std::vector< uint16_t > DriveInputs()
+{
+    std::vector< uint16_t > inputs( 32768 );
+    uint32_t                seed = 0x12345678;
+    int32_t                 noise = 0;
+
+    for ( size_t i = 0; i < inputs.size(); i++ )
+    {
+        seed = seed * 1664525 + 1013904223;
+        noise += ( (int32_t)( seed >> 24 ) - 128 - noise / 8 ) / 16;
+
+        int32_t input = 0xbb9f - (int32_t)( i * ( 0xbb9f - 0x0bfb ) /
+                                            inputs.size() ) + noise;
+        inputs[ i ] = input < 0 ? 0 : input > 0xFFFF ? 0xFFFF : input;
+    }
+
+    return inputs;
+}
+
+// Map each tank input through both stages with MapValue()
+static void BM_MapValue( benchmark::State& state )
+{
+    std::vector< uint16_t > inputs = TankInputs();
+
+    for ( auto _ : state )
+    {
+        for ( uint16_t input : inputs )
+        {
+            uint16_t actual = MapValue( input, RealInputMap, LinearFullScale );
+            benchmark::DoNotOptimize(
+                MapValue( actual, LinearFullScale, RealOutputMap ) );
+        }
+    }
+
+    state.SetItemsProcessed( state.iterations() * inputs.size() );
+}
+BENCHMARK( BM_MapValue );
+
+// Map each tank input through both stages with the LinearFullScale functions
+static void BM_MapLinearValue( benchmark::State& state )
+{
+    std::vector< uint16_t > inputs = TankInputs();
+
+    for ( auto _ : state )
+    {
+        for ( uint16_t input : inputs )
+        {
+            uint16_t actual = MapValueToLinear( input, RealInputMap );
+            benchmark::DoNotOptimize( MapLinearValue( actual, RealOutputMap ) );
+        }
+    }
+
+    state.SetItemsProcessed( state.iterations() * inputs.size() );
+}
+BENCHMARK( BM_MapLinearValue );
+
+// Map each tank input through both stages with compiled maps
+static void BM_MapCompiledValue( benchmark::State& state )
+{
+    std::vector< uint16_t > inputs = TankInputs();
+
+    CompiledMap inputStage;
+    CompiledMap outputStage;
+    CompileMap( &inputStage, RealInputMap, LinearFullScale );
+    CompileMap( &outputStage, LinearFullScale, RealOutputMap );
+
+    for ( auto _ : state )
+    {
+        for ( uint16_t input : inputs )
+        {
+            uint16_t actual = MapCompiledValue( input, &inputStage );
+            benchmark::DoNotOptimize( MapCompiledValue( actual, &outputStage ) );
+        }
+    }
+
+    state.SetItemsProcessed( state.iterations() * inputs.size() );
+}
+BENCHMARK( BM_MapCompiledValue );
+
+// Measure the cost of recompiling both stages after a map change
+static void BM_CompileMap( benchmark::State& state )
+{
+    CompiledMap inputStage;
+    CompiledMap outputStage;
+
+    for ( auto _ : state )
+    {
+        CompileMap( &inputStage, RealInputMap, LinearFullScale );
+        CompileMap( &outputStage, LinearFullScale, RealOutputMap );
+        benchmark::DoNotOptimize( inputStage );
+        benchmark::DoNotOptimize( outputStage );
+    }
+}
+BENCHMARK( BM_CompileMap );
+
+// Map each tank input straight to the gauge output with a composite map
+static void BM_MapCompositeValue( benchmark::State& state )
+{
+    std::vector< uint16_t > inputs = TankInputs();
+
+    CompiledMap compositeMap;
+    CompileMap( &compositeMap, RealInputMap, RealOutputMap );
+
+    for ( auto _ : state )
+    {
+        for ( uint16_t input : inputs )
+        {
+            benchmark::DoNotOptimize( MapCompiledValue( input, &compositeMap ) );
+        }
+    }
+
+    state.SetItemsProcessed( state.iterations() * inputs.size() );
+}
+BENCHMARK( BM_MapCompositeValue );
+
+// Map a drive straight to the gauge output with a composite map
+static void BM_MapCompositeDrive( benchmark::State& state )
+{
+    std::vector< uint16_t > inputs = DriveInputs();
+
+    CompiledMap compositeMap;
+    CompileMap( &compositeMap, RealInputMap, RealOutputMap );
+
+    for ( auto _ : state )
+    {
+        for ( uint16_t input : inputs )
+        {
+            benchmark::DoNotOptimize( MapCompiledValue( input, &compositeMap ) );
+        }
+    }
+
+    state.SetItemsProcessed( state.iterations() * inputs.size() );
+}
+BENCHMARK( BM_MapCompositeDrive );
+
+// Map a drive straight to the gauge output starting from the last bin found
+static void BM_MapCompositeDriveHinted( benchmark::State& state )
+{
+    std::vector< uint16_t > inputs = DriveInputs();
+
+    CompiledMap compositeMap;
+    CompileMap( &compositeMap, RealInputMap, RealOutputMap );
+
+    uint32_t hits = 0;
+    uint32_t searches = 0;
+
+    for ( auto _ : state )
+    {
+        BinHint hint;
+        ResetBinHint( &hint );
+
+        for ( uint16_t input : inputs )
+        {
+            benchmark::DoNotOptimize(
+                MapCompiledValueHinted( input, &compositeMap, &hint ) );
+        }
+
+        hits += hint.hits;
+        searches += hint.searches;
+    }
+
+    state.SetItemsProcessed( state.iterations() * inputs.size() );
+    state.counters[ "HitRate" ] = searches ? (double)hits / searches : 0.0;
+}
+BENCHMARK( BM_MapCompositeDriveHinted );
+
+// Map each tank input through the input map with a loop of MapValue() calls
+static void BM_MapValueLoop( benchmark::State& state )
+{
+    std::vector< uint16_t > inputs = TankInputs();
+    std::vector< uint16_t > outputs( inputs.size() );
+
+    for ( auto _ : state )
+    {
+        for ( size_t i = 0; i < inputs.size(); i++ )
+        {
+            outputs[ i ] = MapValue( inputs[ i ], RealInputMap, RealOutputMap );
+        }
+        benchmark::DoNotOptimize( outputs.data() );
+    }
+
+    state.SetItemsProcessed( state.iterations() * inputs.size() );
+}
+BENCHMARK( BM_MapValueLoop );
+
+// Map each tank input through the input map as a batch
+static void BM_MapValues( benchmark::State& state )
+{
+    BatchMapper             mapper = (BatchMapper)state.range( 0 );
+    std::vector< uint16_t > inputs = TankInputs();
+    std::vector< uint16_t > outputs( inputs.size() );
+
+    for ( auto _ : state )
+    {
+        if ( !MapValuesUsing(
+                 mapper, inputs.data(), outputs.data(), inputs.size(),
+                 RealInputMap, RealOutputMap ) )
+        {
+            state.SkipWithError( "Not supported on this host" );
+            break;
+        }
+        benchmark::DoNotOptimize( outputs.data() );
+    }
+
+    state.SetItemsProcessed( state.iterations() * inputs.size() );
+}
+BENCHMARK( BM_MapValues )
+    ->Arg( BATCH_MAPPER_SCALAR )
+    ->Arg( BATCH_MAPPER_SSE2 )
+    ->Arg( BATCH_MAPPER_AVX2 );
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  A tank with curved sections and the exact gauge reading for every
+//!         tank input
+//!
+//! The tank is a cylinder on its side with a sender reading linearly from
+//! empty to full. The maps sample the curve at each bin.
+//!
+///////////////////////////////////////////////////////////////////////////////
+struct CurvedTank
+{
+    uint16_t                inputMap[ MAPSIZE ];
+    uint16_t                outputMap[ MAPSIZE ];
+    std::vector< uint16_t > inputs;
+    std::vector< double >   reference;
+
+    static double Volume( double height )
+    {
+        double x = 1.0 - 2.0 * height;
+        return ( acos( x ) - x * sqrt( 1.0 - x * x ) ) / M_PI;
+    }
+
+    static double Input( double height )
+    {
+        return 0xbb9f - ( 0xbb9f - 0x0bfb ) * height;
+    }
+
+    static double Output( double height )
+    {
+        return 0x1900 + ( 0xf000 - 0x1900 ) * Volume( height );
+    }
+
+    CurvedTank()
+    {
+        for ( int bin = 0; bin < MAPSIZE; bin++ )
+        {
+            double height = (double)bin / ( MAPSIZE - 1 );
+            inputMap[ bin ] = lround( Input( height ) );
+            outputMap[ bin ] = lround( Output( height ) );
+        }
+
+        for ( uint32_t input = 0x0bfb; input <= 0xbb9f; input++ )
+        {
+            inputs.push_back( input );
+            reference.push_back(
+                Output( ( 0xbb9f - input ) / (double)( 0xbb9f - 0x0bfb ) ) );
+        }
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Map every input of the curved tank and report the speed and the
+//!         error against the exact curve
+//!
+///////////////////////////////////////////////////////////////////////////////
+template < typename Mapper >
+static void MapCurvedTank( benchmark::State& state, Mapper mapper )
+{
+    CurvedTank              tank;
+    std::vector< uint16_t > outputs( tank.inputs.size() );
+
+    uint64_t cycles = 0;
+    for ( auto _ : state )
+    {
+        uint64_t start = READ_CYCLES();
+        for ( size_t i = 0; i < tank.inputs.size(); i++ )
+        {
+            outputs[ i ] = mapper( tank.inputs[ i ] );
+        }
+        benchmark::DoNotOptimize( outputs.data() );
+        cycles += READ_CYCLES() - start;
+    }
+
+    double maxError = 0.0;
+    double sumSquares = 0.0;
+    for ( size_t i = 0; i < outputs.size(); i++ )
+    {
+        double error = fabs( outputs[ i ] - tank.reference[ i ] );
+        maxError = error > maxError ? error : maxError;
+        sumSquares += error * error;
+    }
+
+    size_t maps = state.iterations() * tank.inputs.size();
+    state.SetItemsProcessed( maps );
+    state.counters[ "CyclesPerMap" ] = maps ? (double)cycles / maps : 0.0;
+    state.counters[ "MaxError" ] = maxError;
+    state.counters[ "RmsError" ] = sqrt( sumSquares / outputs.size() );
+}
+
+// Map a curved tank with straight lines between the bins
+static void BM_MapCurvedTankLinear( benchmark::State& state )
+{
+    CurvedTank  tank;
+    CompiledMap map;
+    CompileMap( &map, tank.inputMap, tank.outputMap );
+
+    MapCurvedTank( state, [&map]( uint16_t input ) {
+        return MapCompiledValue( input, &map );
+    } );
+}
+BENCHMARK( BM_MapCurvedTankLinear );
+
+// Map a curved tank with a monotone cubic through the bins
+static void BM_MapCurvedTankCubic( benchmark::State& state )
+{
+    CurvedTank tank;
+    CubicMap   map;
+    CompileCubicMap( &map, tank.inputMap, tank.outputMap );
+
+    MapCurvedTank( state, [&map]( uint16_t input ) {
+        return MapCubicValue( input, &map );
+    } );
+}
+BENCHMARK( BM_MapCurvedTankCubic );
@@ -0,0 +1,364 @@
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \file
+//! \brief  Benchmark the timing of tank input samples on the host
+//!
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2019 David J. Fiddes
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <benchmark/benchmark.h>
+#include <math.h>
+#include <algorithm>
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "filter.h"
+#include "sampler.h"
+
+//
+//! Time between tank input samples on the gauge
+//
+const uint32_t TickUs = 1024;
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  The lengths of a minute of main loop passes
+//!
+//! Most passes only check the console and take tens of microseconds. Every
+//! so often one sends a character of queued text or runs a mapping, and now
+//! and again a command prints a line and holds the loop up for tens of
+//! milliseconds.
+//!
+///////////////////////////////////////////////////////////////////////////////
+static std::vector< uint32_t > LoopPasses()
+{
+    std::vector< uint32_t > passes;
+    uint32_t                seed = 0x31415927;
+    uint32_t                totalUs = 0;
+
+    while ( totalUs < 60000000 )
+    {
+        seed = seed * 1664525 + 1013904223;
+        uint32_t passUs = 20 + ( seed >> 28 ) * 5;
+        if ( ( seed & 0x3F ) == 0 )
+        {
+            passUs += 400 + ( seed >> 20 ) % 800;
+        }
+        if ( ( seed & 0xFFFF ) == 0 )
+        {
+            passUs += 70000;
+        }
+
+        passes.push_back( passUs );
+        totalUs += passUs;
+    }
+
+    return passes;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Sample the tank input from the main loop once a tick, as the gauge
+//!         did before the sampling interrupt
+//!
+//! The sample is taken on the first pass after the tick is due, and ticks
+//! missed while the loop was held up are skipped.
+//!
+///////////////////////////////////////////////////////////////////////////////
+static void PolledSampling(
+    const std::vector< uint32_t >& passes,
+    TankFilter*                    filter,
+    std::vector< uint32_t >*       takenUs )
+{
+    uint32_t timeUs = 0;
+    uint32_t dueTick = 0;
+
+    for ( uint32_t passUs : passes )
+    {
+        uint32_t tick = timeUs / TickUs;
+        if ( tick >= dueTick )
+        {
+            benchmark::DoNotOptimize( FilterTankInput( filter, 0x8000 ) );
+            takenUs->push_back( timeUs );
+            dueTick = tick + 1;
+        }
+        timeUs += passUs;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Sample the tank input from the tick interrupt into the ring and
+//!         drain it from the main loop every SAMPLE_DRAIN_TICKS
+//!
+///////////////////////////////////////////////////////////////////////////////
+static void InterruptSampling(
+    const std::vector< uint32_t >& passes,
+    TankFilter*                    filter,
+    std::vector< uint32_t >*       takenUs )
+{
+    SampleRing ring = {};
+    uint32_t   timeUs = 0;
+    uint32_t   interruptUs = TickUs;
+    uint32_t   dueTick = 0;
+    uint16_t   tankInput;
+
+    for ( uint32_t passUs : passes )
+    {
+        uint32_t tick = timeUs / TickUs;
+        if ( tick >= dueTick )
+        {
+            DrainSamples( &ring, filter, &tankInput );
+            dueTick = tick + SAMPLE_DRAIN_TICKS;
+        }
+
+        //
+        // The interrupt takes its samples while the pass runs
+        //
+        timeUs += passUs;
+        for ( ; interruptUs <= timeUs; interruptUs += TickUs )
+        {
+            if ( PushSample( &ring, 0x8000 ) )
+            {
+                takenUs->push_back( interruptUs );
+            }
+        }
+    }
+    benchmark::DoNotOptimize( tankInput );
+}
+
+// Measure how evenly the tank input is sampled from the main loop and from
+// the tick interrupt
+static void BM_SampleTiming( benchmark::State& state )
+{
+    bool                    interrupt = state.range( 0 );
+    std::vector< uint32_t > passes = LoopPasses();
+    std::vector< uint32_t > takenUs;
+
+    for ( auto _ : state )
+    {
+        TankFilter filter = {};
+        SetTankFilter( &filter, FILTER_DEFAULT_K );
+        takenUs.clear();
+
+        if ( interrupt )
+        {
+            InterruptSampling( passes, &filter, &takenUs );
+        }
+        else
+        {
+            PolledSampling( passes, &filter, &takenUs );
+        }
+    }
+
+    //
+    // Jitter is how far each period between samples strays from a tick. A
+    // period of several ticks means samples were lost.
+    //
+    double   sumSquares = 0.0;
+    double   maxJitter = 0.0;
+    uint32_t lost = 0;
+    for ( size_t i = 1; i < takenUs.size(); i++ )
+    {
+        uint32_t period = takenUs[ i ] - takenUs[ i - 1 ];
+        uint32_t ticks = ( period + TickUs / 2 ) / TickUs;
+        double   jitter = (double)period - (double)ticks * TickUs;
+
+        sumSquares += jitter * jitter;
+        maxJitter = fabs( jitter ) > maxJitter ? fabs( jitter ) : maxJitter;
+        lost += ticks - 1;
+    }
+
+    size_t samples = state.iterations() * takenUs.size();
+    state.SetItemsProcessed( samples );
+    state.counters[ "NsPerSample" ] = benchmark::Counter(
+        samples, benchmark::Counter::kIsRate | benchmark::Counter::kInvert );
+    state.counters[ "JitterRmsUs" ] = sqrt( sumSquares / takenUs.size() );
+    state.counters[ "MaxJitterUs" ] = maxJitter;
+    state.counters[ "LostPercent" ] =
+        100.0 * lost / ( takenUs.size() + lost );
+}
+BENCHMARK( BM_SampleTiming )->ArgName( "interrupt" )->DenseRange( 0, 1 );
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  A minute of tank input from a drive, one sample a tick
+//!
+//! The inputs are synthetic stand-ins for recorded drives with the ADC noise
+//! and drain rates seen on the car. Where the level jumps the tick it starts
+//! is noted so the latency can be measured.
+//!
+///////////////////////////////////////////////////////////////////////////////
+struct Drive
+{
+    std::vector< uint16_t > input;
+    uint8_t                 setting;
+    size_t                  stepTick;
+
+    Drive( int kind ) : input( 60000000 / TickUs ), setting( 0 ), stepTick( 0 )
+    {
+        uint32_t seed = 0x27182818;
+        size_t   spikeEnd = 0;
+        int32_t  spike = 0;
+
+        for ( size_t i = 0; i < input.size(); i++ )
+        {
+            seed = seed * 1664525 + 1013904223;
+            int32_t noise = ( (int32_t)( seed >> 28 ) - 8 ) * 16;
+            int32_t level = 0x9000;
+
+            if ( kind == 1 || kind == 2 )
+            {
+                // Cruising, with or without sloshing
+                level -= (int32_t)( i / 4 );
+            }
+            else if ( kind == 3 && i >= input.size() / 2 )
+            {
+                // Refuelling after parking for half a minute
+                level = 0x3000 + std::min< int32_t >(
+                                     0x9000 - 0x3000,
+                                     (int32_t)( i - input.size() / 2 ) * 3 );
+            }
+            else if ( kind == 3 )
+            {
+                level = 0x3000;
+            }
+
+            if ( kind == 2 )
+            {
+                if ( i >= spikeEnd && ( seed & 0xFF ) == 0 )
+                {
+                    spike = ( seed & 0x100 ) ? 0x3000 : -0x3000;
+                    spikeEnd = i + 1 + ( seed >> 9 ) % ( MEDIAN_SIZE / 2 );
+                }
+                level += i < spikeEnd ? spike : 0;
+            }
+
+            input[ i ] = level + noise;
+        }
+
+        if ( kind == 2 )
+        {
+            setting = FILTER_MEDIAN_FLAG;
+        }
+        if ( kind == 3 )
+        {
+            stepTick = input.size() / 2;
+        }
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Replay a drive through the sampling interrupt and the ring as the
+//!         gauge runs it, recording the filtered input at each tick
+//!
+//! \returns The number of ticks that were sampled
+//!
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t ReplayDrive(
+    const Drive&             drive,
+    uint8_t                  setting,
+    std::vector< uint16_t >* output )
+{
+    SampleRing ring = {};
+    TankFilter filter = {};
+    uint16_t   tankInput = drive.input[ 0 ];
+    uint32_t   sampled = 0;
+
+    SetTankFilter( &filter, setting );
+    SeedTankFilter( &filter, drive.input[ 0 ] );
+    output->resize( drive.input.size() );
+
+    for ( size_t tick = 0; tick < drive.input.size(); tick++ )
+    {
+        if ( SampleDue( &ring, (uint16_t)tick ) )
+        {
+            PushSample( &ring, drive.input[ tick ] );
+            sampled++;
+        }
+        if ( tick % SAMPLE_DRAIN_TICKS == 0 )
+        {
+            DrainSamples( &ring, &filter, &tankInput );
+        }
+        ( *output )[ tick ] = tankInput;
+    }
+
+    return sampled;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Find the tick the output first gets halfway from where it was at
+//!         a step to where the input ends up
+//!
+///////////////////////////////////////////////////////////////////////////////
+static size_t HalfwayTick(
+    const Drive&                   drive,
+    const std::vector< uint16_t >& y )
+{
+    uint16_t halfway =
+        ( y[ drive.stepTick ] + drive.input[ drive.input.size() - 1 ] ) / 2;
+
+    size_t tick = drive.stepTick;
+    while ( tick < y.size() - 1 && y[ tick ] < halfway )
+    {
+        tick++;
+    }
+
+    return tick;
+}
+
+// Replay drives parked, cruising, sloshing through corners and refuelling
+// with the sample rate fixed and backing off, counting the conversions saved
+// and how far the gauge strays from the full rate
+static void BM_SampleBackoff( benchmark::State& state )
+{
+    Drive   drive( state.range( 0 ) );
+    uint8_t setting = drive.setting | FILTER_DEFAULT_K;
+
+    std::vector< uint16_t > fullOutput;
+    std::vector< uint16_t > backoffOutput;
+    uint32_t                sampled = 0;
+
+    ReplayDrive( drive, setting, &fullOutput );
+    for ( auto _ : state )
+    {
+        sampled = ReplayDrive(
+            drive, setting | FILTER_BACKOFF_FLAG, &backoffOutput );
+    }
+
+    uint32_t maxError = 0;
+    for ( size_t tick = 0; tick < drive.input.size(); tick++ )
+    {
+        uint32_t error = abs( backoffOutput[ tick ] - fullOutput[ tick ] );
+        maxError = error > maxError ? error : maxError;
+    }
+
+    state.SetItemsProcessed( state.iterations() * drive.input.size() );
+    state.counters[ "ConversionsPercent" ] =
+        100.0 * sampled / drive.input.size();
+    state.counters[ "MaxErrorCounts" ] = maxError;
+    if ( drive.stepTick )
+    {
+        state.counters[ "ExtraLatencyMs" ] =
+            ( (double)HalfwayTick( drive, backoffOutput ) -
+              (double)HalfwayTick( drive, fullOutput ) ) *
+            TickUs / 1000.0;
+    }
+}
+BENCHMARK( BM_SampleBackoff )->ArgName( "drive" )->DenseRange( 0, 3 );
@@ -0,0 +1,510 @@
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \file
+//! \brief  Map batches of values through the same pair of maps
+//!
+//! This is intended for host tools processing logged samples rather than the
+//! gauge itself. On x86 hosts the values can be mapped 8 or 16 at a time with
+//! SSE2 or AVX2. Every implementation gives exactly the same results as
+//! MapValue().
+//!
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2019 David J. Fiddes
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <mapper.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#define HAVE_SSE2_MAPPER
+#endif
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#include <immintrin.h>
+#define HAVE_AVX2_MAPPER
+#define AVX2_FUNCTION __attribute__( ( target( "avx2" ) ) )
+#endif
+
+//
+//! A map pair prepared for vectorised mapping
+//
+typedef struct
+{
+    uint16_t        inputMap[ MAPSIZE ]; //!< Input map turned to increase
+    uint16_t        flip;                //!< XORed with values to match
+    const uint16_t* originalInputMap;    //!< Input map as supplied
+    const uint16_t* outputMap;           //!< Output map as supplied
+} BatchMap;
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Map a batch of values one at a time
+//!
+///////////////////////////////////////////////////////////////////////////////
+static void MapValuesScalar(
+    const uint16_t* values,
+    uint16_t*       outputs,
+    size_t          count,
+    const uint16_t* inputMap,
+    const uint16_t* outputMap )
+{
+    for ( size_t i = 0; i < count; i++ )
+    {
+        outputs[ i ] = MapValue( values[ i ], inputMap, outputMap );
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Prepare a pair of maps for vectorised mapping
+//!
+//! A decreasing input map is turned into an increasing one by inverting every
+//! bit of it and of the values mapped through it. This keeps both the bins
+//! found and the interpolation exactly the same.
+//!
+//! Returns false if the maps can't be vectorised and still match MapValue().
+//! This is the case if the input map isn't monotonic, so bins can overlap, or
+//! if the interpolation would overflow 32-bits.
+//!
+///////////////////////////////////////////////////////////////////////////////
+static bool PrepareBatchMap(
+    BatchMap*       map,
+    const uint16_t* inputMap,
+    const uint16_t* outputMap )
+{
+    map->flip = inputMap[ 0 ] < inputMap[ MAPSIZE - 1 ] ? 0x0000 : 0xFFFF;
+    map->originalInputMap = inputMap;
+    map->outputMap = outputMap;
+
+    for ( uint8_t bin = 0; bin < MAPSIZE; bin++ )
+    {
+        map->inputMap[ bin ] = inputMap[ bin ] ^ map->flip;
+    }
+
+    for ( uint8_t bin = 0; bin < MAPSIZE - 1; bin++ )
+    {
+        int32_t inputBinDiff =
+            (int32_t)map->inputMap[ bin + 1 ] - map->inputMap[ bin ];
+        int32_t outputBinDiff =
+            (int32_t)outputMap[ bin + 1 ] - outputMap[ bin ];
+
+        if ( inputBinDiff < 0 )
+        {
+            return false;
+        }
+
+        //
+        // The value difference is at most one less than the bin width
+        //
+        uint64_t valueDiff = inputBinDiff > 0 ? inputBinDiff - 1 : 0;
+        uint64_t magnitude = outputBinDiff < 0 ? -outputBinDiff : outputBinDiff;
+        if ( valueDiff * magnitude > INT32_MAX )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+#if defined( HAVE_SSE2_MAPPER )
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Choose between two vectors lane by lane
+//!
+///////////////////////////////////////////////////////////////////////////////
+static __m128i Select128( __m128i mask, __m128i ifSet, __m128i ifClear )
+{
+    return _mm_or_si128(
+        _mm_and_si128( mask, ifSet ), _mm_andnot_si128( mask, ifClear ) );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Interpolate 4 values within their bins
+//!
+//! The multiply and divide are carried out in double precision which holds the
+//! 32-bit product exactly and is accurate enough that truncating the quotient
+//! gives the same answer as an integer divide.
+//!
+///////////////////////////////////////////////////////////////////////////////
+static __m128i Interpolate4Sse2(
+    __m128i value,
+    __m128i lowerInput,
+    __m128i upperInput,
+    __m128i lowerOutput,
+    __m128i upperOutput )
+{
+    __m128i valueDiff = _mm_sub_epi32( value, lowerInput );
+    __m128i inputBinDiff = _mm_sub_epi32( upperInput, lowerInput );
+    __m128i outputBinDiff = _mm_sub_epi32( upperOutput, lowerOutput );
+
+    __m128d low = _mm_div_pd(
+        _mm_mul_pd(
+            _mm_cvtepi32_pd( valueDiff ), _mm_cvtepi32_pd( outputBinDiff ) ),
+        _mm_cvtepi32_pd( inputBinDiff ) );
+    __m128d high = _mm_div_pd(
+        _mm_mul_pd(
+            _mm_cvtepi32_pd( _mm_srli_si128( valueDiff, 8 ) ),
+            _mm_cvtepi32_pd( _mm_srli_si128( outputBinDiff, 8 ) ) ),
+        _mm_cvtepi32_pd( _mm_srli_si128( inputBinDiff, 8 ) ) );
+
+    __m128i output = _mm_unpacklo_epi64(
+        _mm_cvttpd_epi32( low ), _mm_cvttpd_epi32( high ) );
+
+    return _mm_add_epi32( lowerOutput, output );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Map a batch of values 8 at a time with SSE2
+//!
+//! SSE2 only has signed 16-bit compares so values are biased by 0x8000
+//! before being compared.
+//!
+///////////////////////////////////////////////////////////////////////////////
+static void MapValuesSse2(
+    const uint16_t* values,
+    uint16_t*       outputs,
+    size_t          count,
+    const BatchMap* map )
+{
+    const uint16_t* inputMap = map->inputMap;
+    const uint16_t* outputMap = map->outputMap;
+    const __m128i   bias = _mm_set1_epi16( (short)0x8000 );
+    const __m128i   bias32 = _mm_set1_epi32( 0x8000 );
+    const __m128i   flip = _mm_set1_epi16( (short)map->flip );
+    const __m128i   zero = _mm_setzero_si128();
+
+    size_t i = 0;
+    for ( ; i + 8 <= count; i += 8 )
+    {
+        __m128i value = _mm_xor_si128(
+            _mm_loadu_si128( (const __m128i*)( values + i ) ), flip );
+        __m128i biased = _mm_xor_si128( value, bias );
+
+        //
+        // Start in the first bin and move up to each bin the value is at or
+        // above. As the map is increasing this finds the same bin as
+        // FindBinIncreasing()
+        //
+        __m128i lowerInput = _mm_set1_epi16( (short)inputMap[ 0 ] );
+        __m128i upperInput = _mm_set1_epi16( (short)inputMap[ 1 ] );
+        __m128i lowerOutput = _mm_set1_epi16( (short)outputMap[ 0 ] );
+        __m128i upperOutput = _mm_set1_epi16( (short)outputMap[ 1 ] );
+
+        for ( uint8_t bin = 1; bin < MAPSIZE - 1; bin++ )
+        {
+            __m128i below = _mm_cmplt_epi16(
+                biased, _mm_set1_epi16( (short)( inputMap[ bin ] ^ 0x8000 ) ) );
+
+            lowerInput = Select128(
+                below, lowerInput, _mm_set1_epi16( (short)inputMap[ bin ] ) );
+            upperInput = Select128(
+                below, upperInput,
+                _mm_set1_epi16( (short)inputMap[ bin + 1 ] ) );
+            lowerOutput = Select128(
+                below, lowerOutput, _mm_set1_epi16( (short)outputMap[ bin ] ) );
+            upperOutput = Select128(
+                below, upperOutput,
+                _mm_set1_epi16( (short)outputMap[ bin + 1 ] ) );
+        }
+
+        __m128i low = Interpolate4Sse2(
+            _mm_unpacklo_epi16( value, zero ),
+            _mm_unpacklo_epi16( lowerInput, zero ),
+            _mm_unpacklo_epi16( upperInput, zero ),
+            _mm_unpacklo_epi16( lowerOutput, zero ),
+            _mm_unpacklo_epi16( upperOutput, zero ) );
+        __m128i high = Interpolate4Sse2(
+            _mm_unpackhi_epi16( value, zero ),
+            _mm_unpackhi_epi16( lowerInput, zero ),
+            _mm_unpackhi_epi16( upperInput, zero ),
+            _mm_unpackhi_epi16( lowerOutput, zero ),
+            _mm_unpackhi_epi16( upperOutput, zero ) );
+
+        //
+        // Pack the results back into 16-bits. The pack saturates signed
+        // values so shift into the signed range and back again
+        //
+        __m128i output = _mm_xor_si128(
+            _mm_packs_epi32(
+                _mm_sub_epi32( low, bias32 ), _mm_sub_epi32( high, bias32 ) ),
+            bias );
+
+        //
+        // Clamp values outside the map. Any result worked out for them is
+        // meaningless
+        //
+        __m128i belowFirst = _mm_cmplt_epi16(
+            biased, _mm_set1_epi16( (short)( inputMap[ 0 ] ^ 0x8000 ) ) );
+        __m128i belowLast = _mm_cmplt_epi16(
+            biased,
+            _mm_set1_epi16( (short)( inputMap[ MAPSIZE - 1 ] ^ 0x8000 ) ) );
+
+        output = Select128(
+            belowFirst, _mm_set1_epi16( (short)outputMap[ 0 ] ), output );
+        output = Select128(
+            belowLast, output,
+            _mm_set1_epi16( (short)outputMap[ MAPSIZE - 1 ] ) );
+
+        _mm_storeu_si128( (__m128i*)( outputs + i ), output );
+    }
+
+    MapValuesScalar(
+        values + i, outputs + i, count - i, map->originalInputMap, outputMap );
+}
+
+#endif // HAVE_SSE2_MAPPER
+
+#if defined( HAVE_AVX2_MAPPER )
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Scale 4 value differences by their bin slopes
+//!
+//! As with Interpolate4Sse2() this is done in double precision
+//!
+///////////////////////////////////////////////////////////////////////////////
+AVX2_FUNCTION static __m128i Divide4Avx2(
+    __m128i valueDiff,
+    __m128i inputBinDiff,
+    __m128i outputBinDiff )
+{
+    __m256d product = _mm256_mul_pd(
+        _mm256_cvtepi32_pd( valueDiff ), _mm256_cvtepi32_pd( outputBinDiff ) );
+
+    return _mm256_cvttpd_epi32(
+        _mm256_div_pd( product, _mm256_cvtepi32_pd( inputBinDiff ) ) );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Interpolate 8 values within their bins
+//!
+//! This works the same way as Interpolate4Sse2(). The results are packed into
+//! 16-bits.
+//!
+///////////////////////////////////////////////////////////////////////////////
+AVX2_FUNCTION static __m128i Interpolate8Avx2(
+    __m128i value,
+    __m128i lowerInput,
+    __m128i upperInput,
+    __m128i lowerOutput,
+    __m128i upperOutput )
+{
+    __m256i lowerInput32 = _mm256_cvtepu16_epi32( lowerInput );
+    __m256i lowerOutput32 = _mm256_cvtepu16_epi32( lowerOutput );
+    __m256i valueDiff =
+        _mm256_sub_epi32( _mm256_cvtepu16_epi32( value ), lowerInput32 );
+    __m256i inputBinDiff = _mm256_sub_epi32(
+        _mm256_cvtepu16_epi32( upperInput ), lowerInput32 );
+    __m256i outputBinDiff = _mm256_sub_epi32(
+        _mm256_cvtepu16_epi32( upperOutput ), lowerOutput32 );
+
+    __m128i low = Divide4Avx2(
+        _mm256_castsi256_si128( valueDiff ),
+        _mm256_castsi256_si128( inputBinDiff ),
+        _mm256_castsi256_si128( outputBinDiff ) );
+    __m128i high = Divide4Avx2(
+        _mm256_extracti128_si256( valueDiff, 1 ),
+        _mm256_extracti128_si256( inputBinDiff, 1 ),
+        _mm256_extracti128_si256( outputBinDiff, 1 ) );
+
+    __m256i output =
+        _mm256_inserti128_si256( _mm256_castsi128_si256( low ), high, 1 );
+    output = _mm256_add_epi32( lowerOutput32, output );
+
+    return _mm_packus_epi32(
+        _mm256_castsi256_si128( output ),
+        _mm256_extracti128_si256( output, 1 ) );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Map a batch of values 16 at a time with AVX2
+//!
+//! This works the same way as MapValuesSse2()
+//!
+///////////////////////////////////////////////////////////////////////////////
+AVX2_FUNCTION static void MapValuesAvx2(
+    const uint16_t* values,
+    uint16_t*       outputs,
+    size_t          count,
+    const BatchMap* map )
+{
+    const uint16_t* inputMap = map->inputMap;
+    const uint16_t* outputMap = map->outputMap;
+    const __m256i   bias = _mm256_set1_epi16( (short)0x8000 );
+    const __m256i   flip = _mm256_set1_epi16( (short)map->flip );
+
+    size_t i = 0;
+    for ( ; i + 16 <= count; i += 16 )
+    {
+        __m256i value = _mm256_xor_si256(
+            _mm256_loadu_si256( (const __m256i*)( values + i ) ), flip );
+        __m256i biased = _mm256_xor_si256( value, bias );
+
+        __m256i lowerInput = _mm256_set1_epi16( (short)inputMap[ 0 ] );
+        __m256i upperInput = _mm256_set1_epi16( (short)inputMap[ 1 ] );
+        __m256i lowerOutput = _mm256_set1_epi16( (short)outputMap[ 0 ] );
+        __m256i upperOutput = _mm256_set1_epi16( (short)outputMap[ 1 ] );
+
+        for ( uint8_t bin = 1; bin < MAPSIZE - 1; bin++ )
+        {
+            __m256i below = _mm256_cmpgt_epi16(
+                _mm256_set1_epi16( (short)( inputMap[ bin ] ^ 0x8000 ) ),
+                biased );
+
+            lowerInput = _mm256_blendv_epi8(
+                _mm256_set1_epi16( (short)inputMap[ bin ] ), lowerInput,
+                below );
+            upperInput = _mm256_blendv_epi8(
+                _mm256_set1_epi16( (short)inputMap[ bin + 1 ] ), upperInput,
+                below );
+            lowerOutput = _mm256_blendv_epi8(
+                _mm256_set1_epi16( (short)outputMap[ bin ] ), lowerOutput,
+                below );
+            upperOutput = _mm256_blendv_epi8(
+                _mm256_set1_epi16( (short)outputMap[ bin + 1 ] ), upperOutput,
+                below );
+        }
+
+        __m128i low = Interpolate8Avx2(
+            _mm256_castsi256_si128( value ),
+            _mm256_castsi256_si128( lowerInput ),
+            _mm256_castsi256_si128( upperInput ),
+            _mm256_castsi256_si128( lowerOutput ),
+            _mm256_castsi256_si128( upperOutput ) );
+        __m128i high = Interpolate8Avx2(
+            _mm256_extracti128_si256( value, 1 ),
+            _mm256_extracti128_si256( lowerInput, 1 ),
+            _mm256_extracti128_si256( upperInput, 1 ),
+            _mm256_extracti128_si256( lowerOutput, 1 ),
+            _mm256_extracti128_si256( upperOutput, 1 ) );
+
+        __m256i output =
+            _mm256_inserti128_si256( _mm256_castsi128_si256( low ), high, 1 );
+
+        __m256i belowFirst = _mm256_cmpgt_epi16(
+            _mm256_set1_epi16( (short)( inputMap[ 0 ] ^ 0x8000 ) ), biased );
+        __m256i belowLast = _mm256_cmpgt_epi16(
+            _mm256_set1_epi16( (short)( inputMap[ MAPSIZE - 1 ] ^ 0x8000 ) ),
+            biased );
+
+        output = _mm256_blendv_epi8(
+            output, _mm256_set1_epi16( (short)outputMap[ 0 ] ), belowFirst );
+        output = _mm256_blendv_epi8(
+            _mm256_set1_epi16( (short)outputMap[ MAPSIZE - 1 ] ), output,
+            belowLast );
+
+        _mm256_storeu_si256( (__m256i*)( outputs + i ), output );
+    }
+
+    MapValuesScalar(
+        values + i, outputs + i, count - i, map->originalInputMap, outputMap );
+}
+
+#endif // HAVE_AVX2_MAPPER
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Map a batch of values with a specific implementation
+//!
+//! Returns false if the implementation isn't available on this host. Maps
+//! that can't be vectorised are mapped one value at a time.
+//!
+///////////////////////////////////////////////////////////////////////////////
+bool MapValuesUsing(
+    BatchMapper     mapper,
+    const uint16_t* values,
+    uint16_t*       outputs,
+    size_t          count,
+    const uint16_t* inputMap,
+    const uint16_t* outputMap )
+{
+    switch ( mapper )
+    {
+    case BATCH_MAPPER_SCALAR:
+        MapValuesScalar( values, outputs, count, inputMap, outputMap );
+        return true;
+
+#if defined( HAVE_SSE2_MAPPER )
+    case BATCH_MAPPER_SSE2:
+    {
+        BatchMap map;
+        if ( PrepareBatchMap( &map, inputMap, outputMap ) )
+        {
+            MapValuesSse2( values, outputs, count, &map );
+        }
+        else
+        {
+            MapValuesScalar( values, outputs, count, inputMap, outputMap );
+        }
+        return true;
+    }
+#endif
+
+#if defined( HAVE_AVX2_MAPPER )
+    case BATCH_MAPPER_AVX2:
+    {
+        if ( !__builtin_cpu_supports( "avx2" ) )
+        {
+            return false;
+        }
+
+        BatchMap map;
+        if ( PrepareBatchMap( &map, inputMap, outputMap ) )
+        {
+            MapValuesAvx2( values, outputs, count, &map );
+        }
+        else
+        {
+            MapValuesScalar( values, outputs, count, inputMap, outputMap );
+        }
+        return true;
+    }
+#endif
+
+    default:
+        return false;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Map a batch of values with the fastest implementation available
+//!
+//! This gives exactly the same results as calling MapValue() for each value.
+//!
+///////////////////////////////////////////////////////////////////////////////
+void MapValues(
+    const uint16_t* values,
+    uint16_t*       outputs,
+    size_t          count,
+    const uint16_t* inputMap,
+    const uint16_t* outputMap )
+{
+    if ( !MapValuesUsing(
+             BATCH_MAPPER_AVX2, values, outputs, count, inputMap, outputMap ) &&
+         !MapValuesUsing(
+             BATCH_MAPPER_SSE2, values, outputs, count, inputMap, outputMap ) )
+    {
+        MapValuesScalar( values, outputs, count, inputMap, outputMap );
+    }
+}
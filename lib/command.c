@@ -20,8 +20,12 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "command.h"
+#include "filter.h"
 #include "hal.h"
+#include "lookup.h"
 #include "mapper.h"
+#include "sampler.h"
+#include "scheduler.h"
 #include <ctype.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -42,18 +46,148 @@ static uint16_t s_inputMap[ MAPSIZE ];
 //
 static uint16_t s_outputMap[ MAPSIZE ];
 
+//
+//! Composite of the input and output maps taking the tank input directly to
+//! the gauge output. This must be recompiled whenever either map changes
+//
+static CompiledMap s_compositeMap;
+
+//
+//! Flag to indicate the output map never turns back on itself so a gauge
+//! output can be turned back into an actual value with a binary search. This
+//! must be updated whenever the output map changes
+//
+static bool s_outputMonotonic;
+
+//
+//! Bin of the composite map the last tank input was found in
+//
+static BinHint s_compositeHint;
+
+//
+//! Flag to indicate the lookup table in persistent storage was built from the
+//! current maps and can be used in place of the composite map
+//
+static bool s_lookupValid;
+
 //
 //! Low fuel warning level - an actual fuel value below this should turn
 //! on the low fuel light
 //
 static uint16_t s_lowFuelLevel;
 
+//
+//! Strength of the tank input filter and whether the median filter is used.
+//! This is saved along with the maps
+//
+static uint8_t s_filterSetting;
+
+//
+//! The tank input value equivalent to the low fuel level. Depending on the
+//! direction of the input map the low fuel light is on at or below this value
+//! or at or above it
+//
+static uint16_t s_lowFuelInput;
+
+//
+//! The last tank input mapped and the values it was mapped to. The filtered
+//! tank input rarely changes from one sample to the next so these let the
+//! mapping and the peripheral writes be skipped. The actual value is only
+//! worked out when logging
+//
+static uint16_t s_lastInput;
+static uint16_t s_lastActual;
+static uint16_t s_lastOutput;
+
+//
+//! Flag to indicate the last mapped values still match the maps and outputs.
+//! This must be cleared whenever either changes
+//
+static bool s_lastValid;
+
+//
+//! Flag to indicate whether the last values were mapped with logging
+//
+static bool s_lastLogging;
+
+//
+//! Number of samples mapped and how many of those were skipped as the tank
+//! input hadn't changed. Both are halved before they can wrap
+//
+static uint16_t s_sampleCount;
+static uint16_t s_unchangedCount;
+
 //
 //! Continuous Mode enables output of values as they are mapped to ease
 //! calibration
 //
 static uint16_t s_continuousMode;
 
+//
+//! Length of the command line buffer including its terminator. The longest
+//! commands, such as "i 64 ffff" with its two digit decimal bin, are nine
+//! characters so fit with two to spare.
+//
+#define LINE_BUFFER_LENGTH 12
+
+//
+//! The command line typed so far
+//
+static char    s_lineBuffer[ LINE_BUFFER_LENGTH ];
+static uint8_t s_lineLength;
+
+//
+//! Ticks between each mapping of the tank input and between each update of
+//! the gauge output and low fuel light
+//
+static uint8_t s_mappingTicks;
+static uint8_t s_outputTicks;
+
+//
+//! The low fuel light state from the last mapping
+//
+static bool s_lowFuelOn;
+
+//
+//! Flag to indicate the last mapping hasn't been written to the gauge output
+//! and low fuel light yet
+//
+static bool s_outputPending;
+
+//
+//! Ticks the low fuel light is on for and then off for when flashing to show
+//! a tank input error
+//
+#define ERROR_FLASH_TICKS 1000
+
+//
+//! Flag to indicate the last mapping failed because of a tank input error
+//
+static bool s_inputError;
+
+//
+//! Flag to indicate the low fuel light is on for an error flash
+//
+static bool s_errorFlashOn;
+
+//
+//! The gauge's tasks
+//
+enum
+{
+    SAMPLE_TASK,
+    MAPPING_TASK,
+    OUTPUT_TASK,
+    SERIAL_TASK,
+    ERROR_FLASH_TASK,
+    TASK_COUNT
+};
+
+//
+//! The tick each task is next due at
+//
+static uint16_t s_taskDue[ TASK_COUNT ];
+
 ///////////////////////////////////////////////////////////////////////////////
 //!
 //! \brief  Print a short uint16_t value as text to the console
@@ -91,9 +225,19 @@ static void PrintBin( uint8_t bin )
 {
     if ( bin <= MAPSIZE )
     {
-        char buf[ 2 ];
-        buf[ 0 ] = '0' + bin;
-        buf[ 1 ] = '\0';
+        char    buf[ 3 ];
+        uint8_t i = 0;
+
+        //
+        // Maps have at most 65 bins so need two digits at most
+        //
+        if ( bin >= 10 )
+        {
+            buf[ i++ ] = '0' + bin / 10;
+        }
+        buf[ i++ ] = '0' + bin % 10;
+        buf[ i ] = '\0';
+
         HAL_PrintText( buf );
     }
 }
@@ -102,6 +246,9 @@ static void PrintBin( uint8_t bin )
 //!
 //! \brief  Parse a uint16_t value from the supplied string in hex
 //!
+//! Returns the position of the character that ended the value, which may be
+//! the terminator, or NULL if there was no value
+//!
 ///////////////////////////////////////////////////////////////////////////////
 static char* ParseValue( const char* str, uint16_t* value )
 {
@@ -120,8 +267,10 @@ static char* ParseValue( const char* str, uint16_t* value )
     //
     // while there are hex digits load them in - extra digits will be ignored
     //
-    while ( isxdigit( ch = *str++ ) )
+    while ( isxdigit( ch = *str ) )
     {
+        str++;
+
         // Support both upper and lower case hex
         if ( isupper( ch ) )
         {
@@ -157,28 +306,39 @@ static char* ParseValue( const char* str, uint16_t* value )
 //!
 //! \brief  Parse a mapping bin value
 //!
+//! Returns the position of the character that ended the bin, which may be
+//! the terminator, or NULL if there was no bin
 //!
 ///////////////////////////////////////////////////////////////////////////////
 static char* ParseBin( const char* str, uint8_t* bin )
 {
-    char    ch;
-    bool    success = false;
-    uint8_t tempbin = 0;
+    char     ch;
+    bool     success = false;
+    uint16_t tempbin = 0;
 
     while ( isspace( *str ) )
     {
         str++;
     }
 
-    while ( isdigit( ch = *str++ ) )
+    while ( isdigit( ch = *str ) )
     {
-        tempbin = tempbin * 10 + ( ch - '0' );
+        str++;
+
+        //
+        // Stop accumulating once the bin is out of range so it can't wrap
+        // back into range
+        //
+        if ( tempbin <= MAPSIZE )
+        {
+            tempbin = tempbin * 10 + ( ch - '0' );
+        }
         success = true;
     }
 
     if ( success )
     {
-        *bin = tempbin;
+        *bin = tempbin > MAPSIZE ? MAPSIZE : tempbin;
         return (char*)str;
     }
     else
@@ -187,17 +347,62 @@ static char* ParseBin( const char* str, uint8_t* bin )
     }
 }
 
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Work out how much of a full tank is being used an hour
+//!
+//! The rate the tank input is changing at is projected an hour ahead and
+//! both ends are taken through the input map. Zero is shown unless fuel is
+//! being used.
+//!
+///////////////////////////////////////////////////////////////////////////////
+static uint16_t FuelBurnPerHour( uint16_t input )
+{
+    int32_t rate = HAL_GetTankRate();
+
+    if ( input == TANK_INPUT_ERROR || rate == 0 )
+    {
+        return 0;
+    }
+
+    int32_t later = (int32_t)input + rate;
+    if ( later < 0 )
+    {
+        later = 0;
+    }
+    else if ( later >= TANK_INPUT_ERROR )
+    {
+        later = TANK_INPUT_ERROR - 1;
+    }
+
+    uint16_t now = MapFoldedValueToLinear( input, s_inputMap );
+    uint16_t then = MapFoldedValueToLinear( (uint16_t)later, s_inputMap );
+
+    return now > then ? now - then : 0;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 //!
 //! \brief  Display current tank input value and output gauge value
 //!
+//! The actual value implied by the gauge output is shown alongside it, as is
+//! the fraction of a full tank being used an hour when the level estimator
+//! is tracking it
+//!
 ///////////////////////////////////////////////////////////////////////////////
 static bool ProcessDisplayCommand()
 {
+    uint16_t input = HAL_GetTankInput();
+    uint16_t output = HAL_GetGaugeOutput();
+
     HAL_PrintText( "Tank: 0x" );
-    PrintValue( HAL_GetTankInput() );
+    PrintValue( input );
     HAL_PrintText( " Gauge: 0x" );
-    PrintValue( HAL_GetGaugeOutput() );
+    PrintValue( output );
+    HAL_PrintText( " Actual: 0x" );
+    PrintValue( GaugeOutputToActual( output ) );
+    HAL_PrintText( " Burn: 0x" );
+    PrintValue( FuelBurnPerHour( input ) );
     HAL_PrintText( " Mode: " );
     HAL_PrintText( IsRunning() ? "Run" : "Program" );
     HAL_PrintNewline();
@@ -225,6 +430,8 @@ static bool ProcessGaugeOutputCommand( const char* command )
     if ( ParseValue( command, &output ) )
     {
         HAL_SetGaugeOutput( output );
+        s_lastValid = false;
+        s_outputPending = false;
         return true;
     }
     else
@@ -233,13 +440,61 @@ static bool ProcessGaugeOutputCommand( const char* command )
     }
 }
 
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Find the tank input value equivalent to the low fuel level
+//!
+//! If the input stage is monotonic a binary search can find the furthest tank
+//! input value from the empty end of the map which still maps to an actual
+//! value at or below the low fuel level. Comparing tank input values against
+//! this gives exactly the same result as comparing actual values. Input maps
+//! that turn back on themselves can't use a single threshold.
+//!
+///////////////////////////////////////////////////////////////////////////////
+static uint16_t FindLowFuelInput()
+{
+    //
+    // Search for the boundary between low and not low fuel. The empty end of
+    // the map always maps to zero so it is always low fuel. The other end
+    // starts one step beyond the range of tank input values
+    //
+    int32_t low = s_compositeMap.increasing ? 0x0000 : 0xFFFF;
+    int32_t high = s_compositeMap.increasing ? 0x10000 : -1;
+
+    while ( ( low > high ? low - high : high - low ) > 1 )
+    {
+        int32_t middle = ( low + high ) / 2;
+
+        if ( MapFoldedValueToLinear( middle, s_inputMap ) <= s_lowFuelLevel )
+        {
+            low = middle;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return (uint16_t)low;
+}
+
+///////////////////////////////////////////////////////////////////////////////
 //!
-//! \brief  A constant map that can be used as a map which transforms a value to
-//! or from a full scale uint16t_6
+//! \brief  Rebuild the composite map and low fuel input after a map change
 //!
-const uint16_t LinearFullScale[ MAPSIZE ] = { 0x0000, 0x2000, 0x4000,
-                                              0x6000, 0x8000, 0xA000,
-                                              0xC000, 0xE000, 0xFFFF };
+//! The input map takes the tank input to LinearFullScale and the output map
+//! takes LinearFullScale to the gauge output. As both stages share the
+//! LinearFullScale bins the composite of the two is simply the input map
+//! bins mapped straight onto the output map bins.
+//!
+///////////////////////////////////////////////////////////////////////////////
+static void CompileMaps()
+{
+    CompileMap( &s_compositeMap, s_inputMap, s_outputMap );
+    s_outputMonotonic = IsMapMonotonic( s_outputMap );
+    s_lowFuelInput = FindLowFuelInput();
+    s_lastValid = false;
+}
 
 ///////////////////////////////////////////////////////////////////////////////
 //!
@@ -259,30 +514,106 @@ static bool ProcessMapping( bool logging )
     }
 
     //
-    // Map the value normally
+    // Nothing needs to be mapped or written if we have already mapped this
+    // input in the same way
     //
-    uint16_t actual = MapValue( input, s_inputMap, LinearFullScale );
+    bool unchanged =
+        s_lastValid && input == s_lastInput && logging == s_lastLogging;
+
+    if ( s_sampleCount == UINT16_MAX )
+    {
+        s_sampleCount >>= 1;
+        s_unchangedCount >>= 1;
+    }
+    s_sampleCount++;
+
+    if ( unchanged )
+    {
+        s_unchangedCount++;
+    }
+    else if ( !logging )
+    {
+        //
+        // Map the value normally with a single lookup through the saved
+        // lookup table or composite map as the actual value isn't needed
+        //
+        if ( !s_compositeMap.monotonic )
+        {
+            s_lowFuelOn =
+                MapFoldedValueToLinear( input, s_inputMap ) <= s_lowFuelLevel;
+        }
+        else if ( s_compositeMap.increasing )
+        {
+            s_lowFuelOn = input <= s_lowFuelInput;
+        }
+        else
+        {
+            s_lowFuelOn = input >= s_lowFuelInput;
+        }
+
+        if ( s_lookupValid )
+        {
+            s_lastOutput = LookupValue( input );
+        }
+        else
+        {
+            s_lastOutput = MapCompiledValueHinted(
+                input, &s_compositeMap, &s_compositeHint );
+        }
+    }
+    else
+    {
+        //
+        // Map through the input and output maps in turn so we can log the
+        // actual value. As one side of each map is always LinearFullScale we
+        // can use the cheaper specialised mapping functions
+        //
+        s_lastActual = MapFoldedValueToLinear( input, s_inputMap );
 
-    HAL_SetLowFuelLight( actual <= s_lowFuelLevel );
+        s_lowFuelOn = s_lastActual <= s_lowFuelLevel;
 
-    uint16_t output = MapValue( actual, LinearFullScale, s_outputMap );
+        s_lastOutput = MapLinearValue( s_lastActual, s_outputMap );
+    }
 
-    HAL_SetGaugeOutput( output );
+    if ( !unchanged )
+    {
+        s_outputPending = true;
+        s_lastInput = input;
+        s_lastLogging = logging;
+        s_lastValid = true;
+    }
 
     if ( logging )
     {
         HAL_PrintText( "Tank: 0x" );
         PrintValue( input );
         HAL_PrintText( " Actual: 0x" );
-        PrintValue( actual );
+        PrintValue( s_lastActual );
         HAL_PrintText( " Gauge: 0x" );
-        PrintValue( output );
+        PrintValue( s_lastOutput );
         HAL_PrintNewline();
     }
 
     return true;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Write the last mapping to the gauge output and low fuel light
+//!
+//! Nothing is written if they already show it
+//!
+///////////////////////////////////////////////////////////////////////////////
+static void UpdateOutputs()
+{
+    if ( s_outputPending )
+    {
+        HAL_SetGaugeOutput( s_lastOutput );
+        HAL_SetLowFuelLight( s_lowFuelOn );
+        s_outputPending = false;
+    }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 //!
 //! \brief  Load our input and output maps
@@ -290,18 +621,60 @@ static bool ProcessMapping( bool logging )
 ///////////////////////////////////////////////////////////////////////////////
 static bool ProcessLoadCommand()
 {
-    HAL_LoadMaps( s_inputMap, s_outputMap, &s_lowFuelLevel );
+    HAL_LoadMaps(
+        s_inputMap, s_outputMap, &s_lowFuelLevel, &s_filterSetting,
+        &s_mappingTicks, &s_outputTicks );
+
+    //
+    // Fall back to the default filter and rates if none have been saved
+    //
+    if ( !IS_VALID_FILTER_SETTING( s_filterSetting ) )
+    {
+        s_filterSetting = FILTER_DEFAULT_K;
+    }
+    HAL_SetTankFilter( s_filterSetting );
+
+    if ( !IS_VALID_RATE_TICKS( s_mappingTicks ) )
+    {
+        s_mappingTicks = DEFAULT_MAPPING_TICKS;
+    }
+    if ( !IS_VALID_RATE_TICKS( s_outputTicks ) )
+    {
+        s_outputTicks = DEFAULT_OUTPUT_TICKS;
+    }
+
+    CompileMaps();
+
+    //
+    // Only use the lookup table if every entry matches the loaded maps
+    //
+    s_lookupValid = CheckLookupTable( &s_compositeMap );
     return true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 //!
-//! \brief  Save our input and output maps
+//! \brief  Save our input and output maps along with the lookup table
+//!         generated from them
 //!
 ///////////////////////////////////////////////////////////////////////////////
 static bool ProcessSaveCommand()
 {
-    HAL_SaveMaps( s_inputMap, s_outputMap, s_lowFuelLevel );
+    HAL_SaveMaps(
+        s_inputMap, s_outputMap, s_lowFuelLevel, s_filterSetting,
+        s_mappingTicks, s_outputTicks );
+
+    //
+    // Only rebuild the lookup table if it doesn't match the maps to avoid
+    // wearing out the flash
+    //
+    if ( !CheckLookupTable( &s_compositeMap ) )
+    {
+        BuildLookupTable( &s_compositeMap );
+    }
+    s_lookupValid = true;
+    s_lastValid = false;
+
     return true;
 }
 
@@ -319,7 +692,16 @@ static bool ProcessMapDisplayCommand()
         HAL_PrintText( "] : 0x" );
         PrintValue( s_inputMap[ i ] );
         HAL_PrintText( " : 0x" );
-        PrintValue( LinearFullScale[ i ] );
+        PrintValue( LINEAR_BIN_VALUE( i ) );
+
+        //
+        // Flag segments where a tank input could be read as more than one
+        // level
+        //
+        if ( i < MAPSIZE - 1 && IsSegmentAmbiguous( s_inputMap, i ) )
+        {
+            HAL_PrintText( " Ambiguous" );
+        }
         HAL_PrintNewline();
     }
 
@@ -328,7 +710,7 @@ static bool ProcessMapDisplayCommand()
         HAL_PrintText( "Output[" );
         PrintBin( i );
         HAL_PrintText( "] : 0x" );
-        PrintValue( LinearFullScale[ i ] );
+        PrintValue( LINEAR_BIN_VALUE( i ) );
         HAL_PrintText( " : 0x" );
         PrintValue( s_outputMap[ i ] );
         HAL_PrintNewline();
@@ -338,6 +720,16 @@ static bool ProcessMapDisplayCommand()
     PrintValue( s_lowFuelLevel );
     HAL_PrintNewline();
 
+    HAL_PrintText( "Filter : 0x" );
+    PrintValue( s_filterSetting );
+    HAL_PrintNewline();
+
+    HAL_PrintText( "Rates : 0x" );
+    PrintValue( s_mappingTicks );
+    HAL_PrintText( " : 0x" );
+    PrintValue( s_outputTicks );
+    HAL_PrintNewline();
+
     return true;
 }
 
@@ -374,6 +766,34 @@ static bool ProcessModifyMapValueCommand( const char* command, uint16_t* map )
     // With valid input we can now modify the map
     //
     map[ bin ] = value;
+    CompileMaps();
+
+    //
+    // The lookup table no longer matches the maps until they are saved again
+    //
+    s_lookupValid = false;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Display the run loop statistics
+//!
+///////////////////////////////////////////////////////////////////////////////
+static bool ProcessStatisticsCommand()
+{
+    HAL_PrintText( "Samples: 0x" );
+    PrintValue( s_sampleCount );
+    HAL_PrintText( " Unchanged: 0x" );
+    PrintValue( s_unchangedCount );
+    HAL_PrintText( " Bin Hits: 0x" );
+    PrintValue( s_compositeHint.hits );
+    HAL_PrintText( "/0x" );
+    PrintValue( s_compositeHint.searches );
+    HAL_PrintText( " Lost: 0x" );
+    PrintValue( HAL_GetLostCharacters() );
+    HAL_PrintNewline();
+
     return true;
 }
 
@@ -388,7 +808,8 @@ static void ProcessUsageDisplay()
         "Usage:\r\n"
         "p\t\t- Program mode\r\n"
         "r\t\t- Run mode\r\n"
-        "d\t\t- Display current tank input value and output gauge value\r\n"
+        "d\t\t- Display current tank input value, output gauge value and "
+        "actual value\r\n"
         "g <Value>   \t- Output raw gauge value\r\n"
         "t\t\t- One shot test map the current tank input to the gauge "
         "output\r\n"
@@ -399,7 +820,13 @@ static void ProcessUsageDisplay()
         "s\t\t- Save input and output maps to persistent storage\r\n"
         "l\t\t- Load input and output maps from persistent storage\r\n"
         "f <Value>   \t- Set the low fuel limit\r\n"
+        "k <Value>   \t- Set the tank input filter strength (0 is off, "
+        "+10 backs off, +20 estimates burn, +40 adapts, +80 adds the "
+        "median)\r\n"
+        "e <Map> <Gauge> - Set the ticks between mappings and between gauge "
+        "updates\r\n"
         "c\t\t- Continuously output values as the gauge runs\r\n"
+        "x\t\t- Display run loop statistics\r\n"
         "u\t\t- This usage information\r\n" );
     HAL_PrintNewline();
 }
@@ -424,6 +851,7 @@ static bool ProcessLowFuelLevel( const char* command )
     if ( ParseValue( command, &lowFuelLevel ) )
     {
         s_lowFuelLevel = lowFuelLevel;
+        CompileMaps();
         return true;
     }
     else
@@ -432,6 +860,78 @@ static bool ProcessLowFuelLevel( const char* command )
     }
 }
 
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Set the strength of the tank input filter
+//!
+//! A k of zero turns the filter off
+//!
+///////////////////////////////////////////////////////////////////////////////
+static bool ProcessFilterCommand( const char* command )
+{
+    //
+    // Fail immediately if we are running
+    //
+    if ( s_running )
+    {
+        return false;
+    }
+
+    uint16_t setting;
+
+    if ( ParseValue( command, &setting ) &&
+         IS_VALID_FILTER_SETTING( setting ) )
+    {
+        s_filterSetting = (uint8_t)setting;
+        HAL_SetTankFilter( s_filterSetting );
+        return true;
+    }
+    else
+    {
+        return false;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Set the ticks between mappings and between gauge updates
+//!
+///////////////////////////////////////////////////////////////////////////////
+static bool ProcessRatesCommand( const char* command )
+{
+    //
+    // Fail immediately if we are running
+    //
+    if ( s_running )
+    {
+        return false;
+    }
+
+    uint16_t mappingTicks;
+    uint16_t outputTicks;
+
+    char* newpos = ParseValue( command, &mappingTicks );
+    if ( newpos == NULL )
+    {
+        return false;
+    }
+
+    if ( !ParseValue( newpos, &outputTicks ) )
+    {
+        return false;
+    }
+
+    if ( !IS_VALID_RATE_TICKS( mappingTicks ) ||
+         !IS_VALID_RATE_TICKS( outputTicks ) )
+    {
+        return false;
+    }
+
+    s_mappingTicks = (uint8_t)mappingTicks;
+    s_outputTicks = (uint8_t)outputTicks;
+    return true;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 //!
 //! \brief  Toggle continuous logging of values as they are mapped
@@ -447,10 +947,17 @@ static bool ProcessContinuousMode()
 //!
 //! \brief  Initialise the gauge and get it ready to run
 //!
+//! The tank input filters are seeded from the current tank input so the
+//! first call to RunGauge() drives the gauge to the right level
+//!
 ///////////////////////////////////////////////////////////////////////////////
 void InitialiseGauge()
 {
-    HAL_LoadMaps( s_inputMap, s_outputMap, &s_lowFuelLevel );
+    ProcessLoadCommand();
+    HAL_SeedTankFilter();
+    ResetBinHint( &s_compositeHint );
+    s_sampleCount = 0;
+    s_unchangedCount = 0;
     s_running = true;
     s_continuousMode = false;
 }
@@ -493,6 +1000,7 @@ bool ProcessCommand( const char* command )
     case 't':
         // Read the input and map with logging
         result = ProcessMapping( true );
+        UpdateOutputs();
         break;
     case 'i':
         result = ProcessModifyMapValueCommand( &command[ 1 ], s_inputMap );
@@ -516,9 +1024,18 @@ bool ProcessCommand( const char* command )
     case 'f':
         result = ProcessLowFuelLevel( &command[ 1 ] );
         break;
+    case 'k':
+        result = ProcessFilterCommand( &command[ 1 ] );
+        break;
     case 'c':
         result = ProcessContinuousMode();
         break;
+    case 'x':
+        result = ProcessStatisticsCommand();
+        break;
+    case 'e':
+        result = ProcessRatesCommand( &command[ 1 ] );
+        break;
 
     default:
         break;
@@ -537,6 +1054,21 @@ bool ProcessCommand( const char* command )
 //!
 ///////////////////////////////////////////////////////////////////////////////
 bool RunGauge( void )
+{
+    bool result = MapGauge();
+    UpdateGauge();
+    return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Read the tank input and map it without changing the output
+//!
+//! The new output is held until UpdateGauge() is next called so the gauge
+//! can be written less often than the input is mapped.
+//!
+///////////////////////////////////////////////////////////////////////////////
+bool MapGauge( void )
 {
     //
     // Run the mapping command but with logging controlled by wether we are
@@ -552,6 +1084,36 @@ bool RunGauge( void )
     }
 }
 
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Write the last mapped value to the gauge and low fuel light
+//!
+///////////////////////////////////////////////////////////////////////////////
+void UpdateGauge( void )
+{
+    UpdateOutputs();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Convert a gauge output back into the actual value that gives it
+//!
+//! Whether the output map is monotonic is worked out when the maps last
+//! changed, so the usual monotonic map costs the same binary search as
+//! mapping a tank input to an actual value. Where the output map turns back on
+//! itself the lowest actual value is used.
+//!
+///////////////////////////////////////////////////////////////////////////////
+uint16_t GaugeOutputToActual( uint16_t output )
+{
+    if ( s_outputMonotonic )
+    {
+        return MapValueToLinear( output, s_outputMap );
+    }
+
+    return MapFoldedValueToLinear( output, s_outputMap );
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 //!
 //! \brief  Check whether the Fuel Gauge is in programming or run mode
@@ -561,3 +1123,178 @@ bool IsRunning()
 {
     return s_running;
 }
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Add a character received from the console to the command line
+//!
+//! Printable characters are echoed and stored. A carriage return runs the
+//! command line and reports how it went.
+//!
+///////////////////////////////////////////////////////////////////////////////
+static void ProcessCharacter( char character )
+{
+    if ( character == '\r' )
+    {
+        //
+        // Echo the CR before doing any work
+        //
+        HAL_PrintNewline();
+
+        s_lineBuffer[ s_lineLength ] = '\0';
+        s_lineLength = 0;
+
+        if ( ProcessCommand( s_lineBuffer ) )
+        {
+            HAL_PrintText( "OK" );
+        }
+        else
+        {
+            HAL_PrintText( "Command Error" );
+        }
+        HAL_PrintNewline();
+    }
+    else if ( isprint( (unsigned char)character ) )
+    {
+        //
+        // Local echo
+        //
+        char echo[ 2 ] = { character, '\0' };
+        HAL_PrintText( echo );
+
+        //
+        // Store the character leaving room for the terminator
+        //
+        s_lineBuffer[ s_lineLength ] = character;
+        s_lineLength++;
+        if ( s_lineLength == LINE_BUFFER_LENGTH )
+        {
+            HAL_PrintNewline();
+            HAL_PrintText( "Line too long" );
+            HAL_PrintNewline();
+            s_lineLength = 0;
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Send queued text and handle any character received
+//!
+///////////////////////////////////////////////////////////////////////////////
+static void SerialTask( void )
+{
+    HAL_ServiceText();
+
+    char character;
+    if ( HAL_ReadCharacter( &character ) )
+    {
+        ProcessCharacter( character );
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Map the tank input to the gauge and start flashing the low fuel
+//!         light if it can't be read
+//!
+///////////////////////////////////////////////////////////////////////////////
+static void MappingTask( void )
+{
+    bool error = !MapGauge();
+
+    //
+    // Start a flash straight away rather than waiting for the flash task
+    //
+    if ( error && !s_inputError && !s_errorFlashOn )
+    {
+        WakeTask( &s_taskDue[ ERROR_FLASH_TASK ] );
+    }
+    s_inputError = error;
+
+    DelayTask( &s_taskDue[ MAPPING_TASK ], s_mappingTicks );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Write the latest mapping to the gauge and low fuel light
+//!
+//! The outputs are left alone while there is a tank input error so the error
+//! flash isn't disturbed.
+//!
+///////////////////////////////////////////////////////////////////////////////
+static void OutputTask( void )
+{
+    if ( !s_inputError )
+    {
+        UpdateGauge();
+    }
+
+    DelayTask( &s_taskDue[ OUTPUT_TASK ], s_outputTicks );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Flash the low fuel light while there is a tank input error
+//!
+//! Each run turns the light on or off. Once the error clears the light is
+//! left off and the next mapping sets it from the fuel level again.
+//!
+///////////////////////////////////////////////////////////////////////////////
+static void ErrorFlashTask( void )
+{
+    if ( s_errorFlashOn )
+    {
+        HAL_SetLowFuelLight( false );
+        s_errorFlashOn = false;
+        s_lastValid = false;
+    }
+    else if ( s_inputError )
+    {
+        HAL_SetLowFuelLight( true );
+        s_errorFlashOn = true;
+    }
+}
+
+//
+//! Everything the gauge does and how often. The tank input is sampled by an
+//! interrupt and the samples filtered here in batches. The console is checked
+//! on every pass of the main loop. The mapping and output tasks set their own
+//! periods as they can be changed from the console.
+//
+static const Task s_tasks[ TASK_COUNT ] = {
+    { HAL_DrainTankSamples, SAMPLE_DRAIN_TICKS },
+    { MappingTask, 0 },
+    { OutputTask, 0 },
+    { SerialTask, 0 },
+    { ErrorFlashTask, ERROR_FLASH_TICKS },
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Start running the gauge's tasks from the main loop
+//!
+//! Every task runs on the first pass. The gauge should already have been
+//! initialised.
+//!
+///////////////////////////////////////////////////////////////////////////////
+void StartGaugeTasks()
+{
+    s_lineLength = 0;
+    s_inputError = false;
+    s_errorFlashOn = false;
+    StartTasks( s_taskDue, TASK_COUNT );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Run whichever of the gauge's tasks are due
+//!
+//! This is meant to be called over and over from the main loop. It never
+//! waits so the loop rate doesn't depend on what the gauge is doing.
+//!
+///////////////////////////////////////////////////////////////////////////////
+void RunGaugeTasks()
+{
+    RunTasks( s_tasks, s_taskDue, TASK_COUNT );
+}
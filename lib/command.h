@@ -29,6 +29,16 @@
 #include <xc.h> /* XC8 General Include File */
 #endif
 
+//
+//! Default ticks between each mapping of the tank input to the gauge output
+//! and between each update of the gauge and low fuel light. A hot-wire gauge
+//! takes seconds to respond so a few updates a second is plenty. Both are
+//! saved with the maps and erased EEPROM reads as an invalid 0xFF.
+//
+#define DEFAULT_MAPPING_TICKS 20
+#define DEFAULT_OUTPUT_TICKS 200
+#define IS_VALID_RATE_TICKS( ticks ) ( ( ticks ) >= 1 && ( ticks ) <= 0xFE )
+
 #ifdef __cplusplus // Provide C++ Compatibility
 extern "C" {
 #endif
@@ -36,7 +46,12 @@ extern "C" {
 void InitialiseGauge( void );
 bool ProcessCommand( const char* command );
 bool RunGauge( void );
+bool MapGauge( void );
+void UpdateGauge( void );
 bool IsRunning( void );
+void StartGaugeTasks( void );
+void RunGaugeTasks( void );
+uint16_t GaugeOutputToActual( uint16_t output );
 
 #ifdef __cplusplus // Provide C++ Compatibility
 }
@@ -0,0 +1,768 @@
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \file
+//! \brief  Exponential moving average filter and level estimator for
+//!         smoothing the tank input
+//!
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2019 David J. Fiddes
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <filter.h>
+#include <hal.h>
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Reset a filter so its output starts from zero
+//!
+//! The k supplied is limited to FILTER_MAX_K. The filter isn't adaptive.
+//!
+///////////////////////////////////////////////////////////////////////////////
+void InitialiseFilter( FilterState* filter, uint8_t k )
+{
+    filter->z = 0;
+    filter->k = k > FILTER_MAX_K ? FILTER_MAX_K : k;
+    filter->kNow = filter->k;
+    filter->settled = 0;
+    filter->adaptive = false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Work out the last output of a filter from its history
+//!
+//! Once settled the history of a fixed filter holds the output scaled by
+//! 2^k - 1 so this needs a divide. With the filter off it holds the last
+//! input.
+//!
+///////////////////////////////////////////////////////////////////////////////
+static uint16_t FilterOutput( const FilterState* filter )
+{
+    if ( filter->adaptive )
+    {
+        return ( filter->z + 0x8000 ) >> 16;
+    }
+
+    if ( filter->k == 0 )
+    {
+        return (uint16_t)filter->z;
+    }
+
+    uint32_t scale = ( 1UL << filter->k ) - 1;
+    return (uint16_t)( ( filter->z + ( scale >> 1 ) ) / scale );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Set the history of a filter so it carries on from an output
+//!
+//! Seeding a filter with a good estimate of its input at power on saves
+//! waiting for it to climb from zero
+//!
+///////////////////////////////////////////////////////////////////////////////
+void SeedFilter( FilterState* filter, uint16_t y )
+{
+    if ( filter->adaptive )
+    {
+        filter->z = (uint32_t)y << 16;
+    }
+    else
+    {
+        filter->z = filter->k > 0 ? y * ( ( 1UL << filter->k ) - 1 ) : y;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Change the strength of a running filter
+//!
+//! The history is rescaled so the output carries on from where it was rather
+//! than jumping. This needs a divide so isn't meant for the sample loop.
+//! Returns false and leaves the filter alone if k is out of range.
+//!
+///////////////////////////////////////////////////////////////////////////////
+bool SetFilterK( FilterState* filter, uint8_t k )
+{
+    if ( k > FILTER_MAX_K )
+    {
+        return false;
+    }
+
+    uint16_t y = FilterOutput( filter );
+    filter->k = k;
+    SeedFilter( filter, y );
+
+    filter->kNow = k;
+    filter->settled = 0;
+
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Switch a running filter between a fixed and adaptive strength
+//!
+//! The output carries on from where it was rather than jumping
+//!
+///////////////////////////////////////////////////////////////////////////////
+void SetFilterAdaptive( FilterState* filter, bool adaptive )
+{
+    uint16_t y = FilterOutput( filter );
+    filter->adaptive = adaptive;
+    SeedFilter( filter, y );
+
+    filter->kNow = filter->k;
+    filter->settled = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Apply an Exponential Moving Average filter whose strength follows
+//!         the input
+//!
+//! Each sample that lands outside FILTER_NOISE_BAND of the output weakens the
+//! filter by one step down to FILTER_MIN_ADAPTIVE_K, so a real change such as
+//! refuelling comes through within a few tens of samples while a lone spike
+//! barely moves it. Once the input has stayed within the band for 2^k samples
+//! (one time constant at the current strength) the filter strengthens by a
+//! step until it is back at the configured k.
+//!
+//! The output is held with 16 fractional bits so the strength can change from
+//! one sample to the next without rescaling. Only additions, subtractions and
+//! shifts are used.
+//!
+///////////////////////////////////////////////////////////////////////////////
+static uint16_t AdaptiveFilter( FilterState* filter, uint16_t x )
+{
+    uint32_t input = (uint32_t)x << 16;
+    uint32_t difference =
+        input > filter->z ? input - filter->z : filter->z - input;
+
+    if ( difference > ( (uint32_t)FILTER_NOISE_BAND << 16 ) )
+    {
+        if ( filter->kNow > FILTER_MIN_ADAPTIVE_K )
+        {
+            filter->kNow--;
+        }
+        filter->settled = 0;
+    }
+    else if ( filter->kNow < filter->k )
+    {
+        filter->settled++;
+        if ( filter->settled >> filter->kNow )
+        {
+            filter->kNow++;
+            filter->settled = 0;
+        }
+    }
+
+    //
+    // The output only ever moves towards the input so can't pass 0xFFFF
+    //
+    if ( input > filter->z )
+    {
+        filter->z += difference >> filter->kNow;
+    }
+    else
+    {
+        filter->z -= difference >> filter->kNow;
+    }
+
+    return ( filter->z + 0x8000 ) >> 16;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Apply an Exponential Moving Average filter
+//!
+//! This applies an exponential moving average filter to the supplied value. The
+//! filter is of the form:
+//!
+//! y[n] = alpha * x[n] + (1 - alpha) * y[n-1]
+//!
+//! where "alpha" is a value between 0 and 1 indicating the historical weight
+//!
+//! This implementation uses just addition subtraction and bit-shift to do this:
+//!
+//! alpha = 1 / (2^k)
+//!
+//! Algorithm and performance from
+//! https://tttapa.github.io/Pages/Mathematics/Systems-and-Control-Theory/Digital-filters/Exponential%20Moving%20Average/Exponential-Moving-Average.html
+//!
+///////////////////////////////////////////////////////////////////////////////
+uint16_t Filter( FilterState* filter, uint16_t x )
+{
+    if ( filter->adaptive )
+    {
+        return AdaptiveFilter( filter, x );
+    }
+
+    uint8_t k = filter->k;
+
+    if ( k == 0 )
+    {
+        //
+        // Keep the history so turning the filter on doesn't start from zero
+        //
+        filter->z = x;
+        return x;
+    }
+
+    filter->z += x;
+    uint32_t y = ( filter->z + ( 1UL << ( k - 1 ) ) ) >> k;
+    filter->z -= y;
+
+    return (uint16_t)y;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Set the strength of a level estimator
+//!
+//! The k supplied is limited to between ESTIMATOR_MIN_K and FILTER_MAX_K. The
+//! state isn't scaled by k so the output carries on from where it was.
+//!
+///////////////////////////////////////////////////////////////////////////////
+void SetEstimatorK( LevelEstimator* estimator, uint8_t k )
+{
+    if ( k < ESTIMATOR_MIN_K )
+    {
+        k = ESTIMATOR_MIN_K;
+    }
+    estimator->k = k > FILTER_MAX_K ? FILTER_MAX_K : k;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Start a level estimator from a steady level
+//!
+///////////////////////////////////////////////////////////////////////////////
+void SeedEstimator( LevelEstimator* estimator, uint16_t y )
+{
+    estimator->level = (uint32_t)y << 16;
+    estimator->rate = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Estimate the tank level from a sample
+//!
+//! This is a steady state Kalman filter for a level that changes at a slowly
+//! varying rate, otherwise known as an alpha-beta filter. Each sample the
+//! level is moved on by the rate and then both are corrected by the
+//! difference between the sample and that prediction:
+//!
+//! level[n] = level[n-1] + rate[n-1] + alpha * residual[n]
+//! rate[n] = rate[n-1] + beta * residual[n]
+//!
+//! Choosing beta = alpha^2 / 4 critically damps it so a step in the level
+//! doesn't overshoot. With alpha = 1 / (2^k) both gains are shifts so the
+//! update only uses additions, subtractions and shifts.
+//!
+//! Unlike the EMA the output doesn't lag behind a steady drain, so a much
+//! stronger k can be used to hold the needle still against slosh. The rate
+//! is the fuel burn.
+//!
+///////////////////////////////////////////////////////////////////////////////
+uint16_t Estimate( LevelEstimator* estimator, uint16_t x )
+{
+    //
+    // Predict where the level has got to. The level is kept within the
+    // input range so the rounded output can't pass 0xFFFF.
+    //
+    uint32_t level = estimator->level;
+    int32_t  rate = estimator->rate;
+    if ( rate >= 0 )
+    {
+        level += (uint32_t)rate >> ESTIMATOR_RATE_BITS;
+        if ( level > 0xFFFF0000UL )
+        {
+            level = 0xFFFF0000UL;
+        }
+    }
+    else
+    {
+        uint32_t fall = (uint32_t)-rate >> ESTIMATOR_RATE_BITS;
+        level = level > fall ? level - fall : 0;
+    }
+
+    //
+    // Correct both from the residual. The level correction never passes the
+    // input and the rate is limited so it can't overflow.
+    //
+    uint8_t  k = estimator->k;
+    uint8_t  rateShift = 2 * k + 2 - ESTIMATOR_RATE_BITS;
+    uint32_t input = (uint32_t)x << 16;
+    uint32_t residual;
+    uint32_t step;
+
+    if ( input > level )
+    {
+        residual = input - level;
+        level += residual >> k;
+
+        step = residual >> rateShift;
+        if ( step > (uint32_t)( ESTIMATOR_MAX_RATE - rate ) )
+        {
+            rate = ESTIMATOR_MAX_RATE;
+        }
+        else
+        {
+            rate += step;
+        }
+    }
+    else
+    {
+        residual = level - input;
+        level -= residual >> k;
+
+        step = residual >> rateShift;
+        if ( step > (uint32_t)( ESTIMATOR_MAX_RATE + rate ) )
+        {
+            rate = -ESTIMATOR_MAX_RATE;
+        }
+        else
+        {
+            rate -= step;
+        }
+    }
+
+    estimator->level = level;
+    estimator->rate = rate;
+
+    return ( level + 0x8000 ) >> 16;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Return the rate a level estimator has the level changing at
+//!
+//! The rate is in counts of the 16-bit input per hour at the 1kHz tank sample
+//! rate so is negative while fuel is being used. This needs a multiply so
+//! isn't meant for the sample loop.
+//!
+///////////////////////////////////////////////////////////////////////////////
+int32_t EstimatedRate( const LevelEstimator* estimator )
+{
+    //
+    // 3600000 samples an hour with the rate scaled by 2^30 is close to
+    // 879 / 2^18. The magnitude is scaled so the shifts don't depend on how
+    // the compiler handles negative numbers.
+    //
+    int32_t  rate = estimator->rate;
+    uint32_t magnitude = rate < 0 ? (uint32_t)-rate : (uint32_t)rate;
+    int32_t  perHour = (int32_t)( ( ( magnitude >> 10 ) * 879 ) >> 8 );
+
+    return rate < 0 ? -perHour : perHour;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Fill a median filter's window with a single value
+//!
+///////////////////////////////////////////////////////////////////////////////
+void InitialiseMedian( MedianFilter* filter, uint16_t x )
+{
+    for ( uint8_t i = 0; i < MEDIAN_SIZE; i++ )
+    {
+        filter->window[ i ] = x;
+        filter->sorted[ i ] = x;
+    }
+    filter->oldest = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Apply a sliding median filter
+//!
+//! The new sample replaces the oldest in the window and the median of the
+//! window is returned. Any spike that lasts for less than half of the window
+//! is removed completely.
+//!
+//! Rather than sorting the whole window the oldest sample is found in the
+//! sorted copy with a binary search. The new sample then takes its place and
+//! is slid along to where it belongs. The slide only passes the samples that
+//! lie between the old and new values so it is usually very short for a
+//! slowly changing input.
+//!
+///////////////////////////////////////////////////////////////////////////////
+uint16_t Median( MedianFilter* filter, uint16_t x )
+{
+    uint16_t old = filter->window[ filter->oldest ];
+    filter->window[ filter->oldest ] = x;
+    filter->oldest++;
+    if ( filter->oldest == MEDIAN_SIZE )
+    {
+        filter->oldest = 0;
+    }
+
+    //
+    // Find the first sorted entry holding the oldest sample
+    //
+    uint8_t lower = 0;
+    uint8_t upper = MEDIAN_SIZE - 1;
+    while ( lower < upper )
+    {
+        uint8_t middle = ( lower + upper ) >> 1;
+        if ( filter->sorted[ middle ] < old )
+        {
+            lower = middle + 1;
+        }
+        else
+        {
+            upper = middle;
+        }
+    }
+
+    //
+    // Slide the new sample into its place
+    //
+    uint16_t* sorted = filter->sorted;
+    if ( x > old )
+    {
+        while ( lower < MEDIAN_SIZE - 1 && sorted[ lower + 1 ] < x )
+        {
+            sorted[ lower ] = sorted[ lower + 1 ];
+            lower++;
+        }
+    }
+    else
+    {
+        while ( lower > 0 && sorted[ lower - 1 ] > x )
+        {
+            sorted[ lower ] = sorted[ lower - 1 ];
+            lower--;
+        }
+    }
+    sorted[ lower ] = x;
+
+    return sorted[ MEDIAN_SIZE / 2 ];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Add an ADC conversion to an oversampled result
+//!
+//! Returns true once OVERSAMPLE_COUNT conversions have been added and the
+//! result is ready to be collected with DumpOversample()
+//!
+///////////////////////////////////////////////////////////////////////////////
+bool AccumulateSample( Oversampler* sampler, uint16_t conversion )
+{
+    sampler->total += conversion >> ( 16 - ADC_BITS );
+    sampler->count++;
+
+    return sampler->count >= OVERSAMPLE_COUNT;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Collect an oversampled result and start the next one
+//!
+//! Adding up 4^n conversions and dropping n bits (decimating) gives n more
+//! bits of resolution as long as there is at least a count of noise on the
+//! input to dither it. The result is left justified in 16-bits like a single
+//! conversion so the rest of the sample path doesn't need to know.
+//!
+///////////////////////////////////////////////////////////////////////////////
+uint16_t DumpOversample( Oversampler* sampler )
+{
+    uint16_t result = ( sampler->total >> OVERSAMPLE_BITS )
+        << ( 16 - ADC_BITS - OVERSAMPLE_BITS );
+
+    sampler->total = 0;
+    sampler->count = 0;
+
+    return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Check a raw tank input sample for a sender fault
+//!
+//! A fault is only reported after SENDER_FAULT_SAMPLES faulty samples in a
+//! row so a stray reading doesn't flash the warning light. It is only cleared
+//! after SENDER_RECOVERY_SAMPLES good samples in a row so a sender with a
+//! loose connection doesn't flicker between the two.
+//!
+///////////////////////////////////////////////////////////////////////////////
+SenderStatus CheckSender( FaultDetector* detector, uint16_t raw )
+{
+    bool faulty = raw >= SENDER_OPEN_LEVEL || raw <= SENDER_SHORT_LEVEL;
+
+    //
+    // Count runs of whichever kind of sample would change the state
+    //
+    if ( faulty != detector->faulted )
+    {
+        detector->count++;
+    }
+    else
+    {
+        detector->count = 0;
+    }
+
+    if ( !detector->faulted )
+    {
+        if ( !faulty )
+        {
+            return SENDER_OK;
+        }
+        if ( detector->count < SENDER_FAULT_SAMPLES )
+        {
+            return SENDER_SUSPECT;
+        }
+    }
+    else
+    {
+        if ( faulty )
+        {
+            return SENDER_FAULT;
+        }
+        if ( detector->count < SENDER_RECOVERY_SAMPLES )
+        {
+            return SENDER_FAULT;
+        }
+    }
+
+    detector->faulted = !detector->faulted;
+    detector->count = 0;
+
+    return detector->faulted ? SENDER_FAULT : SENDER_RECOVERED;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Change how far the tank input sample rate is backed off
+//!
+//! The EMA strength is lowered a step for each halving of the rate so it
+//! still settles in the same time. This rescales the EMA so it is only done
+//! when the rate changes.
+//!
+///////////////////////////////////////////////////////////////////////////////
+static void SetBackoff( TankFilter* filter, uint8_t backoff )
+{
+    filter->backoff = backoff;
+    filter->steady = 0;
+    SetFilterK(
+        &filter->stage.smoothing,
+        ( filter->setting & FILTER_K_MASK ) - backoff );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Back the tank input sample rate off while the input is steady
+//!
+//! Once the input has stayed within FILTER_NOISE_BAND of the output for a
+//! time constant of the EMA the rate is halved, down to SAMPLE_BACKOFF_MAX
+//! halvings or until the EMA would be weaker than BACKOFF_MIN_K. A single
+//! sample outside the band is a step or the noise rising so the full rate is
+//! restored straight away.
+//!
+///////////////////////////////////////////////////////////////////////////////
+static void UpdateBackoff( TankFilter* filter, uint16_t value, uint16_t last )
+{
+    uint16_t difference = value > last ? value - last : last - value;
+
+    if ( difference > FILTER_NOISE_BAND )
+    {
+        if ( filter->backoff > 0 )
+        {
+            SetBackoff( filter, 0 );
+        }
+        filter->steady = 0;
+        return;
+    }
+
+    uint8_t k = ( filter->setting & FILTER_K_MASK ) - filter->backoff;
+    if ( filter->backoff == SAMPLE_BACKOFF_MAX || k <= BACKOFF_MIN_K )
+    {
+        return;
+    }
+
+    filter->steady++;
+    if ( filter->steady >> k )
+    {
+        SetBackoff( filter, filter->backoff + 1 );
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Change the filter setting of a tank input sample path
+//!
+//! The setting is as saved with the maps and is assumed to be valid
+//!
+///////////////////////////////////////////////////////////////////////////////
+void SetTankFilter( TankFilter* filter, uint8_t setting )
+{
+    //
+    // Start the median from the current output so it doesn't pull the
+    // output towards a stale window
+    //
+    if ( ( setting & FILTER_MEDIAN_FLAG ) &&
+         !( filter->setting & FILTER_MEDIAN_FLAG ) )
+    {
+        InitialiseMedian( &filter->median, filter->output );
+    }
+
+    //
+    // Only one of the EMA and the estimator runs and they share their
+    // storage, so the one taking over starts afresh from the current output
+    //
+    bool estimator = ( setting & FILTER_ESTIMATOR_FLAG ) != 0;
+    bool wasEstimator = ( filter->setting & FILTER_ESTIMATOR_FLAG ) != 0;
+    filter->setting = setting;
+    filter->backoff = 0;
+    filter->steady = 0;
+
+    if ( estimator )
+    {
+        if ( !wasEstimator )
+        {
+            SeedEstimator( &filter->stage.estimator, filter->output );
+        }
+        SetEstimatorK( &filter->stage.estimator, setting & FILTER_K_MASK );
+        return;
+    }
+
+    if ( wasEstimator )
+    {
+        InitialiseFilter( &filter->stage.smoothing, setting & FILTER_K_MASK );
+    }
+    else
+    {
+        SetFilterK( &filter->stage.smoothing, setting & FILTER_K_MASK );
+    }
+    SetFilterAdaptive(
+        &filter->stage.smoothing, ( setting & FILTER_ADAPTIVE_FLAG ) != 0 );
+    if ( wasEstimator )
+    {
+        SeedFilter( &filter->stage.smoothing, filter->output );
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Start a tank input sample path from a known input
+//!
+///////////////////////////////////////////////////////////////////////////////
+void SeedTankFilter( TankFilter* filter, uint16_t raw )
+{
+    if ( filter->backoff > 0 )
+    {
+        SetBackoff( filter, 0 );
+    }
+
+    InitialiseMedian( &filter->median, raw );
+    if ( filter->setting & FILTER_ESTIMATOR_FLAG )
+    {
+        SeedEstimator( &filter->stage.estimator, raw );
+    }
+    else
+    {
+        SeedFilter( &filter->stage.smoothing, raw );
+    }
+    filter->output = raw;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Run a raw tank input sample through the sample path
+//!
+//! Faulty samples are checked for before any filtering and never reach the
+//! filters. While a fault is suspected the last good value is held and once
+//! it is confirmed TANK_INPUT_ERROR is returned straight away rather than
+//! waiting for the filters to get there. The filters start afresh when the
+//! sender recovers. Faulty samples stop any backing off so a fault is
+//! confirmed just as quickly.
+//!
+///////////////////////////////////////////////////////////////////////////////
+uint16_t FilterTankInput( TankFilter* filter, uint16_t raw )
+{
+    switch ( CheckSender( &filter->fault, raw ) )
+    {
+    case SENDER_FAULT:
+        if ( filter->backoff > 0 )
+        {
+            SetBackoff( filter, 0 );
+        }
+        return TANK_INPUT_ERROR;
+
+    case SENDER_SUSPECT:
+        if ( filter->backoff > 0 )
+        {
+            SetBackoff( filter, 0 );
+        }
+        return filter->output;
+
+    case SENDER_RECOVERED:
+        SeedTankFilter( filter, raw );
+        return raw;
+
+    default:
+        break;
+    }
+
+    uint16_t value = raw;
+    if ( filter->setting & FILTER_MEDIAN_FLAG )
+    {
+        value = Median( &filter->median, value );
+    }
+    if ( filter->setting & FILTER_ESTIMATOR_FLAG )
+    {
+        filter->output = Estimate( &filter->stage.estimator, value );
+    }
+    else
+    {
+        uint16_t last = filter->output;
+        filter->output = Filter( &filter->stage.smoothing, value );
+
+        if ( filter->setting & FILTER_BACKOFF_FLAG )
+        {
+            UpdateBackoff( filter, value, last );
+        }
+    }
+
+    return filter->output;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Return the rate the tank input is changing at in counts per hour
+//!
+//! Only the level estimator tracks the rate so this is zero when it isn't
+//! being used
+//!
+///////////////////////////////////////////////////////////////////////////////
+int32_t TankFilterRate( const TankFilter* filter )
+{
+    if ( !( filter->setting & FILTER_ESTIMATOR_FLAG ) )
+    {
+        return 0;
+    }
+
+    return EstimatedRate( &filter->stage.estimator );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Return how many times the tank input sample rate should be halved
+//!
+///////////////////////////////////////////////////////////////////////////////
+uint8_t TankFilterBackoff( const TankFilter* filter )
+{
+    return filter->backoff;
+}
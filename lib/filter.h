@@ -0,0 +1,296 @@
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \file
+//! \brief  Exponential moving average filter and level estimator for
+//!         smoothing the tank input
+//!
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2019 David J. Fiddes
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#if defined( __XC )
+#include <xc.h> /* XC8 General Include File */
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+//
+//! Default filter strength. At the 1kHz tank sample rate:
+//!
+//! k = 5 results in a -3dB roll off of 5Hz
+//! k = 6 results in a -3dB roll off of 2.5Hz
+//! k = 7 results in a -3dB roll off of 1.25Hz
+//! k = 8 results in a -3dB roll off of 0.62Hz
+//
+#define FILTER_DEFAULT_K 8
+
+//
+//! Strongest filter supported. The state holds a 16-bit value scaled by 2^k
+//! so this keeps it within 32-bits. A k of zero turns the filter off.
+//
+#define FILTER_MAX_K 15
+
+//
+//! An adaptive filter drops towards this k while its input is away from the
+//! output so real changes come through quickly
+//
+#define FILTER_MIN_ADAPTIVE_K 2
+
+//
+//! Differences between the input and output of an adaptive filter larger
+//! than this aren't treated as noise. This is 8 counts of the 10-bit ADC.
+//
+#define FILTER_NOISE_BAND 0x0200
+
+//
+//! Tank filter settings hold the EMA k in the bottom bits. Setting the top
+//! bit also runs a median filter ahead of the EMA to reject slosh and the
+//! next bit makes the EMA adaptive. The bit after that replaces the EMA with
+//! a level estimator using the same k, and the next lets the tank input be
+//! sampled less often while it is steady.
+//
+#define FILTER_K_MASK 0x0F
+#define FILTER_MEDIAN_FLAG 0x80
+#define FILTER_ADAPTIVE_FLAG 0x40
+#define FILTER_ESTIMATOR_FLAG 0x20
+#define FILTER_BACKOFF_FLAG 0x10
+#define FILTER_FLAGS                                                       \
+    ( FILTER_MEDIAN_FLAG | FILTER_ADAPTIVE_FLAG | FILTER_ESTIMATOR_FLAG | \
+      FILTER_BACKOFF_FLAG )
+
+//
+//! Check a tank filter setting is one we understand. The estimator can't be
+//! adaptive or back off and needs a k of at least ESTIMATOR_MIN_K.
+//
+#define IS_VALID_FILTER_SETTING( setting )                                     \
+    ( ( ( setting ) & ~FILTER_FLAGS ) <= FILTER_MAX_K &&                       \
+      ( !( ( setting ) & FILTER_ESTIMATOR_FLAG ) ||                            \
+        ( !( ( setting ) & ( FILTER_ADAPTIVE_FLAG | FILTER_BACKOFF_FLAG ) ) && \
+          ( ( setting ) & FILTER_K_MASK ) >= ESTIMATOR_MIN_K ) ) )
+
+//
+//! Most times the tank input sample rate can be halved while the input stays
+//! within FILTER_NOISE_BAND of the output. Each halving takes a step off the
+//! EMA strength so its time constant stays the same.
+//
+#define SAMPLE_BACKOFF_MAX 3
+
+//
+//! Weakest EMA strength backing off can leave, so the EMA still averages
+//! enough samples for a step of k to match a halving of the rate
+//
+#define BACKOFF_MIN_K 3
+
+//
+//! Fractional bits the level estimator holds its rate with beyond the 16 of
+//! its level. The rate is held in a signed 32-bit value so this limits how
+//! small a k the estimator can use.
+//
+#define ESTIMATOR_RATE_BITS 14
+
+//
+//! Weakest k the level estimator can use. Its rate gain is 1 / (2^(2k+2)) so
+//! this is the smallest k where the rate gain is still a right shift of the
+//! residual.
+//
+#define ESTIMATOR_MIN_K ( ( ESTIMATOR_RATE_BITS - 1 ) / 2 )
+
+//
+//! Fastest rate the level estimator will follow. This is a count of the
+//! 16-bit input per sample, about a full tank in a minute.
+//
+#define ESTIMATOR_MAX_RATE 0x3FFFFFFFL
+
+//
+//! Number of samples the median filter picks from. This must be odd. Each
+//! sample costs 4 bytes of RAM.
+//
+#ifndef MEDIAN_SIZE
+#define MEDIAN_SIZE 7
+#endif
+
+#if ( MEDIAN_SIZE & 1 ) == 0 || MEDIAN_SIZE < 3 || MEDIAN_SIZE > 15
+#error "MEDIAN_SIZE must be odd and between 3 and 15"
+#endif
+
+//
+//! Resolution of the ADC. Its results are left justified in 16-bits.
+//
+#define ADC_BITS 10
+
+//
+//! Extra bits of resolution gained by oversampling the ADC. Each extra bit
+//! needs four times as many conversions.
+//
+#ifndef OVERSAMPLE_BITS
+#define OVERSAMPLE_BITS 2
+#endif
+
+#if ADC_BITS + 2 * OVERSAMPLE_BITS > 16
+#error "The oversampling total must fit in 16-bits"
+#endif
+
+//
+//! Number of conversions that are added up for each oversampled result
+//
+#define OVERSAMPLE_COUNT ( 1 << ( 2 * OVERSAMPLE_BITS ) )
+
+//
+//! Raw tank inputs at or above this are an open circuit sender. This is the
+//! full scale reading of the 10-bit ADC.
+//
+#define SENDER_OPEN_LEVEL 0xffc0
+
+//
+//! Raw tank inputs at or below this are a sender shorted to ground
+//
+#define SENDER_SHORT_LEVEL 0x0040
+
+//
+//! Consecutive faulty samples needed to report a sender fault. Fewer than
+//! this are just ignored.
+//
+#define SENDER_FAULT_SAMPLES 4
+
+//
+//! Consecutive good samples needed to clear a sender fault
+//
+#define SENDER_RECOVERY_SAMPLES 16
+
+//
+//! Adds up ADC conversions to make one result with more resolution. All zeros
+//! is a valid starting state.
+//
+typedef struct
+{
+    uint16_t total; //!< Sum of the right justified conversions so far
+    uint8_t  count; //!< Number of conversions in the total
+} Oversampler;
+
+//
+//! What a raw sample says about the sender
+//
+typedef enum
+{
+    SENDER_OK,        //!< Good sample
+    SENDER_SUSPECT,   //!< Faulty sample that isn't a fault yet
+    SENDER_FAULT,     //!< Sender is open circuit or shorted or recovering
+    SENDER_RECOVERED, //!< First good sample after a fault has cleared
+} SenderStatus;
+
+//
+//! Tracks runs of faulty or good raw samples. All zeros is a valid starting
+//! state.
+//
+typedef struct
+{
+    uint8_t count;   //!< Length of the current run of faulty or good samples
+    bool    faulted; //!< A fault has been reported and not yet cleared
+} FaultDetector;
+
+//
+//! The state of one filter. Each filtered signal needs its own.
+//
+typedef struct
+{
+    uint32_t z;        //!< Filtered value scaled by 2^k less the last output
+                       //!< or, when adaptive, the output scaled by 2^16
+    uint8_t  k;        //!< Filter strength where alpha = 1 / (2^k)
+    uint8_t  kNow;     //!< Strength an adaptive filter is currently using
+    uint16_t settled;  //!< Samples an adaptive filter has been within the
+                       //!< noise band at its current strength
+    bool     adaptive; //!< Vary the strength with the input
+} FilterState;
+
+//
+//! The state of one level estimator. This tracks the rate the level is
+//! changing as well as the level so a steady drain doesn't leave the output
+//! lagging behind. Set its k with SetEstimatorK() before use.
+//
+typedef struct
+{
+    uint32_t level; //!< Estimated level scaled by 2^16
+    int32_t  rate;  //!< Estimated change in level per sample scaled by 2^30
+    uint8_t  k;     //!< Level gain is 1 / (2^k) and rate gain 1 / (2^(2k+2))
+} LevelEstimator;
+
+//
+//! The state of one median filter. All zeros is a valid starting state.
+//
+typedef struct
+{
+    uint16_t window[ MEDIAN_SIZE ]; //!< Last samples in the order they came
+    uint16_t sorted[ MEDIAN_SIZE ]; //!< The same samples in ascending order
+    uint8_t  oldest;                //!< Window entry the next sample replaces
+} MedianFilter;
+
+//
+//! The whole tank input sample path. All zeros is a valid starting state
+//! with the filters off.
+//
+typedef struct
+{
+    FaultDetector  fault;     //!< Checks raw samples before any filtering
+    MedianFilter   median;    //!< Optional slosh rejection
+    union
+    {
+        FilterState    smoothing; //!< EMA smoothing
+        LevelEstimator estimator; //!< Alternative to the EMA smoothing
+    } stage; //!< Only one of the two runs at a time so they share RAM
+    uint8_t        setting;   //!< Filter setting as saved with the maps
+    uint16_t       output;    //!< Last good filtered value
+    uint8_t        backoff;   //!< Sample rate is divided by 2^backoff
+    uint16_t       steady;    //!< Samples within the noise band since the
+                              //!< rate last changed
+} TankFilter;
+
+#ifdef __cplusplus // Provide C++ Compatibility
+extern "C" {
+#endif
+
+void     InitialiseFilter( FilterState* filter, uint8_t k );
+bool     SetFilterK( FilterState* filter, uint8_t k );
+void     SetFilterAdaptive( FilterState* filter, bool adaptive );
+void     SeedFilter( FilterState* filter, uint16_t y );
+uint16_t Filter( FilterState* filter, uint16_t x );
+
+void     SetEstimatorK( LevelEstimator* estimator, uint8_t k );
+void     SeedEstimator( LevelEstimator* estimator, uint16_t y );
+uint16_t Estimate( LevelEstimator* estimator, uint16_t x );
+int32_t  EstimatedRate( const LevelEstimator* estimator );
+
+void     InitialiseMedian( MedianFilter* filter, uint16_t x );
+uint16_t Median( MedianFilter* filter, uint16_t x );
+
+bool     AccumulateSample( Oversampler* sampler, uint16_t conversion );
+uint16_t DumpOversample( Oversampler* sampler );
+
+SenderStatus CheckSender( FaultDetector* detector, uint16_t raw );
+
+void     SetTankFilter( TankFilter* filter, uint8_t setting );
+void     SeedTankFilter( TankFilter* filter, uint16_t raw );
+uint16_t FilterTankInput( TankFilter* filter, uint16_t raw );
+int32_t  TankFilterRate( const TankFilter* filter );
+uint8_t  TankFilterBackoff( const TankFilter* filter );
+
+#ifdef __cplusplus // Provide C++ Compatibility
+}
+#endif
+
+#endif // FILTER_H
@@ -38,19 +38,67 @@
 extern "C" {
 #endif
 
+//
+// A free running count of ticks of about 1ms that the scheduler runs from
+//
+void     HAL_StartTicks( void );
+uint16_t HAL_GetTicks( void );
+
+//
+// The tank input is sampled once a tick by an interrupt and the samples are
+// filtered in batches from the main loop
+//
+void     HAL_DrainTankSamples( void );
 uint16_t HAL_GetTankInput( void );
+int32_t  HAL_GetTankRate( void );
 uint16_t HAL_GetGaugeOutput( void );
 void     HAL_SetGaugeOutput( uint16_t value );
 void     HAL_SetLowFuelLight( bool newState );
 
-void HAL_PrintText( const char* text );
-void HAL_PrintNewline( void );
+//
+// The serial port is serviced by interrupts through transmit and receive
+// queues. Printing returns as soon as the text is queued, only waiting if the
+// transmit queue is full. Received characters that don't fit in the receive
+// queue are dropped and counted.
+//
+void    HAL_StartSerial( void );
+void    HAL_PrintText( const char* text );
+void    HAL_PrintNewline( void );
+bool    HAL_ReadCharacter( char* character );
+uint8_t HAL_GetLostCharacters( void );
+
+//
+// Text that is fed to the transmit queue from the main loop as it empties so
+// long text doesn't hold anything up. Printing anything else sends the rest
+// of it first.
+//
+void HAL_QueueText( const char* text );
+void HAL_ServiceText( void );
+
+void HAL_SetTankFilter( uint8_t setting );
+void HAL_SeedTankFilter( void );
 
-void HAL_LoadMaps( uint16_t* input, uint16_t* output, uint16_t* lowFuelLevel );
+void HAL_LoadMaps(
+    uint16_t* input,
+    uint16_t* output,
+    uint16_t* lowFuelLevel,
+    uint8_t*  filterSetting,
+    uint8_t*  mappingTicks,
+    uint8_t*  outputTicks );
 void HAL_SaveMaps(
     const uint16_t* input,
     const uint16_t* output,
-    uint16_t        lowFuelLevel );
+    uint16_t        lowFuelLevel,
+    uint8_t         filterSetting,
+    uint8_t         mappingTicks,
+    uint8_t         outputTicks );
+
+//
+// Persistent storage for the lookup table. Entries are at most 14-bits wide
+// and are always written in order starting from the first entry
+//
+uint16_t HAL_ReadLookupEntry( uint16_t index );
+void     HAL_WriteLookupEntry( uint16_t index, uint16_t value );
 
 #ifdef __cplusplus // Provide C++ Compatibility
 }
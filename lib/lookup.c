@@ -0,0 +1,105 @@
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \file
+//! \brief  Coarse tank input to gauge output lookup table held in flash
+//!
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2019 David J. Fiddes
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "lookup.h"
+#include "hal.h"
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Work out the stored value of a lookup table entry
+//!
+//! Each entry is the output for the tank input at the bottom of its range
+//! with the last entry holding the output for full-scale.
+//!
+///////////////////////////////////////////////////////////////////////////////
+static uint16_t LookupEntry( uint16_t index, const CompiledMap* map )
+{
+    uint16_t value = index < LOOKUP_TABLE_SIZE - 1
+        ? index << LOOKUP_INDEX_SHIFT
+        : 0xFFFF;
+
+    return MapCompiledValue( value, map ) >> LOOKUP_ENTRY_SHIFT;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Build the lookup table from a composite map and store it
+//!
+//! The entries are written in order.
+//!
+///////////////////////////////////////////////////////////////////////////////
+void BuildLookupTable( const CompiledMap* map )
+{
+    for ( uint16_t i = 0; i < LOOKUP_TABLE_SIZE; i++ )
+    {
+        HAL_WriteLookupEntry( i, LookupEntry( i, map ) );
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Check whether the stored table matches a composite map
+//!
+//! Every entry is compared with the one the map would give so a table built
+//! from different maps is never used, however close they are.
+//!
+///////////////////////////////////////////////////////////////////////////////
+bool CheckLookupTable( const CompiledMap* map )
+{
+    for ( uint16_t i = 0; i < LOOKUP_TABLE_SIZE; i++ )
+    {
+        if ( HAL_ReadLookupEntry( i ) != LookupEntry( i, map ) )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Map a tank input to a gauge output using the stored table
+//!
+//! The two entries either side of the value are blended linearly using the
+//! bottom 8-bits of the value.
+//!
+///////////////////////////////////////////////////////////////////////////////
+uint16_t LookupValue( uint16_t value )
+{
+    uint8_t  index = value >> LOOKUP_INDEX_SHIFT;
+    uint8_t  fraction = value & 0xFF;
+    uint16_t lower = HAL_ReadLookupEntry( index ) << LOOKUP_ENTRY_SHIFT;
+    uint16_t upper = HAL_ReadLookupEntry( index + 1 ) << LOOKUP_ENTRY_SHIFT;
+
+    if ( upper >= lower )
+    {
+        return lower +
+            (uint16_t)( ( (uint32_t)( upper - lower ) * fraction ) >>
+                        LOOKUP_INDEX_SHIFT );
+    }
+    else
+    {
+        return lower -
+            (uint16_t)( ( (uint32_t)( lower - upper ) * fraction ) >>
+                        LOOKUP_INDEX_SHIFT );
+    }
+}
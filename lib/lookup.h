@@ -0,0 +1,70 @@
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \file
+//! \brief  Coarse tank input to gauge output lookup table held in flash
+//!
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2019 David J. Fiddes
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef LOOKUP_H
+#define LOOKUP_H
+
+#if defined( __XC )
+#include <xc.h> /* XC8 General Include File */
+#endif
+
+#include "mapper.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+//
+//! The table is indexed by the top 8-bits of the tank input
+//
+#define LOOKUP_INDEX_SHIFT 8
+
+//
+//! Number of table entries including the extra one for the top of the range
+//
+#define LOOKUP_TABLE_SIZE ( ( 0x10000UL >> LOOKUP_INDEX_SHIFT ) + 1 )
+
+//
+//! Total number of entries written to persistent storage
+//
+#define LOOKUP_STORAGE_SIZE LOOKUP_TABLE_SIZE
+
+//
+//! Entries are stored in 14-bit flash words so drop the bottom bits
+//
+#define LOOKUP_ENTRY_SHIFT 2
+
+//
+//! Value of an entry in erased flash
+//
+#define LOOKUP_ERASED_ENTRY 0x3FFF
+
+#ifdef __cplusplus // Provide C++ Compatibility
+extern "C" {
+#endif
+
+void     BuildLookupTable( const CompiledMap* map );
+bool     CheckLookupTable( const CompiledMap* map );
+uint16_t LookupValue( uint16_t value );
+
+#ifdef __cplusplus // Provide C++ Compatibility
+}
+#endif
+
+#endif // LOOKUP_H
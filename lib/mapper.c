@@ -58,148 +58,1015 @@ static uint16_t InterpolateBinValue(
     return (uint16_t)output;
 }
 
+//
+//! Flag in a bin search result indicating the value lies outside the map and
+//! should be clamped to the output of the bin in the remaining bits
+//
+#define BIN_CLAMP_FLAG 0x80
+
+//
+//! Bin search result indicating the value lies beyond the first map bin
+//
+#define BIN_CLAMP_FIRST ( BIN_CLAMP_FLAG | 0 )
+
+//
+//! Bin search result indicating the value lies beyond the last map bin
+//
+#define BIN_CLAMP_LAST ( BIN_CLAMP_FLAG | ( MAPSIZE - 1 ) )
+
 ///////////////////////////////////////////////////////////////////////////////
 //!
-//! \brief  Map a value by scanning through the input map of increasing values
+//! \brief  Find the bounding bins with a binary search of the input map of
+//!         increasing values
 //!
 //! This function assumes that the inputMap refers to a map that has steadily
-//! increasing values
+//! increasing values. The lower of the two bounding bins is returned.
 //!
 ///////////////////////////////////////////////////////////////////////////////
-static uint16_t MapInputValueIncreasing(
-    uint16_t        value,
-    const uint16_t* inputMap,
-    const uint16_t* outputMap )
+static uint8_t FindBinIncreasing( uint16_t value, const uint16_t* inputMap )
 {
     //
     // Check to see if we are below the bottom map bin
     //
     if ( value < inputMap[ 0 ] )
     {
-        //
-        // Clamp at the bottom output map value
-        //
-        return outputMap[ 0 ];
+        return BIN_CLAMP_FIRST;
     }
 
     //
-    // Scan to find bounding bin
+    // Check to see if we are above the top map bin
+    //
+    if ( value >= inputMap[ MAPSIZE - 1 ] )
+    {
+        return BIN_CLAMP_LAST;
+    }
+
+    //
+    // Narrow down the bounding bins keeping the value at or above the lower
+    // bin and below the upper bin
     //
     uint8_t lowerBin = 0;
-    bool    found = false;
-    while ( !found && lowerBin < MAPSIZE - 1 )
+    uint8_t upperBin = MAPSIZE - 1;
+
+    while ( upperBin - lowerBin > 1 )
     {
-        if ( value >= inputMap[ lowerBin ] && value < inputMap[ lowerBin + 1 ] )
+        uint8_t middleBin = ( lowerBin + upperBin ) >> 1;
+
+        if ( value >= inputMap[ middleBin ] )
         {
-            found = true;
+            lowerBin = middleBin;
         }
         else
         {
-            lowerBin++;
+            upperBin = middleBin;
         }
     }
 
+    return lowerBin;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Find the bounding bins with a binary search of the input map of
+//!         decreasing values
+//!
+//! This function assumes that the inputMap refers to a map that has steadily
+//! decreasing values. The lower of the two bounding bins is returned.
+//!
+///////////////////////////////////////////////////////////////////////////////
+static uint8_t FindBinDecreasing( uint16_t value, const uint16_t* inputMap )
+{
     //
-    // If we haven't found a value we must be above the top map bin
+    // Check to see if we are above the bottom map bin
     //
-    if ( !found )
+    if ( value > inputMap[ 0 ] )
     {
-        //
-        // Clamp at the top output map value
-        //
-        return outputMap[ lowerBin ];
+        return BIN_CLAMP_FIRST;
     }
 
     //
-    // Having found the input bins we can interpolate between them
+    // Check to see if we are below the top map bin
     //
-    return InterpolateBinValue(
-        value, lowerBin, lowerBin + 1, inputMap, outputMap );
+    if ( value <= inputMap[ MAPSIZE - 1 ] )
+    {
+        return BIN_CLAMP_LAST;
+    }
+
+    //
+    // Narrow down the bounding bins keeping the value at or below the lower
+    // bin and above the upper bin
+    //
+    uint8_t lowerBin = 0;
+    uint8_t upperBin = MAPSIZE - 1;
+
+    while ( upperBin - lowerBin > 1 )
+    {
+        uint8_t middleBin = ( lowerBin + upperBin ) >> 1;
+
+        if ( value <= inputMap[ middleBin ] )
+        {
+            lowerBin = middleBin;
+        }
+        else
+        {
+            upperBin = middleBin;
+        }
+    }
+
+    return lowerBin;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 //!
-//! \brief  Map a value by scanning the input map of decreasing values
+//! \brief  Find the lower of the two bins in the input map that bound a value
 //!
-//! This function assumes that the inputMap refers to a map that has steadily
-//! decreasing values
+//! Returns BIN_CLAMP_FIRST or BIN_CLAMP_LAST if the value lies outside the map
+//!
+///////////////////////////////////////////////////////////////////////////////
+static uint8_t FindBin( uint16_t value, const uint16_t* inputMap )
+{
+    //
+    // Does our input map count up or down. Maps that turn back on themselves
+    // need FindBinFolded() to be searched reliably.
+    //
+    if ( inputMap[ 0 ] < inputMap[ MAPSIZE - 1 ] )
+    {
+        return FindBinIncreasing( value, inputMap );
+    }
+    else
+    {
+        return FindBinDecreasing( value, inputMap );
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Map a value using the supplied map bins as input values
+//!
+//! The value supplied is used to identify which bins constrain it. The bins
+//! dictate the values to be output. The value output is a linear interpolation
+//! between the values. It is assumed that map is not NULL and has MAPSIZE bins
 //!
 ///////////////////////////////////////////////////////////////////////////////
-static uint16_t MapInputValueDecreasing(
+uint16_t MapValue(
     uint16_t        value,
     const uint16_t* inputMap,
     const uint16_t* outputMap )
 {
+    uint8_t lowerBin = FindBin( value, inputMap );
+
     //
-    // Check to see if we are above the bottom map bin
+    // Clamp at the first or last output map value if we are outside the map
     //
-    if ( value > inputMap[ 0 ] )
+    if ( lowerBin == BIN_CLAMP_FIRST )
     {
-        //
-        // Clamp at the bottom output map value
-        //
         return outputMap[ 0 ];
     }
+    else if ( lowerBin == BIN_CLAMP_LAST )
+    {
+        return outputMap[ MAPSIZE - 1 ];
+    }
 
     //
-    // Scan to find bounding bin
+    // Having found the input bins we can interpolate between them
     //
-    uint8_t lowerBin = 0;
-    bool    found = false;
-    while ( !found && lowerBin < MAPSIZE - 1 )
+    return InterpolateBinValue(
+        value, lowerBin, lowerBin + 1, inputMap, outputMap );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Interpolate within a bin of an input map onto LinearFullScale
+//!
+//! The lowerBin may be a clamp value
+//!
+///////////////////////////////////////////////////////////////////////////////
+static uint16_t InterpolateToLinear(
+    uint16_t        value,
+    uint8_t         lowerBin,
+    const uint16_t* inputMap )
+{
+    if ( lowerBin & BIN_CLAMP_FLAG )
+    {
+        return LINEAR_BIN_VALUE( lowerBin & ~BIN_CLAMP_FLAG );
+    }
+
+    //
+    // Work with the distances from the lower bin so the values are always
+    // positive whichever direction the bin runs in. This gives the same
+    // result as the signed division in InterpolateBinValue() as both the
+    // value and bin differences change sign together.
+    //
+    uint16_t valueDiff;
+    uint16_t inputBinDiff;
+    if ( inputMap[ lowerBin ] < inputMap[ lowerBin + 1 ] )
+    {
+        valueDiff = value - inputMap[ lowerBin ];
+        inputBinDiff = inputMap[ lowerBin + 1 ] - inputMap[ lowerBin ];
+    }
+    else
+    {
+        valueDiff = inputMap[ lowerBin ] - value;
+        inputBinDiff = inputMap[ lowerBin ] - inputMap[ lowerBin + 1 ];
+    }
+
+    uint32_t scaledDiff = (uint32_t)valueDiff << LINEAR_BIN_SHIFT;
+
+    //
+    // The last bin ends at 0xFFFF rather than 0x10000 so is one narrower
+    //
+    if ( lowerBin == MAPSIZE - 2 )
+    {
+        scaledDiff -= valueDiff;
+    }
+
+    uint16_t output = (uint16_t)lowerBin << LINEAR_BIN_SHIFT;
+
+    return output + (uint16_t)( scaledDiff / inputBinDiff );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Map a value onto a LinearFullScale output map
+//!
+//! This gives exactly the same result as MapValue() with LinearFullScale as
+//! the output map. Each output bin is LINEAR_BIN_WIDTH wide (bar the last one
+//! which is one less) so the multiply needed by the interpolation is replaced
+//! with a shift.
+//!
+///////////////////////////////////////////////////////////////////////////////
+uint16_t MapValueToLinear( uint16_t value, const uint16_t* inputMap )
+{
+    return InterpolateToLinear( value, FindBin( value, inputMap ), inputMap );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Map a value from a LinearFullScale input map
+//!
+//! This gives exactly the same result as MapValue() with LinearFullScale as
+//! the input map. The bounding bin is found with a shift rather than a search
+//! and, apart from the last bin, the division needed by the interpolation is
+//! replaced with a shift.
+//!
+///////////////////////////////////////////////////////////////////////////////
+uint16_t MapLinearValue( uint16_t value, const uint16_t* outputMap )
+{
+    //
+    // Full scale is the only value that lies outside the linear map
+    //
+    if ( value == 0xFFFF )
+    {
+        return outputMap[ MAPSIZE - 1 ];
+    }
+
+    uint8_t lowerBin = value >> LINEAR_BIN_SHIFT;
+    int32_t valueDiff = value & ( LINEAR_BIN_WIDTH - 1 );
+    int32_t outputBinDiff =
+        (int32_t)outputMap[ lowerBin + 1 ] - outputMap[ lowerBin ];
+
+    int32_t output = valueDiff * outputBinDiff;
+
+    if ( lowerBin == MAPSIZE - 2 )
     {
-        if ( value <= inputMap[ lowerBin ] && value > inputMap[ lowerBin + 1 ] )
+        //
+        // The last bin is one narrower so we have to divide
+        //
+        output = output / ( LINEAR_BIN_WIDTH - 1 );
+    }
+    else if ( output >= 0 )
+    {
+        output = output >> LINEAR_BIN_SHIFT;
+    }
+    else
+    {
+        //
+        // Shift the magnitude so we round towards zero the same as a divide
+        //
+        output = -( -output >> LINEAR_BIN_SHIFT );
+    }
+
+    output = outputMap[ lowerBin ] + output;
+
+    return (uint16_t)output;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Check whether an input map never turns back on itself
+//!
+//! Flat segments don't count as turning back.
+//!
+///////////////////////////////////////////////////////////////////////////////
+bool IsMapMonotonic( const uint16_t* inputMap )
+{
+    bool increasing = inputMap[ 0 ] < inputMap[ MAPSIZE - 1 ];
+
+    for ( uint8_t bin = 0; bin < MAPSIZE - 1; bin++ )
+    {
+        if ( increasing ? inputMap[ bin + 1 ] < inputMap[ bin ]
+                        : inputMap[ bin + 1 ] > inputMap[ bin ] )
         {
-            found = true;
+            return false;
         }
-        else
+    }
+
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Find the bin for a value in an input map that may turn back on
+//!         itself
+//!
+//! The first segment that covers the value and the values just above it is
+//! used so where the map turns back on itself the reading errs towards empty.
+//! Values outside the map are clamped to the first bin holding the nearest
+//! end value. This scans every segment so is only worth using when the
+//! binary searches can't be.
+//!
+///////////////////////////////////////////////////////////////////////////////
+static uint8_t FindBinFolded( uint16_t value, const uint16_t* inputMap )
+{
+    uint8_t lowest = 0;
+    uint8_t highest = 0;
+
+    for ( uint8_t bin = 0; bin < MAPSIZE; bin++ )
+    {
+        uint16_t start = inputMap[ bin ];
+
+        if ( bin < MAPSIZE - 1 )
         {
-            lowerBin++;
+            uint16_t end = inputMap[ bin + 1 ];
+
+            if ( start < end ? start <= value && value < end
+                             : end <= value && value < start )
+            {
+                return bin;
+            }
+        }
+
+        if ( start < inputMap[ lowest ] )
+        {
+            lowest = bin;
+        }
+        if ( start > inputMap[ highest ] )
+        {
+            highest = bin;
         }
     }
 
     //
-    // If we haven't found a value we must be below the top map bin
+    // No segment covers the value so it is below or at the top of the map
     //
-    if ( !found )
+    return BIN_CLAMP_FLAG | ( value < inputMap[ lowest ] ? lowest : highest );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Map a value onto a LinearFullScale output map from an input map
+//!         that may turn back on itself
+//!
+//! This gives exactly the same result as MapValueToLinear() for monotonic
+//! input maps. Otherwise the value is mapped through the segment nearest the
+//! start of the map that covers it.
+//!
+///////////////////////////////////////////////////////////////////////////////
+uint16_t MapFoldedValueToLinear( uint16_t value, const uint16_t* inputMap )
+{
+    if ( IsMapMonotonic( inputMap ) )
     {
+        return MapValueToLinear( value, inputMap );
+    }
+
+    return InterpolateToLinear(
+        value, FindBinFolded( value, inputMap ), inputMap );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Check whether a segment of an input map overlaps another
+//!
+//! A value in an ambiguous segment could be read as more than one tank level.
+//! Flat segments are never reported as they cover no range of values.
+//!
+///////////////////////////////////////////////////////////////////////////////
+bool IsSegmentAmbiguous( const uint16_t* inputMap, uint8_t bin )
+{
+    uint16_t low = inputMap[ bin ];
+    uint16_t high = inputMap[ bin + 1 ];
+
+    if ( low > high )
+    {
+        low = inputMap[ bin + 1 ];
+        high = inputMap[ bin ];
+    }
+    else if ( low == high )
+    {
+        return false;
+    }
+
+    for ( uint8_t other = 0; other < MAPSIZE - 1; other++ )
+    {
+        uint16_t otherLow = inputMap[ other ];
+        uint16_t otherHigh = inputMap[ other + 1 ];
+
+        if ( otherLow > otherHigh )
+        {
+            otherLow = inputMap[ other + 1 ];
+            otherHigh = inputMap[ other ];
+        }
+
         //
-        // Clamp at the top output map value
+        // Segments that only touch at a bin don't overlap
         //
-        return outputMap[ lowerBin ];
+        if ( other != bin && otherLow < high && low < otherHigh )
+        {
+            return true;
+        }
     }
 
+    return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Prepare a pair of maps so values can be mapped without division
+//!
+//! The slope of each segment is calculated once as a fixed-point multiplier
+//! with COMPILED_SLOPE_SHIFT fractional bits. This needs to be re-run whenever
+//! either of the maps change. The maps are referenced rather than copied so
+//! must outlive the compiled map.
+//!
+///////////////////////////////////////////////////////////////////////////////
+void CompileMap(
+    CompiledMap*    map,
+    const uint16_t* inputMap,
+    const uint16_t* outputMap )
+{
+    map->inputMap = inputMap;
+    map->outputMap = outputMap;
+    map->increasing = inputMap[ 0 ] < inputMap[ MAPSIZE - 1 ];
+    map->monotonic = IsMapMonotonic( inputMap );
+
+    for ( uint8_t bin = 0; bin < MAPSIZE - 1; bin++ )
+    {
+        //
+        // Measure the input bin width in the direction of the segment so the
+        // value difference used when mapping is always positive
+        //
+        int32_t inputBinDiff = (int32_t)inputMap[ bin + 1 ] - inputMap[ bin ];
+        int32_t outputBinDiff =
+            (int32_t)outputMap[ bin + 1 ] - outputMap[ bin ];
+
+        if ( inputBinDiff < 0 )
+        {
+            inputBinDiff = -inputBinDiff;
+        }
+
+        //
+        // Flat segments can never be found by the bin search so don't need a
+        // slope
+        //
+        if ( inputBinDiff == 0 )
+        {
+            map->slope[ bin ] = 0;
+            continue;
+        }
+
+        //
+        // Calculate the magnitude of the slope rounded to the nearest step.
+        // This can't overflow as the output difference is at most 16-bits
+        //
+        uint32_t magnitude =
+            outputBinDiff < 0 ? -outputBinDiff : outputBinDiff;
+        magnitude = ( magnitude << COMPILED_SLOPE_SHIFT ) + inputBinDiff / 2;
+        magnitude = magnitude / inputBinDiff;
+
+        map->slope[ bin ] =
+            outputBinDiff < 0 ? -(int32_t)magnitude : (int32_t)magnitude;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Interpolate within a bin of a compiled map
+//!
+//! The lowerBin may be a clamp value
+//!
+///////////////////////////////////////////////////////////////////////////////
+static uint16_t InterpolateCompiledBin(
+    uint16_t           value,
+    uint8_t            lowerBin,
+    const CompiledMap* map )
+{
+    const uint16_t* inputMap = map->inputMap;
+    const uint16_t* outputMap = map->outputMap;
+
+    if ( lowerBin & BIN_CLAMP_FLAG )
+    {
+        return outputMap[ lowerBin & ~BIN_CLAMP_FLAG ];
+    }
+
+    uint16_t valueDiff = inputMap[ lowerBin ] < inputMap[ lowerBin + 1 ]
+        ? value - inputMap[ lowerBin ]
+        : inputMap[ lowerBin ] - value;
+
     //
-    // Having found the input bins we can interpolate between them
+    // The value difference is always less than the bin width so the product
+    // is bounded by the output difference and fits in 32-bits
     //
-    return InterpolateBinValue(
-        value, lowerBin, lowerBin + 1, inputMap, outputMap );
+    int32_t  slope = map->slope[ lowerBin ];
+    uint16_t output = outputMap[ lowerBin ];
+
+    if ( slope >= 0 )
+    {
+        uint32_t change = (uint32_t)valueDiff * slope;
+        return output + (uint16_t)( change >> COMPILED_SLOPE_SHIFT );
+    }
+    else
+    {
+        uint32_t change = (uint32_t)valueDiff * -slope;
+        return output - (uint16_t)( change >> COMPILED_SLOPE_SHIFT );
+    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 //!
-//! \brief  Map a value using the supplied map bins as input values
+//! \brief  Find the bin for a value in a compiled map
 //!
-//! The value supplied is used to identify which bins constrain it. The bins
-//! dictate the values to be output. The value output is a linear interpolation
-//! between the values. It is assumed that map is not NULL and has 9 bins
+//! Input maps that aren't monotonic are searched segment by segment
 //!
 ///////////////////////////////////////////////////////////////////////////////
-uint16_t MapValue(
-    uint16_t        value,
+static uint8_t FindCompiledBin( uint16_t value, const CompiledMap* map )
+{
+    if ( !map->monotonic )
+    {
+        return FindBinFolded( value, map->inputMap );
+    }
+    else if ( map->increasing )
+    {
+        return FindBinIncreasing( value, map->inputMap );
+    }
+    else
+    {
+        return FindBinDecreasing( value, map->inputMap );
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Map a value using a compiled map
+//!
+//! This is equivalent to MapValue() but costs a single multiply and shift once
+//! the bin is found. As the slopes are rounded the result may differ from
+//! MapValue() by a couple of counts.
+//!
+///////////////////////////////////////////////////////////////////////////////
+uint16_t MapCompiledValue( uint16_t value, const CompiledMap* map )
+{
+    uint8_t lowerBin = FindCompiledBin( value, map );
+
+    return InterpolateCompiledBin( value, lowerBin, map );
+}
+
+//
+//! Hinted bin search result indicating the value wasn't near the hint
+//
+#define BIN_HINT_MISS 0xFF
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Check whether a value lies in a bin (or clamp) of a compiled map
+//!
+//! This gives the same answer as the bin searches as long as the input map is
+//! monotonic and so no two bins overlap.
+//!
+///////////////////////////////////////////////////////////////////////////////
+static bool BinContainsValue(
+    uint16_t           value,
+    uint8_t            bin,
+    const CompiledMap* map )
+{
+    const uint16_t* inputMap = map->inputMap;
+
+    if ( bin == BIN_CLAMP_FIRST )
+    {
+        return map->increasing ? value < inputMap[ 0 ]
+                               : value > inputMap[ 0 ];
+    }
+    else if ( bin == BIN_CLAMP_LAST )
+    {
+        return map->increasing ? value >= inputMap[ MAPSIZE - 1 ]
+                               : value <= inputMap[ MAPSIZE - 1 ];
+    }
+    else if ( map->increasing )
+    {
+        return value >= inputMap[ bin ] && value < inputMap[ bin + 1 ];
+    }
+    else
+    {
+        return value <= inputMap[ bin ] && value > inputMap[ bin + 1 ];
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Look for a value in the hinted bin and then its neighbours
+//!
+//! The clamps are treated as neighbours of the first and last bins. Returns
+//! BIN_HINT_MISS if the value isn't close to the hint.
+//!
+///////////////////////////////////////////////////////////////////////////////
+static uint8_t FindBinNearHint(
+    uint16_t           value,
+    uint8_t            hint,
+    const CompiledMap* map )
+{
+    //
+    // Number the clamps and bins in search order so neighbours are adjacent
+    //
+    uint8_t position;
+    if ( hint == BIN_CLAMP_FIRST )
+    {
+        position = 0;
+    }
+    else if ( hint == BIN_CLAMP_LAST )
+    {
+        position = MAPSIZE;
+    }
+    else if ( hint < MAPSIZE - 1 )
+    {
+        position = hint + 1;
+    }
+    else
+    {
+        return BIN_HINT_MISS;
+    }
+
+    if ( BinContainsValue( value, hint, map ) )
+    {
+        return hint;
+    }
+
+    uint8_t first = position > 0 ? position - 1 : 0;
+    uint8_t last = position < MAPSIZE ? position + 1 : MAPSIZE;
+
+    for ( uint8_t i = first; i <= last; i++ )
+    {
+        uint8_t bin = i == 0 ? BIN_CLAMP_FIRST
+                             : i == MAPSIZE ? BIN_CLAMP_LAST : i - 1;
+
+        if ( i != position && BinContainsValue( value, bin, map ) )
+        {
+            return bin;
+        }
+    }
+
+    return BIN_HINT_MISS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Reset a bin hint and its statistics
+//!
+///////////////////////////////////////////////////////////////////////////////
+void ResetBinHint( BinHint* hint )
+{
+    hint->bin = BIN_CLAMP_FIRST;
+    hint->hits = 0;
+    hint->searches = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Map a value using a compiled map starting from the last bin found
+//!
+//! This gives exactly the same result as MapCompiledValue(). The bin found by
+//! the previous call and its neighbours are checked first and the full search
+//! is only needed when the value has jumped further. Maps that aren't
+//! monotonic always use the full search as a value may lie in more than one
+//! bin.
+//!
+///////////////////////////////////////////////////////////////////////////////
+uint16_t MapCompiledValueHinted(
+    uint16_t           value,
+    const CompiledMap* map,
+    BinHint*           hint )
+{
+    uint8_t lowerBin = BIN_HINT_MISS;
+
+    if ( map->monotonic )
+    {
+        lowerBin = FindBinNearHint( value, hint->bin, map );
+    }
+
+    //
+    // Keep the hit rate meaningful by halving both counts before they wrap
+    //
+    if ( hint->searches == UINT16_MAX )
+    {
+        hint->searches >>= 1;
+        hint->hits >>= 1;
+    }
+    hint->searches++;
+
+    if ( lowerBin == BIN_HINT_MISS )
+    {
+        lowerBin = FindCompiledBin( value, map );
+    }
+    else
+    {
+        hint->hits++;
+    }
+
+    hint->bin = lowerBin;
+
+    return InterpolateCompiledBin( value, lowerBin, map );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Calculate the tangent at one end of a cubic map segment
+//!
+//! The tangent is scaled to the output change it would give across the whole
+//! segment and measured in the direction the segment's output runs. It is the
+//! average of the slopes either side, limited to three times each of them
+//! (the Fritsch-Carlson condition) so the curve can't overshoot. It is zero
+//! at a peak or trough of the output map.
+//!
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t CubicTangent(
+    uint16_t rise,
+    uint16_t width,
+    uint16_t otherRise,
+    uint16_t otherWidth,
+    bool     sameDirection )
+{
+    if ( !sameDirection || rise == 0 || otherRise == 0 )
+    {
+        return 0;
+    }
+
+    //
+    // Scale the neighbour's rise to this segment's width. Anything over six
+    // times our own rise is limited below so doesn't need to be exact.
+    //
+    uint32_t other = ( (uint32_t)otherRise * width ) / otherWidth;
+    uint32_t limit = 6 * (uint32_t)rise;
+
+    if ( other > limit )
+    {
+        other = limit;
+    }
+
+    uint32_t tangent = ( rise + other ) / 2;
+
+    limit = 3 * ( other < rise ? other : (uint32_t)rise );
+
+    return tangent < limit ? tangent : limit;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Calculate the tangent at the end of a cubic map
+//!
+//! This is the slope at the end of a quadratic through the last segment and
+//! its neighbour, limited as for CubicTangent(). This follows the curve at
+//! the ends of the map far better than the segment's own slope.
+//!
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t CubicEndTangent(
+    uint16_t rise,
+    uint16_t width,
+    uint16_t otherRise,
+    uint16_t otherWidth,
+    bool     sameDirection )
+{
+    uint32_t other = ( (uint32_t)otherRise * width ) / otherWidth;
+    uint32_t limit = 6 * (uint32_t)rise;
+
+    if ( other > limit )
+    {
+        other = limit;
+    }
+
+    //
+    // The tangent moves away from the segment's slope in proportion to the
+    // difference between the slopes and the share of the width taken by this
+    // segment. The fraction has 13 bits so the products fit in 32-bits.
+    //
+    uint32_t fraction =
+        ( (uint32_t)width << 13 ) / ( (uint32_t)width + otherWidth );
+    uint32_t tangent;
+
+    if ( !sameDirection )
+    {
+        tangent = rise + ( ( ( rise + other ) * fraction ) >> 13 );
+    }
+    else if ( other <= rise )
+    {
+        tangent = rise + ( ( ( rise - other ) * fraction ) >> 13 );
+    }
+    else
+    {
+        uint32_t correction = ( ( other - rise ) * fraction ) >> 13;
+        tangent = correction < rise ? rise - correction : 0;
+    }
+
+    limit = 3 * (uint32_t)rise;
+
+    return tangent < limit ? tangent : limit;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Prepare a pair of maps for monotone cubic interpolation
+//!
+//! The tangents and reciprocal bin widths are calculated here so mapping a
+//! value needs no division. This needs to be re-run whenever either map
+//! changes. Input maps that turn back on themselves are mapped linearly.
+//!
+///////////////////////////////////////////////////////////////////////////////
+void CompileCubicMap(
+    CubicMap*       map,
     const uint16_t* inputMap,
     const uint16_t* outputMap )
 {
+    uint16_t width[ MAPSIZE - 1 ];
+    uint16_t rise[ MAPSIZE - 1 ];
+    bool     rising[ MAPSIZE - 1 ];
+
+    CompileMap( &map->linear, inputMap, outputMap );
+    map->cubic = map->linear.monotonic;
+
+    for ( uint8_t bin = 0; bin < MAPSIZE - 1; bin++ )
+    {
+        width[ bin ] = inputMap[ bin ] < inputMap[ bin + 1 ]
+            ? inputMap[ bin + 1 ] - inputMap[ bin ]
+            : inputMap[ bin ] - inputMap[ bin + 1 ];
+
+        rising[ bin ] = outputMap[ bin ] < outputMap[ bin + 1 ];
+        rise[ bin ] = rising[ bin ] ? outputMap[ bin + 1 ] - outputMap[ bin ]
+                                    : outputMap[ bin ] - outputMap[ bin + 1 ];
+    }
+
+    for ( uint8_t bin = 0; bin < MAPSIZE - 1; bin++ )
+    {
+        map->reciprocal[ bin ] = 0;
+        map->reciprocalShift[ bin ] = 0;
+        map->startTangent[ bin ] = 0;
+        map->endTangent[ bin ] = 0;
+
+        //
+        // Flat segments can never be found by the bin search
+        //
+        if ( width[ bin ] == 0 )
+        {
+            continue;
+        }
+
+        //
+        // Scale the reciprocal by the width's most significant bit so it
+        // keeps 15 bits of precision whatever the width
+        //
+        uint8_t shift = 0;
+        while ( width[ bin ] >> ( shift + 1 ) )
+        {
+            shift++;
+        }
+
+        uint32_t scale = 1UL << ( CUBIC_POSITION_SHIFT + shift );
+        map->reciprocal[ bin ] =
+            (uint16_t)( ( scale + width[ bin ] / 2 ) / width[ bin ] );
+        map->reciprocalShift[ bin ] = shift;
+
+        //
+        // A step in the input map is treated like the end of the map. A
+        // segment with no neighbours at all is left as a straight line.
+        //
+        uint16_t previousWidth = bin > 0 ? width[ bin - 1 ] : 0;
+        uint16_t nextWidth = bin < MAPSIZE - 2 ? width[ bin + 1 ] : 0;
+        bool     previousSame = bin > 0 && rising[ bin ] == rising[ bin - 1 ];
+        bool     nextSame =
+            bin < MAPSIZE - 2 && rising[ bin ] == rising[ bin + 1 ];
+
+        if ( previousWidth )
+        {
+            map->startTangent[ bin ] = CubicTangent(
+                rise[ bin ], width[ bin ], rise[ bin - 1 ], previousWidth,
+                previousSame );
+        }
+        else if ( nextWidth )
+        {
+            map->startTangent[ bin ] = CubicEndTangent(
+                rise[ bin ], width[ bin ], rise[ bin + 1 ], nextWidth,
+                nextSame );
+        }
+        else
+        {
+            map->startTangent[ bin ] = rise[ bin ];
+        }
+
+        if ( nextWidth )
+        {
+            map->endTangent[ bin ] = CubicTangent(
+                rise[ bin ], width[ bin ], rise[ bin + 1 ], nextWidth,
+                nextSame );
+        }
+        else if ( previousWidth )
+        {
+            map->endTangent[ bin ] = CubicEndTangent(
+                rise[ bin ], width[ bin ], rise[ bin - 1 ], previousWidth,
+                previousSame );
+        }
+        else
+        {
+            map->endTangent[ bin ] = rise[ bin ];
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Map a value using a monotone cubic map
+//!
+//! Once the bin is found the curve is evaluated as a cubic Hermite spline with
+//! six multiplies and no division. The output always lies between the values
+//! of the bins either side. Rounding the powers of the position may make the
+//! output step back by a single count within a segment.
+//!
+///////////////////////////////////////////////////////////////////////////////
+uint16_t MapCubicValue( uint16_t value, const CubicMap* map )
+{
+    if ( !map->cubic )
+    {
+        return MapCompiledValue( value, &map->linear );
+    }
+
+    const uint16_t* inputMap = map->linear.inputMap;
+    const uint16_t* outputMap = map->linear.outputMap;
+
+    uint8_t lowerBin = FindCompiledBin( value, &map->linear );
+
+    if ( lowerBin & BIN_CLAMP_FLAG )
+    {
+        return outputMap[ lowerBin & ~BIN_CLAMP_FLAG ];
+    }
+
+    uint16_t valueDiff = inputMap[ lowerBin ] < inputMap[ lowerBin + 1 ]
+        ? value - inputMap[ lowerBin ]
+        : inputMap[ lowerBin ] - value;
+
     //
-    // Does our input map count up or down
-    // This is super naive and will likely not work for a complex map
+    // Find the position t through the segment and its powers. The value
+    // difference is less than twice the reciprocal's scale so this fits in
+    // 32-bits.
     //
-    if ( inputMap[ 0 ] < inputMap[ MAPSIZE - 1 ] )
+    uint32_t position =
+        ( (uint32_t)valueDiff * map->reciprocal[ lowerBin ] ) >>
+        map->reciprocalShift[ lowerBin ];
+
+    if ( position > ( 1UL << CUBIC_POSITION_SHIFT ) )
     {
-        return MapInputValueIncreasing( value, inputMap, outputMap );
+        position = 1UL << CUBIC_POSITION_SHIFT;
     }
-    else
+
+    uint32_t squared = ( position * position ) >> CUBIC_POSITION_SHIFT;
+    uint32_t cubed = ( squared * position ) >> CUBIC_POSITION_SHIFT;
+
+    //
+    // Weight the rise and the tangents with the Hermite basis functions
+    // 3t^2 - 2t^3, t^3 - 2t^2 + t and t^2 - t^3. The last is subtracted as
+    // its tangent reduces the output.
+    //
+    uint32_t riseBasis = 3 * squared - 2 * cubed;
+    uint32_t startBasis = cubed + position;
+    uint32_t endBasis = squared - cubed;
+
+    startBasis = startBasis > 2 * squared ? startBasis - 2 * squared : 0;
+
+    bool     rising = outputMap[ lowerBin ] < outputMap[ lowerBin + 1 ];
+    uint16_t rise = rising ? outputMap[ lowerBin + 1 ] - outputMap[ lowerBin ]
+                           : outputMap[ lowerBin ] - outputMap[ lowerBin + 1 ];
+
+    uint32_t change = (uint32_t)rise * riseBasis +
+        map->startTangent[ lowerBin ] * startBasis;
+    uint32_t fall = map->endTangent[ lowerBin ] * endBasis;
+
+    change = change > fall ? change - fall : 0;
+    change = ( change + ( 1UL << ( CUBIC_POSITION_SHIFT - 1 ) ) ) >>
+        CUBIC_POSITION_SHIFT;
+
+    //
+    // Rounding mustn't take us past the next bin
+    //
+    if ( change > rise )
     {
-        return MapInputValueDecreasing( value, inputMap, outputMap );
+        change = rise;
     }
+
+    uint16_t output = outputMap[ lowerBin ];
+
+    return rising ? output + (uint16_t)change : output - (uint16_t)change;
 }
@@ -26,9 +26,99 @@
 #include <xc.h> /* XC8 General Include File */
 #endif
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
-#define MAPSIZE 9 // 3-bits + 1
+//
+//! Number of bits in a map bin number. Each map has 2^MAPSIZE_BITS bins plus
+//! one so the LinearFullScale bins are all a power of two wide. This can be
+//! overridden at build time but changes the layout of the saved maps.
+//
+#ifndef MAPSIZE_BITS
+#define MAPSIZE_BITS 3
+#endif
+
+#if MAPSIZE_BITS < 2 || MAPSIZE_BITS > 6
+#error "MAPSIZE_BITS must be between 2 and 6"
+#endif
+
+#define MAPSIZE ( ( 1 << MAPSIZE_BITS ) + 1 )
+
+//
+//! Shift needed to convert a full-scale value into a LinearFullScale bin
+//
+#define LINEAR_BIN_SHIFT ( 16 - MAPSIZE_BITS )
+
+//
+//! Width of each LinearFullScale bin (bar the last which is one less)
+//
+#define LINEAR_BIN_WIDTH ( 1L << LINEAR_BIN_SHIFT )
+
+//
+//! Value of a bin in the LinearFullScale map
+//
+#define LINEAR_BIN_VALUE( bin )                                                \
+    ( ( bin ) == MAPSIZE - 1 ? 0xFFFF : (uint16_t)( bin ) << LINEAR_BIN_SHIFT )
+
+//
+//! Number of fractional bits in each compiled map segment slope
+//
+#define COMPILED_SLOPE_SHIFT 15
+
+//
+//! A map pair that has been prepared so values can be mapped without division
+//
+typedef struct
+{
+    const uint16_t* inputMap;  //!< Input map the slopes were built from
+    const uint16_t* outputMap; //!< Output map the slopes were built from
+    int32_t slope[ MAPSIZE - 1 ]; //!< Output change per input step per segment
+    bool    increasing;           //!< Direction of the input map
+    bool    monotonic;            //!< Input map never turns back on itself
+} CompiledMap;
+
+//
+//! Number of fractional bits in the position within a cubic map segment
+//
+#define CUBIC_POSITION_SHIFT 15
+
+//
+//! A map pair prepared for monotone cubic (Fritsch-Carlson) interpolation.
+//! The curve passes through every bin but has no kinks between them. Output
+//! maps that rise or fall steadily give output that does the same.
+//
+typedef struct
+{
+    CompiledMap linear; //!< Bin search, clamps and non-monotonic fallback
+    uint16_t reciprocal[ MAPSIZE - 1 ]; //!< Scaled inverse of each bin width
+    uint8_t  reciprocalShift[ MAPSIZE - 1 ]; //!< Scale of each reciprocal
+    uint32_t startTangent[ MAPSIZE - 1 ];    //!< Output change per segment
+    uint32_t endTangent[ MAPSIZE - 1 ];      //!< Output change per segment
+    bool     cubic; //!< Input map is monotonic so the curve can be used
+} CubicMap;
+
+//
+//! The bin found by the last hinted mapping and how often the hint was good.
+//! Fuel levels change slowly so the next value is almost always in the same
+//! bin or one of its neighbours.
+//
+typedef struct
+{
+    uint8_t  bin;      //!< Lower bin (or clamp) found by the last mapping
+    uint16_t hits;     //!< Searches resolved from the hint
+    uint16_t searches; //!< Total searches made (halved with hits on overflow)
+} BinHint;
+
+//
+//! Ways of mapping a batch of values. All give identical results to MapValue()
+//
+typedef enum
+{
+    BATCH_MAPPER_SCALAR, //!< Portable one value at a time
+    BATCH_MAPPER_SSE2,   //!< 8 values at a time on x86 hosts with SSE2
+    BATCH_MAPPER_AVX2    //!< 16 values at a time on x86 hosts with AVX2
+} BatchMapper;
 
 #ifdef __cplusplus // Provide C++ Compatibility
 extern "C" {
@@ -39,6 +129,45 @@ uint16_t MapValue(
     const uint16_t* inputMap,
     const uint16_t* outputMap );
 
+uint16_t MapValueToLinear( uint16_t value, const uint16_t* inputMap );
+uint16_t MapFoldedValueToLinear( uint16_t value, const uint16_t* inputMap );
+uint16_t MapLinearValue( uint16_t value, const uint16_t* outputMap );
+
+bool IsMapMonotonic( const uint16_t* inputMap );
+bool IsSegmentAmbiguous( const uint16_t* inputMap, uint8_t bin );
+
+void CompileMap(
+    CompiledMap*    map,
+    const uint16_t* inputMap,
+    const uint16_t* outputMap );
+uint16_t MapCompiledValue( uint16_t value, const CompiledMap* map );
+
+void CompileCubicMap(
+    CubicMap*       map,
+    const uint16_t* inputMap,
+    const uint16_t* outputMap );
+uint16_t MapCubicValue( uint16_t value, const CubicMap* map );
+
+void     ResetBinHint( BinHint* hint );
+uint16_t MapCompiledValueHinted(
+    uint16_t           value,
+    const CompiledMap* map,
+    BinHint*           hint );
+
+void MapValues(
+    const uint16_t* values,
+    uint16_t*       outputs,
+    size_t          count,
+    const uint16_t* inputMap,
+    const uint16_t* outputMap );
+bool MapValuesUsing(
+    BatchMapper     mapper,
+    const uint16_t* values,
+    uint16_t*       outputs,
+    size_t          count,
+    const uint16_t* inputMap,
+    const uint16_t* outputMap );
+
 #ifdef __cplusplus // Provide C++ Compatibility
 }
 #endif
@@ -0,0 +1,110 @@
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \file
+//! \brief  Pass tank input samples from the sampling interrupt to the core
+//!
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2019 David J. Fiddes
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <sampler.h>
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Add a sample to the ring from the producer
+//!
+//! The sample is written before the head moves on so the consumer never sees
+//! a slot that hasn't been filled. If the consumer has fallen so far behind
+//! that the ring is full the new sample is dropped and false returned.
+//!
+///////////////////////////////////////////////////////////////////////////////
+bool PushSample( SampleRing* ring, uint16_t sample )
+{
+    uint8_t head = ring->head;
+
+    if ( (uint8_t)( head - ring->tail ) >= SAMPLE_RING_SIZE )
+    {
+        return false;
+    }
+
+    ring->samples[ head & SAMPLE_RING_MASK ] = sample;
+    ring->head = head + 1;
+
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Take the oldest sample from the ring if there is one
+//!
+///////////////////////////////////////////////////////////////////////////////
+bool TakeSample( SampleRing* ring, uint16_t* sample )
+{
+    uint8_t tail = ring->tail;
+
+    if ( ring->head == tail )
+    {
+        return false;
+    }
+
+    *sample = ring->samples[ tail & SAMPLE_RING_MASK ];
+    ring->tail = tail + 1;
+
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Check whether the producer should take a sample on a tick
+//!
+//! Every tick is sampled unless the filters have backed the rate off while
+//! the tank input is steady.
+//!
+///////////////////////////////////////////////////////////////////////////////
+bool SampleDue( const SampleRing* ring, uint16_t tick )
+{
+    return ( (uint8_t)tick & ring->skip ) == 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Run every sample waiting in the ring through the tank input
+//!         filters
+//!
+//! The head is read once so samples pushed while the batch is filtered wait
+//! for the next drain, and the tail only moves on once the whole batch is
+//! done. The last filtered value is stored in tankInput, which is left alone
+//! if the ring was empty. The producer is then told how often the filters
+//! want sampling.
+//!
+//! \returns The number of samples filtered
+//!
+///////////////////////////////////////////////////////////////////////////////
+uint8_t DrainSamples( SampleRing* ring, TankFilter* filter, uint16_t* tankInput )
+{
+    uint8_t tail = ring->tail;
+    uint8_t count = ring->head - tail;
+
+    for ( uint8_t i = 0; i < count; i++ )
+    {
+        *tankInput = FilterTankInput(
+            filter, ring->samples[ (uint8_t)( tail + i ) & SAMPLE_RING_MASK ] );
+    }
+
+    ring->tail = tail + count;
+    ring->skip = ( 1 << TankFilterBackoff( filter ) ) - 1;
+
+    return count;
+}
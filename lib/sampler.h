@@ -0,0 +1,93 @@
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \file
+//! \brief  Pass tank input samples from the sampling interrupt to the core
+//!
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2019 David J. Fiddes
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#if defined( __XC )
+#include <xc.h> /* XC8 General Include File */
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "filter.h"
+
+//
+//! Number of bits in the size of the ring of samples waiting to be filtered.
+//! The core drains the ring every SAMPLE_DRAIN_TICKS so it must hold more
+//! than that many samples, with room to spare for a slow pass of the loop.
+//
+#ifndef SAMPLE_RING_BITS
+#define SAMPLE_RING_BITS 3
+#endif
+
+#if SAMPLE_RING_BITS < 1 || SAMPLE_RING_BITS > 7
+#error "SAMPLE_RING_BITS must be between 1 and 7"
+#endif
+
+#define SAMPLE_RING_SIZE ( 1 << SAMPLE_RING_BITS )
+#define SAMPLE_RING_MASK ( SAMPLE_RING_SIZE - 1 )
+
+//
+//! Ticks between the core draining the ring of samples
+//
+#ifndef SAMPLE_DRAIN_TICKS
+#define SAMPLE_DRAIN_TICKS 4
+#endif
+
+#if SAMPLE_DRAIN_TICKS < 1 || SAMPLE_DRAIN_TICKS >= SAMPLE_RING_SIZE
+#error "SAMPLE_DRAIN_TICKS must be at least 1 and less than the ring size"
+#endif
+
+//
+//! A ring of samples with a single producer, the sampling interrupt, and a
+//! single consumer, the main loop. Each side only writes its own count so
+//! no locking is needed as long as a byte is written in one go. The counts
+//! run freely and wrap around, so the ring holds head - tail samples. The
+//! consumer also tells the producer which ticks to sample on.
+//
+typedef struct
+{
+    volatile uint16_t samples[ SAMPLE_RING_SIZE ];
+    volatile uint8_t  head; //!< Samples pushed, only written by the producer
+    volatile uint8_t  tail; //!< Samples taken, only written by the consumer
+    volatile uint8_t  skip; //!< Ticks are sampled when these bits of the tick
+                            //!< are clear, only written by the consumer
+} SampleRing;
+
+#ifdef __cplusplus // Provide C++ Compatibility
+extern "C" {
+#endif
+
+bool    PushSample( SampleRing* ring, uint16_t sample );
+bool    TakeSample( SampleRing* ring, uint16_t* sample );
+bool    SampleDue( const SampleRing* ring, uint16_t tick );
+uint8_t DrainSamples(
+    SampleRing* ring,
+    TankFilter* filter,
+    uint16_t*   tankInput );
+
+#ifdef __cplusplus // Provide C++ Compatibility
+}
+#endif
+
+#endif // SAMPLER_H
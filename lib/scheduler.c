@@ -0,0 +1,118 @@
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \file
+//! \brief  Cooperative scheduler for running tasks at fixed periods
+//!
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2019 David J. Fiddes
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <hal.h>
+#include <scheduler.h>
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Make every task due straight away
+//!
+///////////////////////////////////////////////////////////////////////////////
+void StartTasks( uint16_t* due, uint8_t count )
+{
+    uint16_t now = HAL_GetTicks();
+
+    for ( uint8_t i = 0; i < count; i++ )
+    {
+        due[ i ] = now;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Run each task that is due once
+//!
+//! This is called on every pass of the main loop. Nothing waits so a task
+//! with nothing to do just returns and the next one gets its turn.
+//!
+//! Ticks wrap around so a task is due when the ticks have reached its due
+//! tick by less than half the range. A task that has fallen more than a whole
+//! period behind, say while a long command was printed, skips the runs it
+//! missed rather than running them back to back.
+//!
+///////////////////////////////////////////////////////////////////////////////
+void RunTasks( const Task* tasks, uint16_t* due, uint8_t count )
+{
+    for ( uint8_t i = 0; i < count; i++ )
+    {
+        uint16_t now = HAL_GetTicks();
+
+        if ( (int16_t)( now - due[ i ] ) < 0 )
+        {
+            continue;
+        }
+
+        uint16_t period = tasks[ i ].period;
+        if ( period != 0 )
+        {
+            due[ i ] += period;
+            if ( (int16_t)( now - due[ i ] ) >= 0 )
+            {
+                due[ i ] = now + period;
+            }
+        }
+
+        tasks[ i ].run();
+
+        //
+        // A task without a period that didn't set its next run itself runs
+        // again on the next pass
+        //
+        if ( period == 0 && (int16_t)( now - due[ i ] ) >= 0 )
+        {
+            due[ i ] = now;
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Run a task on the next pass whatever its period
+//!
+//! Its period carries on from then
+//!
+///////////////////////////////////////////////////////////////////////////////
+void WakeTask( uint16_t* due )
+{
+    *due = HAL_GetTicks();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Set when a task with no fixed period runs next
+//!
+//! This is called by the task itself for a period that can change while the
+//! gauge runs. The ticks are counted from when the task was due so it keeps
+//! to its period however late the pass that ran it was, unless it has fallen
+//! a whole period behind when it skips the runs it missed.
+//!
+///////////////////////////////////////////////////////////////////////////////
+void DelayTask( uint16_t* due, uint16_t ticks )
+{
+    uint16_t now = HAL_GetTicks();
+
+    *due += ticks;
+    if ( (int16_t)( now - *due ) >= 0 )
+    {
+        *due = now + ticks;
+    }
+}
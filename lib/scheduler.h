@@ -0,0 +1,56 @@
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \file
+//! \brief  Cooperative scheduler for running tasks at fixed periods
+//!
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2019 David J. Fiddes
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#if defined( __XC )
+#include <xc.h> /* XC8 General Include File */
+#endif
+
+#include <stdint.h>
+
+//
+//! A task run by the scheduler. Tables of these are constant so they can
+//! live in program memory and only the tick each task is next due at takes
+//! up RAM.
+//
+typedef struct
+{
+    void ( *run )( void ); //!< Does the task's work and returns promptly
+    uint16_t period;       //!< Ticks between runs or 0 for every pass or
+                           //!< for the task to call DelayTask()
+} Task;
+
+#ifdef __cplusplus // Provide C++ Compatibility
+extern "C" {
+#endif
+
+void StartTasks( uint16_t* due, uint8_t count );
+void RunTasks( const Task* tasks, uint16_t* due, uint8_t count );
+void WakeTask( uint16_t* due );
+void DelayTask( uint16_t* due, uint16_t ticks );
+
+#ifdef __cplusplus // Provide C++ Compatibility
+}
+#endif
+
+#endif // SCHEDULER_H
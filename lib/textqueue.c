@@ -0,0 +1,96 @@
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \file
+//! \brief  Queue characters between the serial port interrupts and the core
+//!
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2019 David J. Fiddes
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <textqueue.h>
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Add a character to the queue from the producer
+//!
+//! The character is written before the head moves on so the consumer never
+//! sees a slot that hasn't been filled. If the queue is full the character is
+//! dropped, counted as lost and false returned. A producer that can wait
+//! should check there is space first instead.
+//!
+///////////////////////////////////////////////////////////////////////////////
+bool PutCharacter( TextQueue* queue, char character )
+{
+    uint8_t head = queue->head;
+
+    if ( (uint8_t)( head - queue->tail ) > queue->mask )
+    {
+        LoseCharacter( queue );
+        return false;
+    }
+
+    queue->text[ head & queue->mask ] = character;
+    queue->head = head + 1;
+
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Take the oldest character from the queue if there is one
+//!
+///////////////////////////////////////////////////////////////////////////////
+bool GetCharacter( TextQueue* queue, char* character )
+{
+    uint8_t tail = queue->tail;
+
+    if ( queue->head == tail )
+    {
+        return false;
+    }
+
+    *character = queue->text[ tail & queue->mask ];
+    queue->tail = tail + 1;
+
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Return the number of characters the producer can add
+//!
+//! The consumer may make more space at any time but never less
+//!
+///////////////////////////////////////////////////////////////////////////////
+uint8_t TextQueueSpace( const TextQueue* queue )
+{
+    return queue->mask + 1 - (uint8_t)( queue->head - queue->tail );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Count a character the producer couldn't pass on
+//!
+//! This is also used for characters lost before they reached the queue, such
+//! as by a receive overrun. The count stops at 255 rather than wrapping.
+//!
+///////////////////////////////////////////////////////////////////////////////
+void LoseCharacter( TextQueue* queue )
+{
+    if ( queue->lost != 0xFF )
+    {
+        queue->lost++;
+    }
+}
@@ -0,0 +1,69 @@
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \file
+//! \brief  Queue characters between the serial port interrupts and the core
+//!
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2019 David J. Fiddes
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef TEXTQUEUE_H
+#define TEXTQUEUE_H
+
+#if defined( __XC )
+#include <xc.h> /* XC8 General Include File */
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+//
+//! A queue of characters with a single producer and a single consumer, one of
+//! which is an interrupt. Each side only writes its own count so no locking is
+//! needed as long as a byte is written in one go. The counts run freely and
+//! wrap around, so the queue holds head - tail characters.
+//!
+//! The buffer is supplied by whoever owns the queue so the transmit and
+//! receive queues can be different sizes. It must be a power of two no bigger
+//! than 128 characters.
+//
+typedef struct
+{
+    volatile char*   text; //!< Buffer holding the characters
+    uint8_t          mask; //!< One less than the size of the buffer
+    volatile uint8_t head; //!< Characters put, only written by the producer
+    volatile uint8_t tail; //!< Characters got, only written by the consumer
+    volatile uint8_t lost; //!< Characters that didn't fit, up to 255
+} TextQueue;
+
+//
+//! Initialiser for a queue using a buffer array
+//
+#define TEXT_QUEUE( buffer ) { ( buffer ), sizeof( buffer ) - 1, 0, 0, 0 }
+
+#ifdef __cplusplus // Provide C++ Compatibility
+extern "C" {
+#endif
+
+bool    PutCharacter( TextQueue* queue, char character );
+bool    GetCharacter( TextQueue* queue, char* character );
+uint8_t TextQueueSpace( const TextQueue* queue );
+void    LoseCharacter( TextQueue* queue );
+
+#ifdef __cplusplus // Provide C++ Compatibility
+}
+#endif
+
+#endif // TEXTQUEUE_H
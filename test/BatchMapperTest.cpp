@@ -0,0 +1,162 @@
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \file
+//! \brief  Unit test mapping batches of values
+//!
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2019 David J. Fiddes
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "gtest/gtest.h"
+#include <stdint.h>
+#include <vector>
+
+#include "mapper.h"
+
+const uint16_t LinearFullScale[ MAPSIZE ] = { 0x0000, 0x2000, 0x4000,
+                                              0x6000, 0x8000, 0xA000,
+                                              0xC000, 0xE000, 0xFFFF };
+
+const uint16_t LinearInverse[ MAPSIZE ] = { 0xFFFF, 0xE000, 0xC000,
+                                            0xA000, 0x8000, 0x6000,
+                                            0x4000, 0x2000, 0x0000 };
+
+const uint16_t ZeroMap[ MAPSIZE ] = { 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+                                      0x0000, 0x0000, 0x0000, 0x0000 };
+
+const uint16_t RealInputMap[ MAPSIZE ] = { 0xbb9f, 0xb6b9, 0xa2e1,
+                                           0x8f39, 0x7abc, 0x667b,
+                                           0x4d7e, 0x2cfc, 0x0bfb };
+
+const uint16_t RealOutputMap[ MAPSIZE ] = { 0x1900, 0x3a40, 0x5200,
+                                            0x6d80, 0x8640, 0x9f00,
+                                            0xb7c0, 0xd540, 0xf000 };
+
+const uint16_t FlatMap[ MAPSIZE ] = { 0x1000, 0x3000, 0x3000, 0x5000, 0x5000,
+                                      0x5000, 0x8000, 0xd000, 0xe000 };
+
+const uint16_t NonMonotonicMap[ MAPSIZE ] = { 0x1000, 0x3000, 0x2800,
+                                              0x5000, 0x5000, 0x9000,
+                                              0x8000, 0xd000, 0xe000 };
+
+const uint16_t SteepMap[ MAPSIZE ] = { 0x0000, 0x0001, 0x0002, 0x0003, 0x0004,
+                                       0x0005, 0x0006, 0x0007, 0xFFFF };
+
+//
+//! All of the maps that are checked in every combination
+//
+const uint16_t* const MapCorpus[] = { LinearFullScale, LinearInverse, ZeroMap,
+                                      RealInputMap,    RealOutputMap, FlatMap,
+                                      NonMonotonicMap, SteepMap };
+
+//
+//! All of the batch mapping implementations
+//
+const BatchMapper Mappers[] = { BATCH_MAPPER_SCALAR, BATCH_MAPPER_SSE2,
+                                BATCH_MAPPER_AVX2 };
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Every possible input plus a few more so there is a partial batch
+//!
+///////////////////////////////////////////////////////////////////////////////
+static std::vector< uint16_t > AllInputs()
+{
+    std::vector< uint16_t > inputs( 0x10000 + 13 );
+
+    for ( size_t i = 0; i < inputs.size(); i++ )
+    {
+        inputs[ i ] = i * 0x3C71;
+    }
+
+    return inputs;
+}
+
+// Check every implementation matches MapValue() for every input and map
+TEST( BatchMapper, MatchesMapValue )
+{
+    std::vector< uint16_t > inputs = AllInputs();
+    std::vector< uint16_t > outputs( inputs.size() );
+
+    for ( BatchMapper mapper : Mappers )
+    {
+        for ( const uint16_t* inputMap : MapCorpus )
+        {
+            for ( const uint16_t* outputMap : MapCorpus )
+            {
+                if ( !MapValuesUsing(
+                         mapper, inputs.data(), outputs.data(), inputs.size(),
+                         inputMap, outputMap ) )
+                {
+                    break;
+                }
+
+                for ( size_t i = 0; i < inputs.size(); i++ )
+                {
+                    uint16_t expected =
+                        MapValue( inputs[ i ], inputMap, outputMap );
+                    if ( outputs[ i ] != expected )
+                    {
+                        FAIL() << "Mapper " << mapper << " value 0x" << std::hex
+                               << inputs[ i ] << " maps starting 0x"
+                               << inputMap[ 0 ] << " and 0x" << outputMap[ 0 ]
+                               << ": expected 0x" << expected << " got 0x"
+                               << outputs[ i ];
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Check the default implementation and that short batches are handled
+TEST( BatchMapper, MapValues )
+{
+    std::vector< uint16_t > inputs = AllInputs();
+
+    for ( size_t count = 0; count < 40; count++ )
+    {
+        std::vector< uint16_t > outputs( count + 1, 0x5555 );
+
+        MapValues(
+            inputs.data(), outputs.data(), count, RealInputMap, RealOutputMap );
+
+        for ( size_t i = 0; i < count; i++ )
+        {
+            ASSERT_EQ(
+                outputs[ i ],
+                MapValue( inputs[ i ], RealInputMap, RealOutputMap ) );
+        }
+        ASSERT_EQ( outputs[ count ], 0x5555 );
+    }
+}
+
+// Check the implementations are available where they should be
+TEST( BatchMapper, Availability )
+{
+    uint16_t value = 0x1000;
+    uint16_t output = 0;
+
+    EXPECT_TRUE( MapValuesUsing(
+        BATCH_MAPPER_SCALAR, &value, &output, 1, LinearFullScale,
+        LinearInverse ) );
+    EXPECT_EQ( output, 0xf000 );
+
+#if defined( __SSE2__ )
+    EXPECT_TRUE( MapValuesUsing(
+        BATCH_MAPPER_SSE2, &value, &output, 1, LinearFullScale,
+        LinearInverse ) );
+#endif
+}
@@ -0,0 +1,164 @@
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \file
+//! \brief  Simulate powering up the gauge on the host
+//!
+//! The dummy HAL keeps a simulated clock using the times the real hardware
+//! takes to sample the tank input and send characters. This is used to
+//! measure how long the gauge takes to show the right level after power on.
+//!
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2019 David J. Fiddes
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "DummyHal.h"
+#include "gtest/gtest.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "command.h"
+#include "filter.h"
+#include "hal.h"
+
+//
+//! The banner the gauge sends at power on
+//
+static const char Banner[] =
+    "FuelGauge Version 0123456\r\n\r\nPress \"u\" for usage\r\n\r\n";
+
+//
+//! Tank input at power on with a tank that has just been filled
+//
+const uint16_t FullTank = 0xD000;
+
+//
+//! Simulated time taken by each pass of the main loop
+//
+const uint32_t LoopUs = 50;
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Put the dummy HAL into its power on state with a full tank and a
+//!         one to one mapping from tank input to gauge
+//!
+///////////////////////////////////////////////////////////////////////////////
+static void PowerOn( uint8_t filterSetting )
+{
+    for ( int i = 0; i < MAPSIZE; i++ )
+    {
+        g_inputMap[ i ] = LINEAR_BIN_VALUE( i );
+        g_outputMap[ i ] = LINEAR_BIN_VALUE( i );
+    }
+    g_filterSetting = filterSetting;
+    g_tankFilterSetting = filterSetting;
+    g_tank = FullTank;
+    g_gauge = 0;
+    g_timeUs = 0;
+    g_output.clear();
+    g_currentLine.clear();
+    g_simulateTankFilter = true;
+    ResetTankFilter();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Run the main loop until the gauge is within 1% of full scale of
+//!         the tank level and return the simulated time taken
+//!
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t RunUntilValid()
+{
+    while ( abs( g_gauge - FullTank ) > 0xFFFF / 100 && g_timeUs < 60000000 )
+    {
+        RunGaugeTasks();
+        g_timeUs += LoopUs;
+    }
+
+    return g_timeUs;
+}
+
+// Check the gauge shows the right level within a few milliseconds of power on
+// while the banner is still being sent
+TEST( Boot, TimeToFirstValidOutput )
+{
+    for ( uint8_t setting :
+          { FILTER_DEFAULT_K, FILTER_MEDIAN_FLAG | FILTER_DEFAULT_K,
+            FILTER_ADAPTIVE_FLAG | FILTER_DEFAULT_K, FILTER_MAX_K } )
+    {
+        PowerOn( setting );
+
+        InitialiseGauge();
+        HAL_QueueText( Banner );
+        StartGaugeTasks();
+        uint32_t validUs = RunUntilValid();
+
+        EXPECT_LE( validUs, 5000 ) << "Setting 0x" << std::hex << (int)setting;
+        RecordProperty(
+            "TimeToValidUs_" + std::to_string( setting ),
+            std::to_string( validUs ) );
+
+        //
+        // The banner carries on being sent from the main loop
+        //
+        EXPECT_NE( *g_queuedText, '\0' );
+        while ( *g_queuedText )
+        {
+            RunGaugeTasks();
+            g_timeUs += LoopUs;
+        }
+        EXPECT_EQ( g_currentLine, Banner );
+    }
+
+    g_simulateTankFilter = false;
+}
+
+// Check how long the gauge used to take when the banner was sent first and
+// the filter climbed from empty
+TEST( Boot, UnseededTimeToFirstValidOutput )
+{
+    PowerOn( FILTER_DEFAULT_K );
+
+    HAL_PrintText( Banner );
+    EXPECT_TRUE( ProcessCommand( "l" ) );
+    EXPECT_TRUE( ProcessCommand( "r" ) );
+    StartGaugeTasks();
+    uint32_t validUs = RunUntilValid();
+
+    EXPECT_GT( validUs, 1000000 );
+    RecordProperty( "TimeToValidUs", std::to_string( validUs ) );
+
+    g_simulateTankFilter = false;
+}
+
+// Check printing waits for queued text so nothing is sent out of order
+TEST( Boot, QueuedTextStaysInOrder )
+{
+    g_currentLine.clear();
+    g_timeUs = 0;
+
+    HAL_QueueText( "First " );
+    HAL_ServiceText();
+    HAL_PrintText( "Second " );
+    HAL_QueueText( "Third " );
+    HAL_QueueText( "Fourth" );
+    while ( *g_queuedText )
+    {
+        HAL_ServiceText();
+        g_timeUs += 100;
+    }
+
+    EXPECT_EQ( g_currentLine, "First Second Third Fourth" );
+    g_currentLine.clear();
+}
@@ -19,7 +19,9 @@
 //
 ///////////////////////////////////////////////////////////////////////////////
 
+#include "DummyHal.h"
 #include "command.h"
+#include "filter.h"
 #include "hal.h"
 #include "mapper.h"
 
@@ -29,121 +31,16 @@
 #include <string>
 #include <vector>
 
-//
-// Dummy HAL used for testing
-//
-
-//! Current tank input value
-uint16_t g_tank;
-
-///////////////////////////////////////////////////////////////////////////////
-//!
-//! \brief  Return the current tank input value
-//!
-///////////////////////////////////////////////////////////////////////////////
-uint16_t HAL_GetTankInput()
-{
-    return g_tank;
-}
-
-//! Current gauge output value
-uint16_t g_gauge;
-
-///////////////////////////////////////////////////////////////////////////////
-//!
-//! \brief  Return the last output value of the gauge
-//!
-///////////////////////////////////////////////////////////////////////////////
-uint16_t HAL_GetGaugeOutput()
-{
-    return g_gauge;
-}
-
-///////////////////////////////////////////////////////////////////////////////
-//!
-//! \brief  Store the value the gauge should be set to output
-//!
-///////////////////////////////////////////////////////////////////////////////
-void HAL_SetGaugeOutput( uint16_t value )
-{
-    g_gauge = value;
-}
-
-//! Low fuel warning light state
-bool g_lowFuelState;
-
-///////////////////////////////////////////////////////////////////////////////
-//!
-//! \brief  Set the state of the low fuel warning light
-//!
-///////////////////////////////////////////////////////////////////////////////
-void HAL_SetLowFuelLight( bool newState )
-{
-    g_lowFuelState = newState;
-}
-
-//! output buffer used to accumulate lines of character output
-std::vector< std::string > g_output;
-std::string                g_currentLine;
-
-///////////////////////////////////////////////////////////////////////////////
-//!
-//! \brief  Print to our current line
-//!
-///////////////////////////////////////////////////////////////////////////////
-void HAL_PrintText( const char* text )
-{
-    g_currentLine.append( text );
-}
-
-///////////////////////////////////////////////////////////////////////////////
-//!
-//! \brief  Print to our current line
-//!
-///////////////////////////////////////////////////////////////////////////////
-void HAL_PrintNewline()
-{
-    g_output.push_back( g_currentLine );
-    g_currentLine.clear();
-}
-
-//! A test tank input to linear actual tank value map
-uint16_t g_inputMap[ MAPSIZE ];
-
-//! A test linear actual tank value to gauge output value map
-uint16_t g_outputMap[ MAPSIZE ];
-
-//! Low fuel level setting (treated as part of the map)
-uint16_t g_lowFuelLevel;
-
-///////////////////////////////////////////////////////////////////////////////
-//!
-//! \brief  Load our test maps into the fuel gauge processor
-//!
-///////////////////////////////////////////////////////////////////////////////
-void HAL_LoadMaps( uint16_t* input, uint16_t* output, uint16_t* lowFuelLevel )
-{
-    memcpy( input, &g_inputMap, sizeof( g_inputMap ) );
-    memcpy( output, &g_outputMap, sizeof( g_outputMap ) );
-    *lowFuelLevel = g_lowFuelLevel;
-}
+const uint16_t ZeroMap[ MAPSIZE ] = { 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+                                      0x0000, 0x0000, 0x0000, 0x0000 };
 
-///////////////////////////////////////////////////////////////////////////////
-//!
-//! \brief  Save the supplied maps into our test maps for checking
-//!
-///////////////////////////////////////////////////////////////////////////////
-void HAL_SaveMaps(
-    const uint16_t* input,
-    const uint16_t* output,
-    uint16_t        lowFuelLevel )
-{
-    memcpy( &g_inputMap, input, sizeof( g_inputMap ) );
-    memcpy( &g_outputMap, output, sizeof( g_outputMap ) );
-    g_lowFuelLevel = lowFuelLevel;
-}
+const uint16_t LinearOneToOne[ MAPSIZE ] = { 0x0000, 0x2000, 0x4000,
+                                             0x6000, 0x8000, 0xA000,
+                                             0xC000, 0xE000, 0xFFFF };
 
-///////////////////////////////////////////////////////////////////////////////
+const uint16_t LinearInverse[ MAPSIZE ] = { 0xFFFF, 0xE000, 0xC000,
+                                            0xA000, 0x8000, 0x6000,
+                                            0x4000, 0x2000, 0x0000 };
 
 ///////////////////////////////////////////////////////////////////////////////
 //!
@@ -186,6 +83,9 @@ TEST( Command, RunProgramSwitching )
 TEST( Command, InputOutput )
 {
     // Set the external conditions
+    memcpy( &g_inputMap, LinearOneToOne, sizeof( g_inputMap ) );
+    memcpy( &g_outputMap, LinearInverse, sizeof( g_outputMap ) );
+    InitialiseGauge();
     g_output.clear();
     g_tank = 0x1234;
     g_gauge = 0x5678;
@@ -197,7 +97,8 @@ TEST( Command, InputOutput )
     ASSERT_TRUE( ProcessCommand( "d" ) );
     ASSERT_EQ( g_output.size(), 1 );
     EXPECT_STREQ(
-        g_output[ 0 ].c_str(), "Tank: 0x1234 Gauge: 0x5678 Mode: Run" );
+        g_output[ 0 ].c_str(),
+        "Tank: 0x1234 Gauge: 0x5678 Actual: 0xa988 Burn: 0x0000 Mode: Run" );
 
     // Attempt to set the gauge output (this will fail in Run mode)
     ASSERT_FALSE( ProcessCommand( "g 1234" ) );
@@ -213,7 +114,8 @@ TEST( Command, InputOutput )
     ASSERT_TRUE( ProcessCommand( "d" ) );
     ASSERT_EQ( g_output.size(), 1 );
     EXPECT_STREQ(
-        g_output[ 0 ].c_str(), "Tank: 0x1234 Gauge: 0x5678 Mode: Program" );
+        g_output[ 0 ].c_str(),
+        "Tank: 0x1234 Gauge: 0x5678 Actual: 0xa988 Burn: 0x0000 Mode: Program" );
 
     // Check that invalid gauge output commands fail
     ASSERT_FALSE( ProcessCommand( "g" ) );
@@ -229,17 +131,6 @@ TEST( Command, InputOutput )
     ASSERT_EQ( g_gauge, 0x1234 );
 }
 
-const uint16_t ZeroMap[ MAPSIZE ] = { 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
-                                      0x0000, 0x0000, 0x0000, 0x0000 };
-
-const uint16_t LinearOneToOne[ MAPSIZE ] = { 0x0000, 0x2000, 0x4000,
-                                             0x6000, 0x8000, 0xA000,
-                                             0xC000, 0xE000, 0xFFFF };
-
-const uint16_t LinearInverse[ MAPSIZE ] = { 0xFFFF, 0xE000, 0xC000,
-                                            0xA000, 0x8000, 0x6000,
-                                            0x4000, 0x2000, 0x0000 };
-
 ///////////////////////////////////////////////////////////////////////////////
 //!
 //! \brief  Test one shot value mapping - linear input / reverse output map
@@ -422,6 +313,9 @@ TEST( Command, MapDisplay )
     memcpy( &g_inputMap, LinearOneToOne, sizeof( g_inputMap ) );
     memcpy( &g_outputMap, LinearInverse, sizeof( g_outputMap ) );
     g_lowFuelLevel = 0x1234;
+    g_filterSetting = 5;
+    g_mappingTicks = 0x10;
+    g_outputTicks = 0x40;
 
     //
     // Load in our maps
@@ -437,7 +331,7 @@ TEST( Command, MapDisplay )
     //
     // Verify the output matches the two maps we loaded
     //
-    ASSERT_EQ( g_output.size(), 19 );
+    ASSERT_EQ( g_output.size(), 21 );
     EXPECT_STREQ( g_output[ 0 ].c_str(), "Input[0] : 0x0000 : 0x0000" );
     EXPECT_STREQ( g_output[ 1 ].c_str(), "Input[1] : 0x2000 : 0x2000" );
     EXPECT_STREQ( g_output[ 2 ].c_str(), "Input[2] : 0x4000 : 0x4000" );
@@ -458,6 +352,8 @@ TEST( Command, MapDisplay )
     EXPECT_STREQ( g_output[ 16 ].c_str(), "Output[7] : 0xe000 : 0x2000" );
     EXPECT_STREQ( g_output[ 17 ].c_str(), "Output[8] : 0xffff : 0x0000" );
     EXPECT_STREQ( g_output[ 18 ].c_str(), "Low Fuel Level : 0x1234" );
+    EXPECT_STREQ( g_output[ 19 ].c_str(), "Filter : 0x0005" );
+    EXPECT_STREQ( g_output[ 20 ].c_str(), "Rates : 0x0010 : 0x0040" );
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -722,6 +618,205 @@ TEST( Command, LowFuelLevelConfiguration )
     EXPECT_EQ( g_lowFuelLevel, 0x1234 );
 }
 
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Test tank input filter configuration
+//!
+///////////////////////////////////////////////////////////////////////////////
+TEST( Command, FilterConfiguration )
+{
+    memcpy( &g_inputMap, LinearOneToOne, sizeof( g_inputMap ) );
+    memcpy( &g_outputMap, LinearInverse, sizeof( g_outputMap ) );
+    g_filterSetting = 6;
+
+    //
+    // The saved filter strength is handed to the HAL on initialisation
+    //
+    g_tankFilterSetting = 0xFF;
+    InitialiseGauge();
+    ASSERT_TRUE( IsRunning() );
+    EXPECT_EQ( g_tankFilterSetting, 6 );
+
+    // Attempt to set the filter strength (this will fail in Run mode)
+    ASSERT_FALSE( ProcessCommand( "k 3" ) );
+    EXPECT_EQ( g_tankFilterSetting, 6 );
+
+    ASSERT_TRUE( ProcessCommand( "p" ) );
+
+    // Check that invalid filter commands fail
+    EXPECT_FALSE( ProcessCommand( "k" ) );
+    EXPECT_FALSE( ProcessCommand( "k qwio" ) );
+    EXPECT_FALSE( ProcessCommand( "k 100" ) );
+    EXPECT_EQ( g_tankFilterSetting, 6 );
+
+    // Check the new strength takes effect straight away but is only kept
+    // once saved
+    EXPECT_TRUE( ProcessCommand( "k 0" ) );
+    EXPECT_EQ( g_tankFilterSetting, 0 );
+    EXPECT_EQ( g_filterSetting, 6 );
+    EXPECT_TRUE( ProcessCommand( "k f" ) );
+    EXPECT_EQ( g_tankFilterSetting, 15 );
+    EXPECT_TRUE( ProcessCommand( "s" ) );
+    EXPECT_EQ( g_filterSetting, 15 );
+
+    // Check the median filter can be added to any strength
+    EXPECT_TRUE( ProcessCommand( "k 88" ) );
+    EXPECT_EQ( g_tankFilterSetting, FILTER_MEDIAN_FLAG | 8 );
+    EXPECT_TRUE( ProcessCommand( "k 80" ) );
+    EXPECT_EQ( g_tankFilterSetting, FILTER_MEDIAN_FLAG );
+    EXPECT_FALSE( ProcessCommand( "k 180" ) );
+    EXPECT_EQ( g_tankFilterSetting, FILTER_MEDIAN_FLAG );
+    EXPECT_TRUE( ProcessCommand( "k 8f" ) );
+
+    // Check the filter can be made adaptive with or without the median
+    EXPECT_TRUE( ProcessCommand( "k 48" ) );
+    EXPECT_EQ( g_tankFilterSetting, FILTER_ADAPTIVE_FLAG | 8 );
+    EXPECT_TRUE( ProcessCommand( "k ca" ) );
+    EXPECT_EQ(
+        g_tankFilterSetting, FILTER_MEDIAN_FLAG | FILTER_ADAPTIVE_FLAG | 10 );
+    EXPECT_FALSE( ProcessCommand( "k 140" ) );
+    EXPECT_TRUE( ProcessCommand( "k 8f" ) );
+
+    // Check backing off the sample rate can be added to the EMA but not the
+    // estimator
+    EXPECT_TRUE( ProcessCommand( "k 18" ) );
+    EXPECT_EQ( g_tankFilterSetting, FILTER_BACKOFF_FLAG | 8 );
+    EXPECT_TRUE( ProcessCommand( "k d8" ) );
+    EXPECT_EQ(
+        g_tankFilterSetting,
+        FILTER_MEDIAN_FLAG | FILTER_ADAPTIVE_FLAG | FILTER_BACKOFF_FLAG | 8 );
+    EXPECT_FALSE( ProcessCommand( "k 38" ) );
+    EXPECT_TRUE( ProcessCommand( "k 8f" ) );
+
+    // Check the estimator can replace the EMA but can't adapt or be weak
+    EXPECT_TRUE( ProcessCommand( "k 2c" ) );
+    EXPECT_EQ( g_tankFilterSetting, FILTER_ESTIMATOR_FLAG | 12 );
+    EXPECT_TRUE( ProcessCommand( "k a6" ) );
+    EXPECT_EQ(
+        g_tankFilterSetting, FILTER_MEDIAN_FLAG | FILTER_ESTIMATOR_FLAG | 6 );
+    EXPECT_FALSE( ProcessCommand( "k 25" ) );
+    EXPECT_FALSE( ProcessCommand( "k 20" ) );
+    EXPECT_FALSE( ProcessCommand( "k 6c" ) );
+    EXPECT_EQ(
+        g_tankFilterSetting, FILTER_MEDIAN_FLAG | FILTER_ESTIMATOR_FLAG | 6 );
+    EXPECT_TRUE( ProcessCommand( "k 8f" ) );
+
+    // Reloading restores the saved strength
+    EXPECT_TRUE( ProcessCommand( "k 2" ) );
+    EXPECT_TRUE( ProcessCommand( "l" ) );
+    EXPECT_EQ( g_tankFilterSetting, 15 );
+
+    //
+    // Erased or corrupt settings fall back to the default strength
+    //
+    g_filterSetting = 0xFF;
+    EXPECT_TRUE( ProcessCommand( "l" ) );
+    EXPECT_EQ( g_tankFilterSetting, FILTER_DEFAULT_K );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Test mapping and output rate configuration
+//!
+///////////////////////////////////////////////////////////////////////////////
+TEST( Command, RateConfiguration )
+{
+    memcpy( &g_inputMap, LinearOneToOne, sizeof( g_inputMap ) );
+    memcpy( &g_outputMap, LinearInverse, sizeof( g_outputMap ) );
+    g_mappingTicks = 0;
+    g_outputTicks = 0xFF;
+    InitialiseGauge();
+
+    //
+    // Erased or corrupt rates fall back to the defaults
+    //
+    g_output.clear();
+    ASSERT_TRUE( ProcessCommand( "m" ) );
+    EXPECT_EQ( g_output.back(), "Rates : 0x0014 : 0x00c8" );
+
+    // Attempt to set the rates (this will fail in Run mode)
+    ASSERT_FALSE( ProcessCommand( "e 5 32" ) );
+
+    ASSERT_TRUE( ProcessCommand( "p" ) );
+
+    // Check that invalid rate commands fail
+    EXPECT_FALSE( ProcessCommand( "e" ) );
+    EXPECT_FALSE( ProcessCommand( "e 5" ) );
+    EXPECT_FALSE( ProcessCommand( "e 5 qwio" ) );
+    EXPECT_FALSE( ProcessCommand( "e 0 32" ) );
+    EXPECT_FALSE( ProcessCommand( "e 5 ff" ) );
+    EXPECT_FALSE( ProcessCommand( "e 105 32" ) );
+
+    // Check nothing is read beyond the end of the command
+    EXPECT_FALSE( ProcessCommand( "e 5\0 32" ) );
+
+    // Check the new rates are only kept once saved
+    EXPECT_TRUE( ProcessCommand( "e 5 32" ) );
+    EXPECT_EQ( g_mappingTicks, 0 );
+    EXPECT_TRUE( ProcessCommand( "s" ) );
+    EXPECT_EQ( g_mappingTicks, 5 );
+    EXPECT_EQ( g_outputTicks, 0x32 );
+
+    // Reloading restores the saved rates
+    EXPECT_TRUE( ProcessCommand( "e 1 fe" ) );
+    g_output.clear();
+    ASSERT_TRUE( ProcessCommand( "m" ) );
+    EXPECT_EQ( g_output.back(), "Rates : 0x0001 : 0x00fe" );
+    EXPECT_TRUE( ProcessCommand( "l" ) );
+    g_output.clear();
+    ASSERT_TRUE( ProcessCommand( "m" ) );
+    EXPECT_EQ( g_output.back(), "Rates : 0x0005 : 0x0032" );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Test the fuel burn is worked out from the tank input rate
+//!
+///////////////////////////////////////////////////////////////////////////////
+TEST( Command, FuelBurnDisplay )
+{
+    memcpy( &g_inputMap, LinearOneToOne, sizeof( g_inputMap ) );
+    memcpy( &g_outputMap, LinearInverse, sizeof( g_outputMap ) );
+    InitialiseGauge();
+    g_tank = 0x8000;
+    g_gauge = 0x8000;
+
+    // A falling tank input is fuel being used
+    g_tankRate = -0x1000;
+    g_output.clear();
+    ASSERT_TRUE( ProcessCommand( "d" ) );
+    ASSERT_EQ( g_output.size(), 1 );
+    EXPECT_EQ(
+        g_output[ 0 ],
+        "Tank: 0x8000 Gauge: 0x8000 Actual: 0x8000 Burn: 0x1000 Mode: Run" );
+
+    // The projection stops at an empty tank
+    g_tankRate = -0x100000;
+    g_output.clear();
+    ASSERT_TRUE( ProcessCommand( "d" ) );
+    EXPECT_EQ(
+        g_output[ 0 ],
+        "Tank: 0x8000 Gauge: 0x8000 Actual: 0x8000 Burn: 0x8000 Mode: Run" );
+
+    // Refuelling and a disconnected sender don't show a burn
+    g_tankRate = 0x1000;
+    g_output.clear();
+    ASSERT_TRUE( ProcessCommand( "d" ) );
+    EXPECT_EQ(
+        g_output[ 0 ],
+        "Tank: 0x8000 Gauge: 0x8000 Actual: 0x8000 Burn: 0x0000 Mode: Run" );
+
+    g_tank = TANK_INPUT_ERROR;
+    g_tankRate = -0x1000;
+    g_output.clear();
+    ASSERT_TRUE( ProcessCommand( "d" ) );
+    EXPECT_EQ(
+        g_output[ 0 ],
+        "Tank: 0xffff Gauge: 0x8000 Actual: 0x8000 Burn: 0x0000 Mode: Run" );
+
+    g_tankRate = 0;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 //!
 //! \brief  Test streaming of mapping values when the gauge is running
@@ -845,4 +940,415 @@ TEST( Command, TankInputValidation )
     ASSERT_EQ( g_output.size(), 1 );
     EXPECT_STREQ(
         g_output[ 0 ].c_str(), "Tank: 0x1234 Actual: 0x1234 Gauge: 0xedcc" );
-}
\ No newline at end of file
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Let a tick pass for the tank input to be sampled, then filter and
+//!         map it as the gauge's tasks would
+//!
+///////////////////////////////////////////////////////////////////////////////
+static bool SampleAndRunGauge()
+{
+    g_timeUs += TICK_US;
+    HAL_DrainTankSamples();
+    return RunGauge();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Test a faulty sender is reported within a few samples through the
+//!         same filters the real gauge uses and the gauge doesn't move
+//!
+///////////////////////////////////////////////////////////////////////////////
+TEST( Command, SenderFaultDetection )
+{
+    memcpy( &g_inputMap, LinearOneToOne, sizeof( g_inputMap ) );
+    memcpy( &g_outputMap, LinearOneToOne, sizeof( g_outputMap ) );
+    g_filterSetting = FILTER_DEFAULT_K;
+    g_simulateTankFilter = true;
+    ResetTankFilter();
+
+    for ( uint16_t faulty : { 0xffc0, 0x0000 } )
+    {
+        g_tank = 0x8000;
+        InitialiseGauge();
+        EXPECT_TRUE( SampleAndRunGauge() );
+        EXPECT_EQ( g_gauge, 0x8000 );
+
+        //
+        // Count the samples until the fault is reported
+        //
+        g_tank = faulty;
+        int samples = 1;
+        while ( SampleAndRunGauge() && samples < 1000 )
+        {
+            samples++;
+        }
+        EXPECT_EQ( samples, SENDER_FAULT_SAMPLES );
+        EXPECT_EQ( g_gauge, 0x8000 );
+
+        //
+        // The gauge carries on from the sender's new value once it is back
+        //
+        g_tank = 0x4000;
+        samples = 1;
+        while ( !SampleAndRunGauge() && samples < 1000 )
+        {
+            samples++;
+        }
+        EXPECT_EQ( samples, SENDER_RECOVERY_SAMPLES );
+        EXPECT_EQ( g_gauge, 0x4000 );
+    }
+
+    g_simulateTankFilter = false;
+}
+
+const uint16_t RealInputMap[ MAPSIZE ] = { 0xbb9f, 0xb6b9, 0xa2e1,
+                                           0x8f39, 0x7abc, 0x667b,
+                                           0x4d7e, 0x2cfc, 0x0bfb };
+
+const uint16_t RealOutputMap[ MAPSIZE ] = { 0x1900, 0x3a40, 0x5200,
+                                            0x6d80, 0x8640, 0x9f00,
+                                            0xb7c0, 0xd540, 0xf000 };
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Test the low fuel light matches the actual fuel level for every
+//!         tank input value
+//!
+///////////////////////////////////////////////////////////////////////////////
+TEST( Command, LowFuelThreshold )
+{
+    const uint16_t* inputMaps[] = { LinearOneToOne,
+                                    LinearInverse,
+                                    RealInputMap };
+    const uint16_t  lowFuelLevels[] = { 0x0000, 0x1000, 0x1fff,
+                                       0x2000, 0x6543, 0xffff };
+
+    g_output.clear();
+
+    for ( const uint16_t* inputMap : inputMaps )
+    {
+        for ( uint16_t lowFuelLevel : lowFuelLevels )
+        {
+            memcpy( &g_inputMap, inputMap, sizeof( g_inputMap ) );
+            memcpy( &g_outputMap, LinearInverse, sizeof( g_outputMap ) );
+            g_lowFuelLevel = lowFuelLevel;
+            InitialiseGauge();
+
+            for ( uint32_t tank = 0; tank < TANK_INPUT_ERROR; tank++ )
+            {
+                g_tank = tank;
+                ASSERT_TRUE( RunGauge() );
+
+                bool expected =
+                    MapValue( tank, inputMap, LinearOneToOne ) <= lowFuelLevel;
+                ASSERT_EQ( g_lowFuelState, expected )
+                    << "Tank 0x" << std::hex << tank << " low fuel level 0x"
+                    << lowFuelLevel;
+            }
+        }
+    }
+
+    ASSERT_TRUE( g_output.empty() );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Test the lookup table is saved with the maps and only used while
+//!         it matches them
+//!
+///////////////////////////////////////////////////////////////////////////////
+TEST( Command, LookupTable )
+{
+    //
+    // Start with blank flash and some maps where the table is noticeably
+    // coarser than the composite map
+    //
+    EraseFlash();
+    memcpy( &g_inputMap, RealInputMap, sizeof( g_inputMap ) );
+    memcpy( &g_outputMap, LinearInverse, sizeof( g_outputMap ) );
+    InitialiseGauge();
+
+    CompiledMap compositeMap;
+    CompileMap( &compositeMap, RealInputMap, LinearInverse );
+
+    const uint16_t tank = 0xb6f0;
+    g_tank = tank;
+
+    //
+    // Without a table we map with the composite map
+    //
+    EXPECT_TRUE( RunGauge() );
+    EXPECT_EQ( g_gauge, MapCompiledValue( tank, &compositeMap ) );
+    EXPECT_EQ( g_flashWrites, 0 );
+
+    //
+    // Saving writes the table which is then used
+    //
+    EXPECT_TRUE( ProcessCommand( "s" ) );
+    EXPECT_EQ( g_flashWrites, LOOKUP_STORAGE_SIZE );
+    EXPECT_TRUE( RunGauge() );
+    EXPECT_EQ( g_gauge, LookupValue( tank ) );
+    EXPECT_NE( g_gauge, MapCompiledValue( tank, &compositeMap ) );
+
+    //
+    // Saving the same maps again leaves the flash alone
+    //
+    EXPECT_TRUE( ProcessCommand( "s" ) );
+    EXPECT_EQ( g_flashWrites, LOOKUP_STORAGE_SIZE );
+
+    //
+    // Changing a map stops the table being used until the maps are saved,
+    // even if the change is undone
+    //
+    EXPECT_TRUE( ProcessCommand( "i 0 bb00" ) );
+    EXPECT_TRUE( RunGauge() );
+    EXPECT_NE( g_gauge, LookupValue( tank ) );
+
+    EXPECT_TRUE( ProcessCommand( "i 0 bb9f" ) );
+    EXPECT_TRUE( RunGauge() );
+    EXPECT_EQ( g_gauge, MapCompiledValue( tank, &compositeMap ) );
+
+    //
+    // Saving the undone change finds the table still matches
+    //
+    EXPECT_TRUE( ProcessCommand( "s" ) );
+    EXPECT_EQ( g_flashWrites, LOOKUP_STORAGE_SIZE );
+    EXPECT_TRUE( RunGauge() );
+    EXPECT_EQ( g_gauge, LookupValue( tank ) );
+
+    //
+    // The table is picked up again after a restart
+    //
+    InitialiseGauge();
+    EXPECT_TRUE( RunGauge() );
+    EXPECT_EQ( g_gauge, LookupValue( tank ) );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Test a map edit that barely changes the maps still rebuilds the
+//!         lookup table
+//!
+//! Moving the top output bin this far once left a checksum of the maps
+//! unchanged so the old table was kept.
+//!
+///////////////////////////////////////////////////////////////////////////////
+TEST( Command, LookupTableSmallEdit )
+{
+    EraseFlash();
+    memcpy( &g_inputMap, RealInputMap, sizeof( g_inputMap ) );
+    memcpy( &g_outputMap, RealOutputMap, sizeof( g_outputMap ) );
+    InitialiseGauge();
+    EXPECT_TRUE( ProcessCommand( "s" ) );
+    EXPECT_EQ( g_flashWrites, LOOKUP_STORAGE_SIZE );
+
+    const uint16_t tank = 0x2cfc;
+    g_tank = tank;
+
+    EXPECT_TRUE( RunGauge() );
+    EXPECT_EQ( g_gauge, LookupValue( tank ) );
+    EXPECT_EQ( g_gauge, 0xd540 );
+
+    //
+    // The edit is used straight away and the save writes a new table
+    //
+    uint16_t editedMap[ MAPSIZE ];
+    memcpy( editedMap, RealOutputMap, sizeof( editedMap ) );
+    editedMap[ 7 ] = 0x3540;
+
+    CompiledMap compositeMap;
+    CompileMap( &compositeMap, RealInputMap, editedMap );
+
+    EXPECT_TRUE( ProcessCommand( "o 7 3540" ) );
+    EXPECT_TRUE( RunGauge() );
+    EXPECT_EQ( g_gauge, MapCompiledValue( tank, &compositeMap ) );
+    EXPECT_EQ( g_gauge, 0x3540 );
+
+    EXPECT_TRUE( ProcessCommand( "s" ) );
+    EXPECT_EQ( g_flashWrites, 2 * LOOKUP_STORAGE_SIZE );
+    EXPECT_TRUE( RunGauge() );
+    EXPECT_EQ( g_gauge, LookupValue( tank ) );
+    EXPECT_NEAR( g_gauge, 0x3540, 0x80 );
+
+    //
+    // A restart still uses the new table
+    //
+    InitialiseGauge();
+    EXPECT_TRUE( RunGauge() );
+    EXPECT_EQ( g_gauge, LookupValue( tank ) );
+    EXPECT_NEAR( g_gauge, 0x3540, 0x80 );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Test the mapping is skipped while the tank input doesn't change
+//!
+///////////////////////////////////////////////////////////////////////////////
+TEST( Command, UnchangedInput )
+{
+    EraseFlash();
+    memcpy( &g_inputMap, LinearInverse, sizeof( g_inputMap ) );
+    memcpy( &g_outputMap, LinearOneToOne, sizeof( g_outputMap ) );
+    InitialiseGauge();
+
+    //
+    // Only the first of several identical samples touches the gauge
+    //
+    g_tank = 0x1234;
+    g_gaugeWrites = 0;
+    for ( int i = 0; i < 4; i++ )
+    {
+        EXPECT_TRUE( RunGauge() );
+    }
+    EXPECT_EQ( g_gauge, 0xedcb );
+    EXPECT_EQ( g_gaugeWrites, 1 );
+
+    g_tank = 0x3000;
+    EXPECT_TRUE( RunGauge() );
+    EXPECT_EQ( g_gauge, 0xd000 );
+    EXPECT_EQ( g_gaugeWrites, 2 );
+
+    //
+    // A map edit must be picked up even though the input is the same
+    //
+    EXPECT_TRUE( ProcessCommand( "o 7 f000" ) );
+    EXPECT_TRUE( RunGauge() );
+    EXPECT_EQ( g_gauge, 0xd800 );
+    EXPECT_EQ( g_gaugeWrites, 3 );
+
+    //
+    // As must a raw gauge output set in program mode
+    //
+    EXPECT_TRUE( ProcessCommand( "p" ) );
+    EXPECT_TRUE( ProcessCommand( "g 1000" ) );
+    EXPECT_TRUE( ProcessCommand( "r" ) );
+    EXPECT_TRUE( RunGauge() );
+    EXPECT_EQ( g_gauge, 0xd800 );
+    EXPECT_EQ( g_gaugeWrites, 5 );
+
+    //
+    // Logging still reports every sample
+    //
+    g_output.clear();
+    EXPECT_TRUE( ProcessCommand( "c" ) );
+    EXPECT_TRUE( RunGauge() );
+    EXPECT_TRUE( RunGauge() );
+    EXPECT_EQ( g_gaugeWrites, 6 );
+    ASSERT_EQ( g_output.size(), 2 );
+    EXPECT_EQ( g_output[ 0 ], g_output[ 1 ] );
+
+    //
+    // Check the statistics add up
+    //
+    g_output.clear();
+    EXPECT_TRUE( ProcessCommand( "x" ) );
+    ASSERT_EQ( g_output.size(), 1 );
+    EXPECT_EQ(
+        g_output[ 0 ],
+        "Samples: 0x0009 Unchanged: 0x0004 Bin Hits: 0x0003/0x0004 Lost: "
+        "0x0000" );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Test an input map that turns back on itself is flagged and mapped
+//!         consistently whether or not we are logging
+//!
+///////////////////////////////////////////////////////////////////////////////
+TEST( Command, NonMonotonicInputMap )
+{
+    const uint16_t nonMonotonicMap[ MAPSIZE ] = { 0x1000, 0x3000, 0x2800,
+                                                  0x5000, 0x5000, 0x9000,
+                                                  0x8000, 0xd000, 0xe000 };
+
+    EraseFlash();
+    memcpy( &g_inputMap, nonMonotonicMap, sizeof( g_inputMap ) );
+    memcpy( &g_outputMap, LinearInverse, sizeof( g_outputMap ) );
+    g_lowFuelLevel = 0x4000;
+    InitialiseGauge();
+
+    //
+    // Only the segments that overlap another are flagged
+    //
+    g_output.clear();
+    ASSERT_TRUE( ProcessCommand( "m" ) );
+    ASSERT_EQ( g_output.size(), 21 );
+    EXPECT_EQ( g_output[ 0 ], "Input[0] : 0x1000 : 0x0000 Ambiguous" );
+    EXPECT_EQ( g_output[ 2 ], "Input[2] : 0x2800 : 0x4000 Ambiguous" );
+    EXPECT_EQ( g_output[ 3 ], "Input[3] : 0x5000 : 0x6000" );
+    EXPECT_EQ( g_output[ 6 ], "Input[6] : 0x8000 : 0xc000 Ambiguous" );
+    EXPECT_EQ( g_output[ 7 ], "Input[7] : 0xd000 : 0xe000" );
+    EXPECT_EQ( g_output[ 8 ], "Input[8] : 0xe000 : 0xffff" );
+
+    //
+    // Overlapping segments read towards empty
+    //
+    g_tank = 0x2c00;
+    g_output.clear();
+    ASSERT_TRUE( ProcessCommand( "t" ) );
+    ASSERT_EQ( g_output.size(), 1 );
+    EXPECT_EQ( g_output[ 0 ], "Tank: 0x2c00 Actual: 0x1c00 Gauge: 0xe400" );
+
+    //
+    // The run loop agrees with the logged mapping for every tank input
+    //
+    for ( uint32_t tank = 0; tank < TANK_INPUT_ERROR; tank += 0x10 )
+    {
+        g_tank = tank;
+
+        ASSERT_TRUE( ProcessCommand( "t" ) );
+        uint16_t loggedGauge = g_gauge;
+        bool     loggedLowFuel = g_lowFuelState;
+
+        ASSERT_TRUE( RunGauge() );
+        ASSERT_LE( abs( g_gauge - loggedGauge ), 2 )
+            << "Tank 0x" << std::hex << tank;
+        ASSERT_EQ( g_lowFuelState, loggedLowFuel )
+            << "Tank 0x" << std::hex << tank;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Test gauge outputs are turned back into the actual values that
+//!         give them and follow changes to the output map
+//!
+///////////////////////////////////////////////////////////////////////////////
+TEST( Command, GaugeOutputToActual )
+{
+    const uint16_t realOutputMap[ MAPSIZE ] = { 0x1900, 0x3a40, 0x5200,
+                                                0x6d80, 0x8640, 0x9f00,
+                                                0xb7c0, 0xd540, 0xf000 };
+
+    memcpy( &g_inputMap, LinearOneToOne, sizeof( g_inputMap ) );
+    memcpy( &g_outputMap, realOutputMap, sizeof( g_outputMap ) );
+    InitialiseGauge();
+
+    //
+    // Each gauge step is less than two actual steps so the round trip can
+    // only be out by rounding
+    //
+    for ( uint32_t actual = 0; actual <= 0xFFFF; actual++ )
+    {
+        uint16_t output = MapLinearValue( actual, realOutputMap );
+        ASSERT_LE( abs( (int)GaugeOutputToActual( output ) - (int)actual ), 2 )
+            << "Actual 0x" << std::hex << actual;
+    }
+
+    //
+    // Outputs beyond the ends of the map are clamped
+    //
+    EXPECT_EQ( GaugeOutputToActual( 0x0000 ), 0x0000 );
+    EXPECT_EQ( GaugeOutputToActual( 0xffff ), 0xffff );
+
+    //
+    // The inverse follows edits to the output map
+    //
+    EXPECT_EQ( GaugeOutputToActual( 0x8640 ), 0x8000 );
+    EXPECT_TRUE( ProcessCommand( "o 4 8000" ) );
+    EXPECT_EQ( GaugeOutputToActual( 0x8000 ), 0x8000 );
+    EXPECT_EQ( GaugeOutputToActual( 0x8640 ), 0x8673 );
+}
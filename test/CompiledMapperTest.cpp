@@ -0,0 +1,291 @@
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \file
+//! \brief  Unit test mapping with compiled maps
+//!
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2019 David J. Fiddes
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "gtest/gtest.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mapper.h"
+
+const uint16_t LinearFullScale[ MAPSIZE ] = { 0x0000, 0x2000, 0x4000,
+                                              0x6000, 0x8000, 0xA000,
+                                              0xC000, 0xE000, 0xFFFF };
+
+const uint16_t LinearInverse[ MAPSIZE ] = { 0xFFFF, 0xE000, 0xC000,
+                                            0xA000, 0x8000, 0x6000,
+                                            0x4000, 0x2000, 0x0000 };
+
+const uint16_t LinearHalf[ MAPSIZE ] = { 0x0000, 0x1000, 0x2000, 0x3000, 0x4000,
+                                         0x5000, 0x6000, 0x7000, 0x8000 };
+
+const uint16_t RealInputMap[ MAPSIZE ] = { 0xbb9f, 0xb6b9, 0xa2e1,
+                                           0x8f39, 0x7abc, 0x667b,
+                                           0x4d7e, 0x2cfc, 0x0bfb };
+
+const uint16_t RealOutputMap[ MAPSIZE ] = { 0x1900, 0x3a40, 0x5200,
+                                            0x6d80, 0x8640, 0x9f00,
+                                            0xb7c0, 0xd540, 0xf000 };
+
+const uint16_t SteepMap[ MAPSIZE ] = { 0x0000, 0x0010, 0x0100, 0x1000, 0x4000,
+                                       0x8000, 0xC000, 0xF000, 0xFFFF };
+
+//
+//! All of the maps that are checked exhaustively
+//
+const uint16_t* const MapCorpus[] = { LinearFullScale, LinearInverse,
+                                      LinearHalf,      RealInputMap,
+                                      RealOutputMap,   SteepMap };
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Find the largest difference between MapValue() and a compiled map
+//!
+///////////////////////////////////////////////////////////////////////////////
+static int MaxCompiledError( const uint16_t* inputMap, const uint16_t* outputMap )
+{
+    CompiledMap map;
+    CompileMap( &map, inputMap, outputMap );
+
+    int maxError = 0;
+    for ( uint32_t value = 0; value <= 0xFFFF; value++ )
+    {
+        int error = abs(
+            MapCompiledValue( value, &map ) -
+            MapValue( value, inputMap, outputMap ) );
+        if ( error > maxError )
+        {
+            maxError = error;
+        }
+    }
+
+    return maxError;
+}
+
+// Check that maps with power of two bin widths are mapped exactly
+TEST( CompiledMapper, ExactForLinearMaps )
+{
+    EXPECT_EQ( MaxCompiledError( LinearFullScale, LinearFullScale ), 0 );
+    EXPECT_EQ( MaxCompiledError( LinearFullScale, LinearHalf ), 0 );
+    EXPECT_EQ( MaxCompiledError( LinearHalf, LinearFullScale ), 0 );
+    EXPECT_EQ( MaxCompiledError( LinearInverse, LinearFullScale ), 0 );
+    EXPECT_EQ( MaxCompiledError( LinearFullScale, LinearInverse ), 0 );
+}
+
+// Check that the compiled input stage stays close to MapValue()
+TEST( CompiledMapper, InputStageAccuracy )
+{
+    for ( const uint16_t* map : MapCorpus )
+    {
+        EXPECT_LE( MaxCompiledError( map, LinearFullScale ), 2 )
+            << "Map starting 0x" << std::hex << map[ 0 ];
+    }
+}
+
+// Check that the compiled output stage stays close to MapValue()
+TEST( CompiledMapper, OutputStageAccuracy )
+{
+    for ( const uint16_t* map : MapCorpus )
+    {
+        EXPECT_LE( MaxCompiledError( LinearFullScale, map ), 2 )
+            << "Map starting 0x" << std::hex << map[ 0 ];
+    }
+}
+
+// Check the clamping at either end of a map
+TEST( CompiledMapper, Clamping )
+{
+    CompiledMap map;
+    CompileMap( &map, RealInputMap, LinearFullScale );
+
+    EXPECT_EQ( MapCompiledValue( 0xffff, &map ), 0x0000 );
+    EXPECT_EQ( MapCompiledValue( 0xbb9f, &map ), 0x0000 );
+    EXPECT_EQ( MapCompiledValue( 0x0bfb, &map ), 0xffff );
+    EXPECT_EQ( MapCompiledValue( 0x0000, &map ), 0xffff );
+}
+
+// Check that a compiled map follows changes made to the maps it references
+// once it is recompiled
+TEST( CompiledMapper, Recompile )
+{
+    uint16_t inputMap[ MAPSIZE ];
+    memcpy( inputMap, LinearFullScale, sizeof( inputMap ) );
+
+    CompiledMap map;
+    CompileMap( &map, inputMap, LinearFullScale );
+    EXPECT_EQ( MapCompiledValue( 0x1000, &map ), 0x1000 );
+
+    inputMap[ 1 ] = 0x4000;
+    inputMap[ 2 ] = 0x6000;
+    CompileMap( &map, inputMap, LinearFullScale );
+    EXPECT_EQ( MapCompiledValue( 0x1000, &map ), 0x0800 );
+    EXPECT_EQ( MapCompiledValue( 0x5000, &map ), 0x3000 );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Find the largest difference between mapping through two stages
+//!         via LinearFullScale and a single compiled composite map
+//!
+///////////////////////////////////////////////////////////////////////////////
+static int MaxCompositeError(
+    const uint16_t* inputMap,
+    const uint16_t* outputMap )
+{
+    CompiledMap map;
+    CompileMap( &map, inputMap, outputMap );
+
+    int maxError = 0;
+    for ( uint32_t value = 0; value <= 0xFFFF; value++ )
+    {
+        uint16_t actual = MapValue( value, inputMap, LinearFullScale );
+        int      error = abs(
+            MapCompiledValue( value, &map ) -
+            MapValue( actual, LinearFullScale, outputMap ) );
+        if ( error > maxError )
+        {
+            maxError = error;
+        }
+    }
+
+    return maxError;
+}
+
+// Check that a composite of the input and output maps stays close to mapping
+// through both stages
+TEST( CompiledMapper, CompositeAccuracy )
+{
+    for ( const uint16_t* inputMap : MapCorpus )
+    {
+        for ( const uint16_t* outputMap : MapCorpus )
+        {
+            EXPECT_LE( MaxCompositeError( inputMap, outputMap ), 2 )
+                << "Maps starting 0x" << std::hex << inputMap[ 0 ] << " and 0x"
+                << outputMap[ 0 ];
+        }
+    }
+}
+
+const uint16_t NonMonotonicMap[ MAPSIZE ] = { 0x1000, 0x3000, 0x2800,
+                                              0x5000, 0x5000, 0x9000,
+                                              0x8000, 0xd000, 0xe000 };
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Check hinted mapping matches unhinted mapping for a sequence of
+//!         values
+//!
+///////////////////////////////////////////////////////////////////////////////
+static void CheckHintedSequence(
+    const uint16_t* inputMap,
+    const uint16_t* outputMap,
+    uint32_t        start,
+    int32_t         step )
+{
+    CompiledMap map;
+    CompileMap( &map, inputMap, outputMap );
+
+    BinHint hint;
+    ResetBinHint( &hint );
+
+    uint16_t value = start;
+    for ( uint32_t i = 0; i <= 0xFFFF; i++ )
+    {
+        uint16_t expected = MapCompiledValue( value, &map );
+        uint16_t actual = MapCompiledValueHinted( value, &map, &hint );
+        if ( actual != expected )
+        {
+            FAIL() << "Mismatch for value 0x" << std::hex << value
+                   << " maps starting 0x" << inputMap[ 0 ] << " and 0x"
+                   << outputMap[ 0 ] << ": expected 0x" << expected
+                   << " got 0x" << actual;
+        }
+
+        value += step;
+    }
+}
+
+// Check the hint never changes the result whether the value creeps up, creeps
+// down or jumps about
+TEST( CompiledMapper, HintedMatchesUnhinted )
+{
+    for ( const uint16_t* inputMap : MapCorpus )
+    {
+        CheckHintedSequence( inputMap, RealOutputMap, 0x0000, 1 );
+        CheckHintedSequence( inputMap, RealOutputMap, 0xFFFF, -1 );
+        CheckHintedSequence( inputMap, RealOutputMap, 0x1234, 0x3C71 );
+    }
+
+    CheckHintedSequence( NonMonotonicMap, RealOutputMap, 0x0000, 1 );
+    CheckHintedSequence( NonMonotonicMap, RealOutputMap, 0x1234, 0x3C71 );
+}
+
+// Check the hint is almost always good for a slowly changing tank input and
+// never used for a map where bins overlap
+TEST( CompiledMapper, HintHitRate )
+{
+    CompiledMap map;
+    BinHint     hint;
+
+    CompileMap( &map, RealInputMap, RealOutputMap );
+    ResetBinHint( &hint );
+
+    for ( uint32_t value = 0x10000; value > 0; value -= 0x10 )
+    {
+        MapCompiledValueHinted( value - 1, &map, &hint );
+    }
+    EXPECT_EQ( hint.searches, 0x1000 );
+    EXPECT_EQ( hint.hits, 0x1000 );
+
+    //
+    // Every step now crosses more than one bin
+    //
+    ResetBinHint( &hint );
+    for ( uint16_t value : { 0x0000, 0x8000, 0xFFFF, 0x4000, 0xC000 } )
+    {
+        MapCompiledValueHinted( value, &map, &hint );
+    }
+    EXPECT_EQ( hint.searches, 5 );
+    EXPECT_EQ( hint.hits, 0 );
+
+    CompileMap( &map, NonMonotonicMap, RealOutputMap );
+    ResetBinHint( &hint );
+    MapCompiledValueHinted( 0x2000, &map, &hint );
+    MapCompiledValueHinted( 0x2000, &map, &hint );
+    EXPECT_EQ( hint.searches, 2 );
+    EXPECT_EQ( hint.hits, 0 );
+}
+
+// Check the hint statistics are scaled down rather than wrapping
+TEST( CompiledMapper, HintStatisticsSaturate )
+{
+    CompiledMap map;
+    BinHint     hint;
+
+    CompileMap( &map, RealInputMap, RealOutputMap );
+    ResetBinHint( &hint );
+    hint.searches = UINT16_MAX;
+    hint.hits = UINT16_MAX - 1;
+
+    MapCompiledValueHinted( 0x0000, &map, &hint );
+    EXPECT_EQ( hint.searches, 0x8000 );
+    EXPECT_EQ( hint.hits, 0x7FFF );
+}
@@ -0,0 +1,234 @@
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \file
+//! \brief  Unit test mapping with monotone cubic maps
+//!
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2019 David J. Fiddes
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "gtest/gtest.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "mapper.h"
+
+const uint16_t LinearFullScale[ MAPSIZE ] = { 0x0000, 0x2000, 0x4000,
+                                              0x6000, 0x8000, 0xA000,
+                                              0xC000, 0xE000, 0xFFFF };
+
+const uint16_t LinearInverse[ MAPSIZE ] = { 0xFFFF, 0xE000, 0xC000,
+                                            0xA000, 0x8000, 0x6000,
+                                            0x4000, 0x2000, 0x0000 };
+
+const uint16_t LinearHalf[ MAPSIZE ] = { 0x0000, 0x1000, 0x2000, 0x3000, 0x4000,
+                                         0x5000, 0x6000, 0x7000, 0x8000 };
+
+const uint16_t RealInputMap[ MAPSIZE ] = { 0xbb9f, 0xb6b9, 0xa2e1,
+                                           0x8f39, 0x7abc, 0x667b,
+                                           0x4d7e, 0x2cfc, 0x0bfb };
+
+const uint16_t RealOutputMap[ MAPSIZE ] = { 0x1900, 0x3a40, 0x5200,
+                                            0x6d80, 0x8640, 0x9f00,
+                                            0xb7c0, 0xd540, 0xf000 };
+
+const uint16_t SteepMap[ MAPSIZE ] = { 0x0000, 0x0010, 0x0100, 0x1000, 0x4000,
+                                       0x8000, 0xC000, 0xF000, 0xFFFF };
+
+const uint16_t FlatSpotMap[ MAPSIZE ] = { 0x0400, 0x2000, 0x2000,
+                                          0x2000, 0x6000, 0x8000,
+                                          0x8000, 0xC000, 0xF000 };
+
+const uint16_t PeakMap[ MAPSIZE ] = { 0x1000, 0x4000, 0x9000, 0xF000, 0xFF00,
+                                      0xE000, 0x8000, 0x3000, 0x2000 };
+
+const uint16_t NonMonotonicMap[ MAPSIZE ] = { 0x1000, 0x3000, 0x2800,
+                                              0x5000, 0x5000, 0x9000,
+                                              0x8000, 0xd000, 0xe000 };
+
+//
+//! Monotonic maps used for both input and output
+//
+const uint16_t* const MapCorpus[] = { LinearFullScale, LinearInverse,
+                                      LinearHalf,      RealInputMap,
+                                      RealOutputMap,   SteepMap,
+                                      FlatSpotMap };
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Fraction of a horizontal cylindrical tank that is full at a
+//!         fraction of its height
+//!
+///////////////////////////////////////////////////////////////////////////////
+static double CylinderVolume( double height )
+{
+    double x = 1.0 - 2.0 * height;
+    return ( acos( x ) - x * sqrt( 1.0 - x * x ) ) / M_PI;
+}
+
+// Check the curve passes through every bin and clamps outside the map
+TEST( CubicMapper, PassesThroughBins )
+{
+    for ( const uint16_t* inputMap : MapCorpus )
+    {
+        for ( const uint16_t* outputMap : MapCorpus )
+        {
+            CubicMap map;
+            CompileCubicMap( &map, inputMap, outputMap );
+
+            for ( int bin = 0; bin < MAPSIZE; bin++ )
+            {
+                EXPECT_EQ(
+                    MapCubicValue( inputMap[ bin ], &map ),
+                    MapValue( inputMap[ bin ], inputMap, outputMap ) )
+                    << "Bin " << bin << " maps starting 0x" << std::hex
+                    << inputMap[ 0 ] << " and 0x" << outputMap[ 0 ];
+            }
+
+            EXPECT_EQ(
+                MapCubicValue( 0x0000, &map ),
+                MapValue( 0x0000, inputMap, outputMap ) );
+            EXPECT_EQ(
+                MapCubicValue( 0xFFFF, &map ),
+                MapValue( 0xFFFF, inputMap, outputMap ) );
+        }
+    }
+}
+
+// Check that evenly spaced bins give a straight line
+TEST( CubicMapper, LinearMaps )
+{
+    CubicMap map;
+
+    CompileCubicMap( &map, LinearFullScale, LinearHalf );
+    for ( uint32_t value = 0; value <= 0xFFFF; value++ )
+    {
+        ASSERT_LE(
+            abs( MapCubicValue( value, &map ) -
+                 MapValue( value, LinearFullScale, LinearHalf ) ),
+            1 )
+            << "Value 0x" << std::hex << value;
+    }
+
+    CompileCubicMap( &map, LinearInverse, LinearFullScale );
+    for ( uint32_t value = 0; value <= 0xFFFF; value++ )
+    {
+        ASSERT_LE(
+            abs( MapCubicValue( value, &map ) -
+                 MapValue( value, LinearInverse, LinearFullScale ) ),
+            1 )
+            << "Value 0x" << std::hex << value;
+    }
+}
+
+// Check monotonic maps give output that never turns back by more than the
+// rounding of the fixed point arithmetic
+TEST( CubicMapper, Monotonic )
+{
+    for ( const uint16_t* inputMap : MapCorpus )
+    {
+        for ( const uint16_t* outputMap : MapCorpus )
+        {
+            CubicMap map;
+            CompileCubicMap( &map, inputMap, outputMap );
+
+            bool rising = MapValue( 0x0000, inputMap, outputMap ) <
+                MapValue( 0xFFFF, inputMap, outputMap );
+            uint16_t last = MapCubicValue( 0x0000, &map );
+
+            for ( uint32_t value = 1; value <= 0xFFFF; value++ )
+            {
+                uint16_t output = MapCubicValue( value, &map );
+                if ( rising ? output + 1 < last : output > last + 1 )
+                {
+                    FAIL() << "Turned back at value 0x" << std::hex << value
+                           << " maps starting 0x" << inputMap[ 0 ]
+                           << " and 0x" << outputMap[ 0 ];
+                }
+                last = output;
+            }
+        }
+    }
+}
+
+// Check an output map with a peak doesn't overshoot it
+TEST( CubicMapper, NoOvershoot )
+{
+    CubicMap map;
+    CompileCubicMap( &map, LinearFullScale, PeakMap );
+
+    uint16_t highest = 0x0000;
+    uint16_t lowest = 0xFFFF;
+    for ( uint32_t value = 0; value <= 0xFFFF; value++ )
+    {
+        uint16_t output = MapCubicValue( value, &map );
+        highest = output > highest ? output : highest;
+        lowest = output < lowest ? output : lowest;
+    }
+
+    EXPECT_EQ( highest, 0xFF00 );
+    EXPECT_EQ( lowest, 0x1000 );
+}
+
+// Check input maps that turn back on themselves are mapped linearly
+TEST( CubicMapper, NonMonotonicInput )
+{
+    CubicMap    map;
+    CompiledMap linear;
+    CompileCubicMap( &map, NonMonotonicMap, RealOutputMap );
+    CompileMap( &linear, NonMonotonicMap, RealOutputMap );
+
+    EXPECT_FALSE( map.cubic );
+    for ( uint32_t value = 0; value <= 0xFFFF; value++ )
+    {
+        ASSERT_EQ(
+            MapCubicValue( value, &map ), MapCompiledValue( value, &linear ) )
+            << "Value 0x" << std::hex << value;
+    }
+}
+
+// Check a curved tank is followed much more closely than by straight lines
+TEST( CubicMapper, CurvedTankAccuracy )
+{
+    uint16_t inputMap[ MAPSIZE ];
+    uint16_t outputMap[ MAPSIZE ];
+
+    for ( int bin = 0; bin < MAPSIZE; bin++ )
+    {
+        inputMap[ bin ] = LinearInverse[ bin ];
+        outputMap[ bin ] =
+            lround( 0xFFFF * CylinderVolume( (double)bin / ( MAPSIZE - 1 ) ) );
+    }
+
+    CubicMap    cubic;
+    CompiledMap linear;
+    CompileCubicMap( &cubic, inputMap, outputMap );
+    CompileMap( &linear, inputMap, outputMap );
+
+    long cubicError = 0;
+    long linearError = 0;
+    for ( uint32_t value = 0; value <= 0xFFFF; value++ )
+    {
+        long expected =
+            lround( 0xFFFF * CylinderVolume( 1.0 - value / 65535.0 ) );
+        long error = labs( MapCubicValue( value, &cubic ) - expected );
+        cubicError = error > cubicError ? error : cubicError;
+        error = labs( MapCompiledValue( value, &linear ) - expected );
+        linearError = error > linearError ? error : linearError;
+    }
+
+    EXPECT_LT( cubicError * 2, linearError );
+}
@@ -0,0 +1,579 @@
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \file
+//! \brief  Dummy HAL used for testing
+//!
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2019 David J. Fiddes
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "DummyHal.h"
+#include "filter.h"
+#include "hal.h"
+#include "lookup.h"
+#include "mapper.h"
+#include "sampler.h"
+#include "textqueue.h"
+
+#include <string.h>
+
+//! Current tank input value
+uint16_t g_tank;
+
+//! Tank input rate of change reported when the filters aren't simulated
+int32_t g_tankRate;
+
+//! Run the tank input through the filters as the real HAL does
+bool g_simulateTankFilter;
+
+//! Simulated time in microseconds
+uint32_t g_timeUs;
+
+//
+//! Approximate times taken by the real HAL
+//
+#define SEED_US 500
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Nothing to start as the ticks come from the simulated time
+//!
+///////////////////////////////////////////////////////////////////////////////
+void HAL_StartTicks()
+{
+}
+
+//
+//! The simulated tank input sample path
+//
+static TankFilter s_tankFilter;
+
+//
+//! Samples waiting to be filtered
+//
+static SampleRing s_samples;
+
+//
+//! Ticks the simulated sampling interrupt has run for
+//
+static uint32_t s_interruptTicks;
+
+//
+//! The last filtered tank input
+//
+static uint16_t s_tankInput;
+
+//! Number of tank input samples filtered
+unsigned g_tankSamples;
+
+//! Number of tank input samples lost because the ring was full
+unsigned g_droppedSamples;
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Catch up with the sampling interrupt
+//!
+//! The real interrupt pushes a sample at the end of every tick that is due
+//! one. Nothing else touches the ring in between so it is enough to push the
+//! samples for the ticks that have passed whenever the core looks at the
+//! ticks or the ring.
+//!
+///////////////////////////////////////////////////////////////////////////////
+static void RunSampleInterrupt()
+{
+    uint32_t ticks = g_timeUs / TICK_US;
+
+    //
+    // A test has started the time again
+    //
+    if ( ticks < s_interruptTicks )
+    {
+        s_interruptTicks = ticks;
+    }
+
+    while ( s_interruptTicks < ticks )
+    {
+        if ( SampleDue( &s_samples, (uint16_t)s_interruptTicks ) &&
+             !PushSample( &s_samples, g_tank ) )
+        {
+            g_droppedSamples++;
+        }
+        s_interruptTicks++;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Return the ticks of simulated time
+//!
+///////////////////////////////////////////////////////////////////////////////
+uint16_t HAL_GetTicks()
+{
+    RunSampleInterrupt();
+    return (uint16_t)( g_timeUs / TICK_US );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Run the samples taken since the last drain through the sample path
+//!
+///////////////////////////////////////////////////////////////////////////////
+void HAL_DrainTankSamples()
+{
+    RunSampleInterrupt();
+    g_tankSamples += DrainSamples( &s_samples, &s_tankFilter, &s_tankInput );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Return the current tank input value
+//!
+///////////////////////////////////////////////////////////////////////////////
+uint16_t HAL_GetTankInput()
+{
+    if ( !g_simulateTankFilter )
+    {
+        return g_tank;
+    }
+
+    return s_tankInput;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Return the rate the tank input is changing at in counts per hour
+//!
+///////////////////////////////////////////////////////////////////////////////
+int32_t HAL_GetTankRate()
+{
+    if ( !g_simulateTankFilter )
+    {
+        return g_tankRate;
+    }
+
+    return TankFilterRate( &s_tankFilter );
+}
+
+//! Current gauge output value
+uint16_t g_gauge;
+
+//! Number of times the gauge output has been set
+unsigned g_gaugeWrites;
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Return the last output value of the gauge
+//!
+///////////////////////////////////////////////////////////////////////////////
+uint16_t HAL_GetGaugeOutput()
+{
+    return g_gauge;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Store the value the gauge should be set to output
+//!
+///////////////////////////////////////////////////////////////////////////////
+void HAL_SetGaugeOutput( uint16_t value )
+{
+    g_gauge = value;
+    g_gaugeWrites++;
+}
+
+//! Low fuel warning light state
+bool g_lowFuelState;
+
+//! Strength the tank input filter was last set to
+uint8_t g_tankFilterSetting;
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Record the strength the tank input filter should be set to
+//!
+///////////////////////////////////////////////////////////////////////////////
+void HAL_SetTankFilter( uint8_t setting )
+{
+    g_tankFilterSetting = setting;
+    SetTankFilter( &s_tankFilter, setting );
+}
+
+//! Number of times the tank input filters have been seeded
+unsigned g_tankFilterSeeds;
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Seed the tank input filters from a burst of conversions
+//!
+///////////////////////////////////////////////////////////////////////////////
+void HAL_SeedTankFilter()
+{
+    g_timeUs += SEED_US;
+    g_tankFilterSeeds++;
+
+    //
+    // Samples taken before the seed are passed over
+    //
+    RunSampleInterrupt();
+    uint16_t sample;
+    while ( TakeSample( &s_samples, &sample ) )
+    {
+    }
+
+    SeedTankFilter( &s_tankFilter, g_tank );
+    s_tankInput = g_tank;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Return the tank input filters to their power on state
+//!
+///////////////////////////////////////////////////////////////////////////////
+void ResetTankFilter()
+{
+    memset( &s_tankFilter, 0, sizeof( s_tankFilter ) );
+    memset( &s_samples, 0, sizeof( s_samples ) );
+    s_interruptTicks = g_timeUs / TICK_US;
+    s_tankInput = 0;
+    HAL_SetTankFilter( g_tankFilterSetting );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Set the state of the low fuel warning light
+//!
+///////////////////////////////////////////////////////////////////////////////
+void HAL_SetLowFuelLight( bool newState )
+{
+    g_lowFuelState = newState;
+}
+
+//! The rest of the text queued to be sent in the background
+const char* g_queuedText = "";
+
+//! output buffer used to accumulate lines of character output
+std::vector< std::string > g_output;
+std::string                g_currentLine;
+
+//! Characters still to be received from the console
+std::string g_input;
+
+//
+//! The serial port queues the same size as the real HAL's
+//
+static char      s_txText[ 8 ];
+static TextQueue s_txQueue = TEXT_QUEUE( s_txText );
+static char      s_rxText[ 4 ];
+static TextQueue s_rxQueue = TEXT_QUEUE( s_rxText );
+
+//
+//! Simulated times the character at the front of the transmit queue will have
+//! been sent and the next character typed will arrive
+//
+static uint32_t s_txDoneUs;
+static uint32_t s_rxArriveUs;
+
+//
+//! Simulated time the serial interrupts were last caught up to
+//
+static uint32_t s_serialUs;
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Catch up with the serial port interrupts
+//!
+//! Characters leave the transmit queue and arrive from g_input in the receive
+//! queue one at a time at 9600 baud. Received characters that don't fit are
+//! lost as they would be on the gauge.
+//!
+///////////////////////////////////////////////////////////////////////////////
+static void RunSerialInterrupts()
+{
+    //
+    // A test has started the time again
+    //
+    if ( g_timeUs < s_serialUs )
+    {
+        s_txQueue.tail = s_txQueue.head;
+        s_rxQueue.tail = s_rxQueue.head;
+        s_rxArriveUs = g_timeUs + CHARACTER_US;
+    }
+    s_serialUs = g_timeUs;
+
+    char character;
+    while ( s_txQueue.head != s_txQueue.tail && s_txDoneUs <= g_timeUs )
+    {
+        GetCharacter( &s_txQueue, &character );
+        s_txDoneUs += CHARACTER_US;
+    }
+
+    if ( g_input.empty() )
+    {
+        s_rxArriveUs = g_timeUs + CHARACTER_US;
+    }
+    while ( !g_input.empty() && s_rxArriveUs <= g_timeUs )
+    {
+        PutCharacter( &s_rxQueue, g_input[ 0 ] );
+        g_input.erase( 0, 1 );
+        s_rxArriveUs += CHARACTER_US;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Nothing to start as the serial port is caught up with as needed
+//!
+///////////////////////////////////////////////////////////////////////////////
+void HAL_StartSerial()
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Add a character to the transmit queue, waiting for space
+//!
+//! When the queue is full the simulated time moves on to when there is space.
+//! The tank input samples taken meanwhile are filtered just as the gauge does
+//! while it waits.
+//!
+///////////////////////////////////////////////////////////////////////////////
+static void SendCharacter( char character )
+{
+    RunSerialInterrupts();
+    if ( TextQueueSpace( &s_txQueue ) == 0 )
+    {
+        g_timeUs = s_txDoneUs;
+        RunSerialInterrupts();
+        HAL_DrainTankSamples();
+    }
+
+    if ( s_txQueue.head == s_txQueue.tail )
+    {
+        s_txDoneUs = g_timeUs + CHARACTER_US;
+    }
+    PutCharacter( &s_txQueue, character );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Print to our current line
+//!
+///////////////////////////////////////////////////////////////////////////////
+void HAL_PrintText( const char* text )
+{
+    for ( ; *g_queuedText; g_queuedText++ )
+    {
+        SendCharacter( *g_queuedText );
+        g_currentLine.push_back( *g_queuedText );
+    }
+
+    for ( ; *text; text++ )
+    {
+        SendCharacter( *text );
+        g_currentLine.push_back( *text );
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Queue text to be sent in the background
+//!
+///////////////////////////////////////////////////////////////////////////////
+void HAL_QueueText( const char* text )
+{
+    HAL_PrintText( "" );
+    g_queuedText = text;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Move as much queued text into the transmit queue as will fit
+//!
+///////////////////////////////////////////////////////////////////////////////
+void HAL_ServiceText()
+{
+    RunSerialInterrupts();
+    while ( *g_queuedText && TextQueueSpace( &s_txQueue ) > 0 )
+    {
+        SendCharacter( *g_queuedText );
+        g_currentLine.push_back( *g_queuedText );
+        g_queuedText++;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Print to our current line
+//!
+///////////////////////////////////////////////////////////////////////////////
+void HAL_PrintNewline()
+{
+    SendCharacter( '\r' );
+    SendCharacter( '\n' );
+    g_output.push_back( g_currentLine );
+    g_currentLine.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Receive the next character from the console if there is one
+//!
+///////////////////////////////////////////////////////////////////////////////
+bool HAL_ReadCharacter( char* character )
+{
+    RunSerialInterrupts();
+    return GetCharacter( &s_rxQueue, character );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Return the number of received characters that have been lost
+//!
+///////////////////////////////////////////////////////////////////////////////
+uint8_t HAL_GetLostCharacters()
+{
+    return s_rxQueue.lost;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Return the number of characters waiting to be sent
+//!
+///////////////////////////////////////////////////////////////////////////////
+unsigned PendingCharacters()
+{
+    RunSerialInterrupts();
+    return (uint8_t)( s_txQueue.head - s_txQueue.tail );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Empty the serial port queues and forget any lost characters
+//!
+///////////////////////////////////////////////////////////////////////////////
+void ResetSerial()
+{
+    s_txQueue.tail = s_txQueue.head;
+    s_rxQueue.tail = s_rxQueue.head;
+    s_rxQueue.lost = 0;
+    s_serialUs = g_timeUs;
+    s_rxArriveUs = g_timeUs + CHARACTER_US;
+}
+
+//! A test tank input to linear actual tank value map
+uint16_t g_inputMap[ MAPSIZE ];
+
+//! A test linear actual tank value to gauge output value map
+uint16_t g_outputMap[ MAPSIZE ];
+
+//! Low fuel level setting (treated as part of the map)
+uint16_t g_lowFuelLevel;
+
+//! Tank input filter setting (treated as part of the map)
+uint8_t g_filterSetting;
+
+//! Ticks between mappings (treated as part of the map)
+uint8_t g_mappingTicks;
+
+//! Ticks between gauge updates (treated as part of the map)
+uint8_t g_outputTicks;
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Load our test maps into the fuel gauge processor
+//!
+///////////////////////////////////////////////////////////////////////////////
+void HAL_LoadMaps(
+    uint16_t* input,
+    uint16_t* output,
+    uint16_t* lowFuelLevel,
+    uint8_t*  filterSetting,
+    uint8_t*  mappingTicks,
+    uint8_t*  outputTicks )
+{
+    memcpy( input, &g_inputMap, sizeof( g_inputMap ) );
+    memcpy( output, &g_outputMap, sizeof( g_outputMap ) );
+    *lowFuelLevel = g_lowFuelLevel;
+    *filterSetting = g_filterSetting;
+    *mappingTicks = g_mappingTicks;
+    *outputTicks = g_outputTicks;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Save the supplied maps into our test maps for checking
+//!
+///////////////////////////////////////////////////////////////////////////////
+void HAL_SaveMaps(
+    const uint16_t* input,
+    const uint16_t* output,
+    uint16_t        lowFuelLevel,
+    uint8_t         filterSetting,
+    uint8_t         mappingTicks,
+    uint8_t         outputTicks )
+{
+    memcpy( &g_inputMap, input, sizeof( g_inputMap ) );
+    memcpy( &g_outputMap, output, sizeof( g_outputMap ) );
+    g_lowFuelLevel = lowFuelLevel;
+    g_filterSetting = filterSetting;
+    g_mappingTicks = mappingTicks;
+    g_outputTicks = outputTicks;
+}
+
+//! Flash stand-in holding the lookup table
+uint16_t g_flash[ LOOKUP_STORAGE_SIZE ];
+
+//! Number of lookup table entries written to flash
+unsigned g_flashWrites;
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Erase the flash stand-in
+//!
+///////////////////////////////////////////////////////////////////////////////
+void EraseFlash()
+{
+    for ( uint16_t& entry : g_flash )
+    {
+        entry = LOOKUP_ERASED_ENTRY;
+    }
+    g_flashWrites = 0;
+}
+
+//! Flash starts off erased just like a freshly programmed device
+static bool s_flashErased = ( EraseFlash(), true );
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Read a lookup table entry back from the flash stand-in
+//!
+///////////////////////////////////////////////////////////////////////////////
+uint16_t HAL_ReadLookupEntry( uint16_t index )
+{
+    return g_flash[ index ];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Write a lookup table entry into the flash stand-in
+//!
+//! Flash words are only 14-bits wide so any higher bits are lost
+//!
+///////////////////////////////////////////////////////////////////////////////
+void HAL_WriteLookupEntry( uint16_t index, uint16_t value )
+{
+    g_flash[ index ] = value & LOOKUP_ERASED_ENTRY;
+    g_flashWrites++;
+}
@@ -0,0 +1,110 @@
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \file
+//! \brief  Dummy HAL used for testing
+//!
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2019 David J. Fiddes
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef DUMMYHAL_H
+#define DUMMYHAL_H
+
+#include "lookup.h"
+#include "mapper.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+//! Current tank input value
+extern uint16_t g_tank;
+
+//! Tank input rate of change reported when the filters aren't simulated
+extern int32_t g_tankRate;
+
+//! Run the tank input through the filters as the real HAL does
+extern bool g_simulateTankFilter;
+
+//! Simulated time in microseconds
+extern uint32_t g_timeUs;
+
+//! Simulated time between ticks, each of which takes a tank input sample
+#define TICK_US 1000
+
+//! Simulated time to send or receive a character at 9600 baud
+#define CHARACTER_US 1042
+
+//! Number of times the tank input filters have been seeded
+extern unsigned g_tankFilterSeeds;
+
+//! Number of tank input samples filtered
+extern unsigned g_tankSamples;
+
+//! Number of tank input samples lost because the ring was full
+extern unsigned g_droppedSamples;
+
+//! Characters still to be typed at the console, arriving at 9600 baud
+extern std::string g_input;
+
+//! The rest of the text queued to be sent in the background
+extern const char* g_queuedText;
+
+//! Current gauge output value
+extern uint16_t g_gauge;
+
+//! Number of times the gauge output has been set
+extern unsigned g_gaugeWrites;
+
+//! Low fuel warning light state
+extern bool g_lowFuelState;
+
+//! Strength the tank input filter was last set to
+extern uint8_t g_tankFilterSetting;
+
+//! output buffer used to accumulate lines of character output
+extern std::vector< std::string > g_output;
+extern std::string                g_currentLine;
+
+//! A test tank input to linear actual tank value map
+extern uint16_t g_inputMap[ MAPSIZE ];
+
+//! A test linear actual tank value to gauge output value map
+extern uint16_t g_outputMap[ MAPSIZE ];
+
+//! Low fuel level setting (treated as part of the map)
+extern uint16_t g_lowFuelLevel;
+
+//! Tank input filter setting (treated as part of the map)
+extern uint8_t g_filterSetting;
+
+//! Ticks between mappings (treated as part of the map)
+extern uint8_t g_mappingTicks;
+
+//! Ticks between gauge updates (treated as part of the map)
+extern uint8_t g_outputTicks;
+
+//! Flash stand-in holding the lookup table
+extern uint16_t g_flash[ LOOKUP_STORAGE_SIZE ];
+
+//! Number of lookup table entries written to flash
+extern unsigned g_flashWrites;
+
+void     EraseFlash();
+void     ResetTankFilter();
+void     ResetSerial();
+unsigned PendingCharacters();
+
+#endif // DUMMYHAL_H
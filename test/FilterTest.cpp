@@ -0,0 +1,729 @@
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \file
+//! \brief  Unit test the tank input filter
+//!
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2019 David J. Fiddes
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "filter.h"
+#include "hal.h"
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  The filter as it was originally written in the PIC HAL with a
+//!         fixed k of 8
+//!
+///////////////////////////////////////////////////////////////////////////////
+static uint16_t ReferenceFilter( uint32_t& z, uint16_t x )
+{
+    const uint8_t k = 8;
+
+    z += x;
+    uint32_t y = ( z + ( 1 << ( k - 1 ) ) ) >> k;
+    z -= y;
+
+    return y;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Generate a repeatable noisy tank input
+//!
+///////////////////////////////////////////////////////////////////////////////
+static uint16_t NoisyInput( uint32_t& seed )
+{
+    seed = seed * 1664525 + 1013904223;
+    return 0x8000 + ( (int16_t)( seed >> 16 ) >> 4 );
+}
+
+// Check the default filter behaves exactly as the original did
+TEST( Filter, MatchesOriginal )
+{
+    FilterState filter;
+    InitialiseFilter( &filter, FILTER_DEFAULT_K );
+
+    uint32_t z = 0;
+    uint32_t seed = 0x12345678;
+    for ( int i = 0; i < 10000; i++ )
+    {
+        uint16_t x = NoisyInput( seed );
+        ASSERT_EQ( Filter( &filter, x ), ReferenceFilter( z, x ) )
+            << "Sample " << i;
+    }
+}
+
+// Check separate filters don't share any history
+TEST( Filter, IndependentInstances )
+{
+    FilterState first;
+    FilterState second;
+    InitialiseFilter( &first, 4 );
+    InitialiseFilter( &second, 4 );
+
+    for ( int i = 0; i < 200; i++ )
+    {
+        Filter( &first, 0xF000 );
+        Filter( &second, 0x1000 );
+    }
+
+    EXPECT_EQ( Filter( &first, 0xF000 ), 0xF000 );
+    EXPECT_EQ( Filter( &second, 0x1000 ), 0x1000 );
+}
+
+// Check a k of zero passes the input straight through
+TEST( Filter, PassThrough )
+{
+    FilterState filter;
+    InitialiseFilter( &filter, 0 );
+
+    EXPECT_EQ( Filter( &filter, 0x1234 ), 0x1234 );
+    EXPECT_EQ( Filter( &filter, 0xFFFF ), 0xFFFF );
+    EXPECT_EQ( Filter( &filter, 0x0000 ), 0x0000 );
+}
+
+// Check the output settles on a step input for every strength
+TEST( Filter, StepResponse )
+{
+    for ( uint8_t k = 1; k <= FILTER_MAX_K; k++ )
+    {
+        FilterState filter;
+        InitialiseFilter( &filter, k );
+
+        //
+        // Stronger filters take longer to get there but the output only
+        // ever rises
+        //
+        uint16_t last = 0;
+        for ( uint32_t i = 0; i < ( 32UL << k ); i++ )
+        {
+            uint16_t y = Filter( &filter, 0xFFFF );
+            ASSERT_GE( y, last ) << "k " << (int)k << " sample " << i;
+            last = y;
+        }
+
+        EXPECT_EQ( last, 0xFFFF ) << "k " << (int)k;
+    }
+}
+
+// Check the strength is limited and can be changed without a jump
+TEST( Filter, ChangeStrength )
+{
+    FilterState filter;
+    InitialiseFilter( &filter, 0xFF );
+    EXPECT_EQ( filter.k, FILTER_MAX_K );
+
+    InitialiseFilter( &filter, 8 );
+    for ( int i = 0; i < 4000; i++ )
+    {
+        Filter( &filter, 0x6000 );
+    }
+
+    EXPECT_FALSE( SetFilterK( &filter, FILTER_MAX_K + 1 ) );
+    EXPECT_EQ( filter.k, 8 );
+
+    for ( uint8_t k : { 3, 12, 0, 5 } )
+    {
+        ASSERT_TRUE( SetFilterK( &filter, k ) );
+        EXPECT_LE( abs( Filter( &filter, 0x6000 ) - 0x6000 ), 1 )
+            << "k " << (int)k;
+    }
+}
+
+// Check the median always matches sorting the last few samples
+TEST( Filter, MedianMatchesSort )
+{
+    MedianFilter filter;
+    memset( &filter, 0, sizeof( filter ) );
+
+    //
+    // Start from all zeros as a static filter would and use a narrow range
+    // of values so there are plenty of repeats
+    //
+    uint16_t history[ MEDIAN_SIZE ] = {};
+    uint32_t seed = 0x12345678;
+    for ( int i = 0; i < 100000; i++ )
+    {
+        seed = seed * 1664525 + 1013904223;
+        uint16_t x = ( i & 0x100 ) ? seed >> 16 : ( seed >> 28 ) + 0x4000;
+        history[ i % MEDIAN_SIZE ] = x;
+
+        uint16_t sorted[ MEDIAN_SIZE ];
+        memcpy( sorted, history, sizeof( sorted ) );
+        std::sort( sorted, sorted + MEDIAN_SIZE );
+
+        ASSERT_EQ( Median( &filter, x ), sorted[ MEDIAN_SIZE / 2 ] )
+            << "Sample " << i;
+    }
+}
+
+// Check spikes shorter than half the window are removed completely
+TEST( Filter, MedianRejectsSpikes )
+{
+    MedianFilter filter;
+    InitialiseMedian( &filter, 0x4000 );
+
+    for ( int width = 1; width <= MEDIAN_SIZE / 2; width++ )
+    {
+        for ( int i = 0; i < width; i++ )
+        {
+            EXPECT_EQ( Median( &filter, i & 1 ? 0x0000 : 0xFFFF ), 0x4000 );
+        }
+        for ( int i = 0; i < MEDIAN_SIZE; i++ )
+        {
+            EXPECT_EQ( Median( &filter, 0x4000 ), 0x4000 );
+        }
+    }
+
+    //
+    // A real change in level comes through after half the window
+    //
+    for ( int i = 0; i < MEDIAN_SIZE / 2; i++ )
+    {
+        EXPECT_EQ( Median( &filter, 0x8000 ), 0x4000 );
+    }
+    EXPECT_EQ( Median( &filter, 0x8000 ), 0x8000 );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Count the samples a filter takes to settle within 1% of full
+//!         scale after a step from empty to full
+//!
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t SettlingSamples( FilterState* filter )
+{
+    uint32_t settled = 0;
+    for ( uint32_t i = 1; i <= 0x10000; i++ )
+    {
+        if ( abs( Filter( filter, 0xFFFF ) - 0xFFFF ) > 0xFFFF / 100 )
+        {
+            settled = i;
+        }
+    }
+
+    return settled;
+}
+
+// Check an adaptive filter follows a step much faster than a fixed one
+TEST( Filter, AdaptiveStepResponse )
+{
+    FilterState fixed;
+    InitialiseFilter( &fixed, 8 );
+    EXPECT_GT( SettlingSamples( &fixed ), 1000 );
+
+    FilterState adaptive;
+    InitialiseFilter( &adaptive, 8 );
+    SetFilterAdaptive( &adaptive, true );
+    EXPECT_LT( SettlingSamples( &adaptive ), 50 );
+
+    //
+    // It returns to full strength once it has settled
+    //
+    EXPECT_EQ( adaptive.kNow, 8 );
+}
+
+// Check an adaptive filter smooths noise within the band as well as a fixed
+// one once it has settled
+TEST( Filter, AdaptiveNoise )
+{
+    FilterState fixed;
+    FilterState adaptive;
+    InitialiseFilter( &fixed, 8 );
+    InitialiseFilter( &adaptive, 8 );
+    SetFilterAdaptive( &adaptive, true );
+
+    //
+    // Noise that stays within the band
+    //
+    uint32_t seed = 0x12345678;
+    uint16_t fixedMin = 0xFFFF, fixedMax = 0;
+    uint16_t adaptiveMin = 0xFFFF, adaptiveMax = 0;
+    for ( int i = 0; i < 20000; i++ )
+    {
+        seed = seed * 1664525 + 1013904223;
+        uint16_t x = 0x8000 + ( (int16_t)( seed >> 16 ) >> 7 );
+        uint16_t fixedOutput = Filter( &fixed, x );
+        uint16_t adaptiveOutput = Filter( &adaptive, x );
+
+        if ( i >= 10000 )
+        {
+            fixedMin = std::min( fixedMin, fixedOutput );
+            fixedMax = std::max( fixedMax, fixedOutput );
+            adaptiveMin = std::min( adaptiveMin, adaptiveOutput );
+            adaptiveMax = std::max( adaptiveMax, adaptiveOutput );
+        }
+    }
+
+    EXPECT_EQ( adaptive.kNow, 8 );
+    EXPECT_LE( adaptiveMax - adaptiveMin, ( fixedMax - fixedMin ) * 5 / 4 );
+}
+
+// Check switching to and from an adaptive filter carries on from the same
+// output
+TEST( Filter, AdaptiveSwitch )
+{
+    FilterState filter;
+    InitialiseFilter( &filter, 6 );
+    for ( int i = 0; i < 2000; i++ )
+    {
+        Filter( &filter, 0x6000 );
+    }
+
+    SetFilterAdaptive( &filter, true );
+    EXPECT_LE( abs( Filter( &filter, 0x6000 ) - 0x6000 ), 1 );
+    ASSERT_TRUE( SetFilterK( &filter, 10 ) );
+    EXPECT_LE( abs( Filter( &filter, 0x6000 ) - 0x6000 ), 1 );
+    SetFilterAdaptive( &filter, false );
+    EXPECT_LE( abs( Filter( &filter, 0x6000 ) - 0x6000 ), 1 );
+
+    //
+    // An adaptive filter with a k of zero is still off
+    //
+    SetFilterAdaptive( &filter, true );
+    ASSERT_TRUE( SetFilterK( &filter, 0 ) );
+    EXPECT_EQ( Filter( &filter, 0x1234 ), 0x1234 );
+    EXPECT_EQ( Filter( &filter, 0xFFFF ), 0xFFFF );
+}
+
+// Check the estimator follows a steady drain without lagging behind it like
+// the EMA does and picks up the rate
+TEST( Filter, EstimatorTracksDrain )
+{
+    FilterState    ema;
+    LevelEstimator estimator;
+    InitialiseFilter( &ema, 12 );
+    SeedFilter( &ema, 0xA000 );
+    SetEstimatorK( &estimator, 12 );
+    SeedEstimator( &estimator, 0xA000 );
+
+    //
+    // A count every hundred samples is 36000 counts an hour
+    //
+    uint32_t seed = 0x12345678;
+    int      emaLag = 0;
+    int      estimatorLag = 0;
+    for ( int i = 0; i < 120000; i++ )
+    {
+        seed = seed * 1664525 + 1013904223;
+        uint16_t level = 0xA000 - i / 100;
+        uint16_t x = level + ( (int16_t)( seed >> 16 ) >> 7 );
+        uint16_t emaOutput = Filter( &ema, x );
+        uint16_t estimatorOutput = Estimate( &estimator, x );
+
+        if ( i >= 100000 )
+        {
+            emaLag = std::max( emaLag, emaOutput - level );
+            estimatorLag =
+                std::max( estimatorLag, abs( estimatorOutput - level ) );
+        }
+    }
+
+    EXPECT_GT( emaLag, 30 );
+    EXPECT_LE( estimatorLag, 8 );
+    EXPECT_NEAR( EstimatedRate( &estimator ), -36000, 1800 );
+}
+
+// Check the estimator settles after a step without overshooting by much
+TEST( Filter, EstimatorStepResponse )
+{
+    LevelEstimator estimator;
+    SetEstimatorK( &estimator, 6 );
+    SeedEstimator( &estimator, 0x4000 );
+
+    uint32_t settled = 0;
+    uint16_t peak = 0;
+    for ( uint32_t i = 1; i <= 5000; i++ )
+    {
+        uint16_t output = Estimate( &estimator, 0xC000 );
+        peak = std::max( peak, output );
+        if ( abs( output - 0xC000 ) > 0xFFFF / 100 )
+        {
+            settled = i;
+        }
+    }
+
+    //
+    // It is about as quick as an EMA of the same strength
+    //
+    EXPECT_LT( settled, 400 );
+    EXPECT_LE( peak - 0xC000, 0x40 );
+    EXPECT_EQ( Estimate( &estimator, 0xC000 ), 0xC000 );
+}
+
+// Check full scale swings can't overflow the estimator
+TEST( Filter, EstimatorLimits )
+{
+    LevelEstimator estimator;
+    SetEstimatorK( &estimator, 0 );
+    EXPECT_EQ( estimator.k, ESTIMATOR_MIN_K );
+    SeedEstimator( &estimator, 0 );
+
+    for ( int swing = 0; swing < 8; swing++ )
+    {
+        uint16_t x = ( swing & 1 ) ? 0x0000 : 0xFFFF;
+        uint16_t output = 0;
+        for ( int i = 0; i < 4000; i++ )
+        {
+            output = Estimate( &estimator, x );
+            ASSERT_LE( estimator.rate, ESTIMATOR_MAX_RATE );
+            ASSERT_GE( estimator.rate, -ESTIMATOR_MAX_RATE );
+        }
+        EXPECT_EQ( output, x );
+    }
+}
+
+// Check switching between the EMA and the estimator carries on from the same
+// output
+TEST( Filter, EstimatorSwitch )
+{
+    TankFilter filter = {};
+    SetTankFilter( &filter, 8 );
+    SeedTankFilter( &filter, 0x6000 );
+    for ( int i = 0; i < 100; i++ )
+    {
+        FilterTankInput( &filter, 0x6000 );
+    }
+    EXPECT_EQ( TankFilterRate( &filter ), 0 );
+
+    SetTankFilter( &filter, FILTER_ESTIMATOR_FLAG | 10 );
+    EXPECT_LE( abs( FilterTankInput( &filter, 0x6000 ) - 0x6000 ), 1 );
+    EXPECT_EQ( TankFilterRate( &filter ), 0 );
+
+    SetTankFilter( &filter, FILTER_ESTIMATOR_FLAG | 12 );
+    EXPECT_LE( abs( FilterTankInput( &filter, 0x6000 ) - 0x6000 ), 1 );
+
+    SetTankFilter( &filter, 8 );
+    EXPECT_LE( abs( FilterTankInput( &filter, 0x6000 ) - 0x6000 ), 1 );
+}
+
+// Check open and shorted senders are reported within a few samples and the
+// last good value is held until then
+TEST( Filter, SenderFaultLatency )
+{
+    for ( uint16_t faulty : { 0xffc0, 0xffff, 0x0040, 0x0000 } )
+    {
+        TankFilter filter = {};
+        SetTankFilter( &filter, FILTER_DEFAULT_K );
+        SeedTankFilter( &filter, 0x8000 );
+
+        for ( int i = 1; i < SENDER_FAULT_SAMPLES; i++ )
+        {
+            EXPECT_EQ( FilterTankInput( &filter, faulty ), 0x8000 )
+                << "Sample 0x" << std::hex << faulty;
+        }
+        EXPECT_EQ( FilterTankInput( &filter, faulty ), TANK_INPUT_ERROR )
+            << "Sample 0x" << std::hex << faulty;
+        EXPECT_EQ( FilterTankInput( &filter, faulty ), TANK_INPUT_ERROR );
+    }
+}
+
+// Check short bursts of faulty samples never reach the filters
+TEST( Filter, SenderFaultDoesNotPolluteFilter )
+{
+    TankFilter clean = {};
+    TankFilter faulty = {};
+    SetTankFilter( &clean, FILTER_MEDIAN_FLAG | FILTER_DEFAULT_K );
+    SetTankFilter( &faulty, FILTER_MEDIAN_FLAG | FILTER_DEFAULT_K );
+
+    uint32_t seed = 0x12345678;
+    for ( int i = 0; i < 20000; i++ )
+    {
+        uint16_t x = NoisyInput( seed );
+
+        //
+        // Every so often the sender drops out or shorts for a moment
+        //
+        if ( ( seed & 0xFF ) == 0 )
+        {
+            uint16_t glitch = ( seed & 0x100 ) ? 0xffc0 : 0x0000;
+            for ( uint32_t j = 0; j <= ( seed >> 9 ) % 3; j++ )
+            {
+                ASSERT_NE(
+                    FilterTankInput( &faulty, glitch ), TANK_INPUT_ERROR );
+            }
+        }
+
+        ASSERT_EQ( FilterTankInput( &faulty, x ), FilterTankInput( &clean, x ) )
+            << "Sample " << i;
+    }
+}
+
+// Check a sender fault is only cleared after a run of good samples and the
+// filters then start from the sender's value
+TEST( Filter, SenderFaultRecovery )
+{
+    TankFilter filter = {};
+    SetTankFilter( &filter, FILTER_DEFAULT_K );
+    SeedTankFilter( &filter, 0x8000 );
+
+    for ( int i = 0; i < SENDER_FAULT_SAMPLES; i++ )
+    {
+        FilterTankInput( &filter, 0xffc0 );
+    }
+
+    //
+    // A good sample in the middle of the fault starts the count again
+    //
+    FilterTankInput( &filter, 0x3000 );
+    EXPECT_EQ( FilterTankInput( &filter, 0xffc0 ), TANK_INPUT_ERROR );
+
+    for ( int i = 1; i < SENDER_RECOVERY_SAMPLES; i++ )
+    {
+        EXPECT_EQ( FilterTankInput( &filter, 0x3000 ), TANK_INPUT_ERROR );
+    }
+    EXPECT_EQ( FilterTankInput( &filter, 0x3000 ), 0x3000 );
+    EXPECT_EQ( FilterTankInput( &filter, 0x3000 ), 0x3000 );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Run a tick by tick tank input through a sample path, only taking
+//!         the samples the ticks are due as the sampling interrupt does
+//!
+//! \returns The output at each tick
+//!
+///////////////////////////////////////////////////////////////////////////////
+static std::vector< uint16_t > SampleTicks(
+    TankFilter*                    filter,
+    const std::vector< uint16_t >& input,
+    unsigned*                      samples = NULL )
+{
+    std::vector< uint16_t > output( input.size() );
+    uint16_t                y = filter->output;
+
+    for ( size_t tick = 0; tick < input.size(); tick++ )
+    {
+        uint8_t skip = ( 1 << TankFilterBackoff( filter ) ) - 1;
+        if ( ( tick & skip ) == 0 )
+        {
+            y = FilterTankInput( filter, input[ tick ] );
+            if ( samples )
+            {
+                ( *samples )++;
+            }
+        }
+        output[ tick ] = y;
+    }
+
+    return output;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Generate a repeatable tank input with noise that stays within the
+//!         noise band
+//!
+///////////////////////////////////////////////////////////////////////////////
+static uint16_t QuietInput( uint32_t& seed )
+{
+    seed = seed * 1664525 + 1013904223;
+    return 0x8000 + ( (int16_t)( seed >> 16 ) >> 7 );
+}
+
+// Check a steady input backs the sample rate off a step at a time with the
+// EMA weakened to match, and only when asked to
+TEST( Filter, BackoffSteadyInput )
+{
+    TankFilter filter = {};
+    SetTankFilter( &filter, FILTER_BACKOFF_FLAG | FILTER_DEFAULT_K );
+    SeedTankFilter( &filter, 0x8000 );
+
+    uint32_t seed = 0x12345678;
+    for ( int i = 0; i < ( 1 << FILTER_DEFAULT_K ) - 1; i++ )
+    {
+        FilterTankInput( &filter, QuietInput( seed ) );
+    }
+    EXPECT_EQ( TankFilterBackoff( &filter ), 0 );
+    FilterTankInput( &filter, QuietInput( seed ) );
+    EXPECT_EQ( TankFilterBackoff( &filter ), 1 );
+    EXPECT_EQ( filter.stage.smoothing.k, FILTER_DEFAULT_K - 1 );
+
+    for ( int i = 0; i < 1000; i++ )
+    {
+        FilterTankInput( &filter, QuietInput( seed ) );
+    }
+    EXPECT_EQ( TankFilterBackoff( &filter ), SAMPLE_BACKOFF_MAX );
+    EXPECT_EQ( filter.stage.smoothing.k, FILTER_DEFAULT_K - SAMPLE_BACKOFF_MAX );
+
+    //
+    // A weak EMA can't back off as far and without the flag it never does
+    //
+    SetTankFilter( &filter, FILTER_BACKOFF_FLAG | ( BACKOFF_MIN_K + 1 ) );
+    EXPECT_EQ( TankFilterBackoff( &filter ), 0 );
+    for ( int i = 0; i < 1000; i++ )
+    {
+        FilterTankInput( &filter, QuietInput( seed ) );
+    }
+    EXPECT_EQ( TankFilterBackoff( &filter ), 1 );
+
+    SetTankFilter( &filter, FILTER_DEFAULT_K );
+    for ( int i = 0; i < 1000; i++ )
+    {
+        FilterTankInput( &filter, QuietInput( seed ) );
+    }
+    EXPECT_EQ( TankFilterBackoff( &filter ), 0 );
+}
+
+// Check a step or a sender fault restores the full rate straight away without
+// the output jumping
+TEST( Filter, BackoffStep )
+{
+    TankFilter filter = {};
+    SetTankFilter( &filter, FILTER_BACKOFF_FLAG | FILTER_DEFAULT_K );
+    SeedTankFilter( &filter, 0x8000 );
+    for ( int i = 0; i < 1000; i++ )
+    {
+        FilterTankInput( &filter, 0x8000 );
+    }
+    ASSERT_EQ( TankFilterBackoff( &filter ), SAMPLE_BACKOFF_MAX );
+
+    EXPECT_LE( abs( FilterTankInput( &filter, 0x9000 ) - 0x8000 ), 0x100 );
+    EXPECT_EQ( TankFilterBackoff( &filter ), 0 );
+    EXPECT_EQ( filter.stage.smoothing.k, FILTER_DEFAULT_K );
+
+    for ( int i = 0; i < 5000; i++ )
+    {
+        FilterTankInput( &filter, 0x9000 );
+    }
+    ASSERT_EQ( TankFilterBackoff( &filter ), SAMPLE_BACKOFF_MAX );
+    EXPECT_EQ( FilterTankInput( &filter, 0xffc0 ), 0x9000 );
+    EXPECT_EQ( TankFilterBackoff( &filter ), 0 );
+}
+
+// Check the gauge responds the same to a slow drain and to a step whether or
+// not the sample rate has backed off
+TEST( Filter, BackoffResponse )
+{
+    //
+    // A drain slow enough to stay within the noise band, then a step
+    //
+    std::vector< uint16_t > input( 30000 );
+    for ( size_t tick = 0; tick < input.size(); tick++ )
+    {
+        input[ tick ] = tick < 20000 ? 0xC000 - tick : 0x6000;
+    }
+
+    TankFilter full = {};
+    TankFilter backoff = {};
+    SetTankFilter( &full, FILTER_DEFAULT_K );
+    SetTankFilter( &backoff, FILTER_BACKOFF_FLAG | FILTER_DEFAULT_K );
+    SeedTankFilter( &full, 0xC000 );
+    SeedTankFilter( &backoff, 0xC000 );
+
+    unsigned                fullSamples = 0;
+    unsigned                backoffSamples = 0;
+    std::vector< uint16_t > fullOutput =
+        SampleTicks( &full, input, &fullSamples );
+    std::vector< uint16_t > backoffOutput =
+        SampleTicks( &backoff, input, &backoffSamples );
+
+    EXPECT_EQ( fullSamples, input.size() );
+    EXPECT_LT( backoffSamples, input.size() / 4 );
+
+    //
+    // The lag behind the drain is the same as the EMA's time constant is
+    //
+    for ( size_t tick = 5000; tick < 20000; tick++ )
+    {
+        ASSERT_LE(
+            abs( backoffOutput[ tick ] - fullOutput[ tick ] ),
+            2 << SAMPLE_BACKOFF_MAX )
+            << "Tick " << tick;
+    }
+
+    //
+    // The step is only noticed at the next sample so can be a few ticks late
+    //
+    size_t fullHalf = 20000;
+    size_t backoffHalf = 20000;
+    while ( fullOutput[ fullHalf ] > 0x8000 )
+    {
+        fullHalf++;
+    }
+    while ( backoffOutput[ backoffHalf ] > 0x8000 )
+    {
+        backoffHalf++;
+    }
+    EXPECT_GE( backoffHalf, fullHalf );
+    EXPECT_LT( backoffHalf, fullHalf + ( 1 << SAMPLE_BACKOFF_MAX ) );
+}
+
+// Check a steady input comes through oversampling unchanged
+TEST( Filter, OversampleSteadyInput )
+{
+    Oversampler sampler = {};
+
+    for ( uint16_t conversion : { 0x0000, 0x0040, 0x1240, 0x8000, 0xffc0 } )
+    {
+        for ( int i = 1; i < OVERSAMPLE_COUNT; i++ )
+        {
+            ASSERT_FALSE( AccumulateSample( &sampler, conversion ) );
+        }
+        ASSERT_TRUE( AccumulateSample( &sampler, conversion ) );
+        EXPECT_EQ( DumpOversample( &sampler ), conversion );
+    }
+}
+
+// Check oversampling a dithered input gives the extra resolution
+TEST( Filter, OversampleResolution )
+{
+    //
+    // A level a quarter of the way between two ADC codes comes out as the
+    // 12-bit code in between
+    //
+    Oversampler sampler = {};
+    for ( int i = 0; i < OVERSAMPLE_COUNT; i++ )
+    {
+        AccumulateSample(
+            &sampler, i < OVERSAMPLE_COUNT / 4 ? 0x1940 : 0x1900 );
+    }
+    EXPECT_EQ( DumpOversample( &sampler ), 0x1910 );
+
+    //
+    // Sweep a slowly changing level with a count of noise on every
+    // conversion and compare against single conversions
+    //
+    uint32_t seed = 0x12345678;
+    double   singleSquares = 0.0;
+    double   oversampledSquares = 0.0;
+    for ( uint32_t level = 0x1000; level < 0x3000; level += 0x7 )
+    {
+        uint16_t first = 0;
+        for ( int i = 0; i < OVERSAMPLE_COUNT; i++ )
+        {
+            seed = seed * 1664525 + 1013904223;
+            int32_t  noisy = level + (int32_t)( seed >> 16 ) % 0x40;
+            uint16_t conversion = noisy & 0xFFC0;
+            first = i == 0 ? conversion : first;
+            AccumulateSample( &sampler, conversion );
+        }
+
+        double single = (double)first - level;
+        double oversampled = (double)DumpOversample( &sampler ) - level;
+        singleSquares += single * single;
+        oversampledSquares += oversampled * oversampled;
+    }
+
+    EXPECT_LT( oversampledSquares, singleSquares / 4 );
+}
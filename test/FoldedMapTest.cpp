@@ -0,0 +1,217 @@
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \file
+//! \brief  Unit test mapping through input maps that turn back on themselves
+//!
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2019 David J. Fiddes
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "gtest/gtest.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "mapper.h"
+
+const uint16_t LinearFullScale[ MAPSIZE ] = { 0x0000, 0x2000, 0x4000,
+                                              0x6000, 0x8000, 0xA000,
+                                              0xC000, 0xE000, 0xFFFF };
+
+const uint16_t LinearInverse[ MAPSIZE ] = { 0xFFFF, 0xE000, 0xC000,
+                                            0xA000, 0x8000, 0x6000,
+                                            0x4000, 0x2000, 0x0000 };
+
+const uint16_t RealInputMap[ MAPSIZE ] = { 0xbb9f, 0xb6b9, 0xa2e1,
+                                           0x8f39, 0x7abc, 0x667b,
+                                           0x4d7e, 0x2cfc, 0x0bfb };
+
+const uint16_t RealOutputMap[ MAPSIZE ] = { 0x1900, 0x3a40, 0x5200,
+                                            0x6d80, 0x8640, 0x9f00,
+                                            0xb7c0, 0xd540, 0xf000 };
+
+const uint16_t FlatSpotMap[ MAPSIZE ] = { 0x0400, 0x2000, 0x2000,
+                                          0x2000, 0x6000, 0x8000,
+                                          0x8000, 0xC000, 0xF000 };
+
+const uint16_t ZeroMap[ MAPSIZE ] = { 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+                                      0x0000, 0x0000, 0x0000, 0x0000 };
+
+const uint16_t NonMonotonicMap[ MAPSIZE ] = { 0x1000, 0x3000, 0x2800,
+                                              0x5000, 0x5000, 0x9000,
+                                              0x8000, 0xd000, 0xe000 };
+
+const uint16_t PeakMap[ MAPSIZE ] = { 0xbb9f, 0xb6b9, 0xa2e1, 0x8f39, 0x7abc,
+                                      0x667b, 0x4d7e, 0x6000, 0x2cfc };
+
+const uint16_t FoldedMap[ MAPSIZE ] = { 0x2000, 0x8000, 0xF000, 0x9000, 0x1000,
+                                        0x4000, 0xA000, 0xE000, 0xFF00 };
+
+//
+//! Monotonic maps that must give the same results as the bin search
+//
+const uint16_t* const MonotonicMaps[] = { LinearFullScale, LinearInverse,
+                                          RealInputMap,    FlatSpotMap,
+                                          ZeroMap };
+
+//
+//! Maps that turn back on themselves at least once
+//
+const uint16_t* const FoldedMaps[] = { NonMonotonicMap, PeakMap, FoldedMap };
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Map a value to LinearFullScale through the first segment of the
+//!         input map that holds it, clamping to the first end bin otherwise
+//!
+///////////////////////////////////////////////////////////////////////////////
+static uint16_t ReferenceMapToLinear( uint16_t value, const uint16_t* inputMap )
+{
+    uint16_t lowest = 0xFFFF;
+    uint16_t highest = 0x0000;
+    for ( int bin = 0; bin < MAPSIZE; bin++ )
+    {
+        lowest = inputMap[ bin ] < lowest ? inputMap[ bin ] : lowest;
+        highest = inputMap[ bin ] > highest ? inputMap[ bin ] : highest;
+    }
+
+    if ( value < lowest || value >= highest )
+    {
+        uint16_t end = value < lowest ? lowest : highest;
+        for ( int bin = 0; bin < MAPSIZE; bin++ )
+        {
+            if ( inputMap[ bin ] == end )
+            {
+                return LINEAR_BIN_VALUE( bin );
+            }
+        }
+    }
+
+    for ( int bin = 0; bin < MAPSIZE - 1; bin++ )
+    {
+        int32_t lower = inputMap[ bin ];
+        int32_t upper = inputMap[ bin + 1 ];
+
+        //
+        // Take the segment that covers the value and the values just above it
+        //
+        if ( ( lower <= value && value < upper ) ||
+             ( upper <= value && value < lower ) )
+        {
+            int32_t linearLower = LINEAR_BIN_VALUE( bin );
+            int32_t linearUpper = LINEAR_BIN_VALUE( bin + 1 );
+
+            return linearLower + ( value - lower ) *
+                ( linearUpper - linearLower ) / ( upper - lower );
+        }
+    }
+
+    return 0;
+}
+
+// Check maps that turn back on themselves are spotted
+TEST( FoldedMap, Monotonic )
+{
+    for ( const uint16_t* map : MonotonicMaps )
+    {
+        EXPECT_TRUE( IsMapMonotonic( map ) )
+            << "Map starting 0x" << std::hex << map[ 0 ];
+
+        CompiledMap compiled;
+        CompileMap( &compiled, map, RealOutputMap );
+        EXPECT_TRUE( compiled.monotonic )
+            << "Map starting 0x" << std::hex << map[ 0 ];
+    }
+
+    for ( const uint16_t* map : FoldedMaps )
+    {
+        EXPECT_FALSE( IsMapMonotonic( map ) )
+            << "Map starting 0x" << std::hex << map[ 0 ];
+
+        CompiledMap compiled;
+        CompileMap( &compiled, map, RealOutputMap );
+        EXPECT_FALSE( compiled.monotonic )
+            << "Map starting 0x" << std::hex << map[ 0 ];
+    }
+}
+
+// Check monotonic maps map exactly as they did before
+TEST( FoldedMap, MonotonicMatchesMapValueToLinear )
+{
+    for ( const uint16_t* map : MonotonicMaps )
+    {
+        for ( uint32_t value = 0; value <= 0xFFFF; value++ )
+        {
+            ASSERT_EQ(
+                MapFoldedValueToLinear( value, map ),
+                MapValueToLinear( value, map ) )
+                << "Value 0x" << std::hex << value << " map starting 0x"
+                << map[ 0 ];
+        }
+    }
+}
+
+// Check folded maps are read through the segment nearest empty
+TEST( FoldedMap, FoldedMatchesReference )
+{
+    for ( const uint16_t* map : FoldedMaps )
+    {
+        for ( uint32_t value = 0; value <= 0xFFFF; value++ )
+        {
+            ASSERT_EQ(
+                MapFoldedValueToLinear( value, map ),
+                ReferenceMapToLinear( value, map ) )
+                << "Value 0x" << std::hex << value << " map starting 0x"
+                << map[ 0 ];
+        }
+    }
+}
+
+// Check a compiled composite of a folded map stays close to mapping through
+// both stages
+TEST( FoldedMap, CompositeAccuracy )
+{
+    for ( const uint16_t* map : FoldedMaps )
+    {
+        CompiledMap compiled;
+        CompileMap( &compiled, map, RealOutputMap );
+
+        for ( uint32_t value = 0; value <= 0xFFFF; value++ )
+        {
+            uint16_t actual = ReferenceMapToLinear( value, map );
+            uint16_t expected = MapLinearValue( actual, RealOutputMap );
+            ASSERT_LE(
+                abs( MapCompiledValue( value, &compiled ) - expected ), 2 )
+                << "Value 0x" << std::hex << value << " map starting 0x"
+                << map[ 0 ];
+        }
+    }
+}
+
+// Check only the segments that overlap another are ambiguous
+TEST( FoldedMap, Ambiguous )
+{
+    const bool expected[ MAPSIZE - 1 ] = { true,  true, true, false,
+                                           true,  true, true, false };
+
+    for ( int bin = 0; bin < MAPSIZE - 1; bin++ )
+    {
+        EXPECT_EQ( IsSegmentAmbiguous( NonMonotonicMap, bin ), expected[ bin ] )
+            << "Bin " << bin;
+        EXPECT_FALSE( IsSegmentAmbiguous( RealInputMap, bin ) )
+            << "Bin " << bin;
+        EXPECT_FALSE( IsSegmentAmbiguous( FlatSpotMap, bin ) ) << "Bin " << bin;
+        EXPECT_FALSE( IsSegmentAmbiguous( ZeroMap, bin ) ) << "Bin " << bin;
+    }
+}
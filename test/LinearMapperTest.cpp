@@ -0,0 +1,98 @@
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \file
+//! \brief  Unit test the specialised LinearFullScale mapping functions
+//!
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2019 David J. Fiddes
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "gtest/gtest.h"
+#include <stdint.h>
+
+#include "mapper.h"
+
+const uint16_t LinearFullScale[ MAPSIZE ] = { 0x0000, 0x2000, 0x4000,
+                                              0x6000, 0x8000, 0xA000,
+                                              0xC000, 0xE000, 0xFFFF };
+
+const uint16_t LinearInverse[ MAPSIZE ] = { 0xFFFF, 0xE000, 0xC000,
+                                            0xA000, 0x8000, 0x6000,
+                                            0x4000, 0x2000, 0x0000 };
+
+const uint16_t LinearHalfOffset[ MAPSIZE ] = { 0x3000, 0x4000, 0x5000,
+                                               0x6000, 0x7000, 0x8000,
+                                               0x9000, 0xa000, 0xb000 };
+
+const uint16_t RealInputMap[ MAPSIZE ] = { 0xbb9f, 0xb6b9, 0xa2e1,
+                                           0x8f39, 0x7abc, 0x667b,
+                                           0x4d7e, 0x2cfc, 0x0bfb };
+
+const uint16_t RealOutputMap[ MAPSIZE ] = { 0x1900, 0x3a40, 0x5200,
+                                            0x6d80, 0x8640, 0x9f00,
+                                            0xb7c0, 0xd540, 0xf000 };
+
+const uint16_t SteepMap[ MAPSIZE ] = { 0x0000, 0x0010, 0x0100, 0x1000, 0x4000,
+                                       0x8000, 0xC000, 0xF000, 0xFFFF };
+
+const uint16_t NonMonotonicMap[ MAPSIZE ] = { 0x1000, 0x3000, 0x2800,
+                                              0x5000, 0x5000, 0x9000,
+                                              0x8000, 0xd000, 0xe000 };
+
+//
+//! All of the maps that are checked exhaustively
+//
+const uint16_t* const MapCorpus[] = { LinearFullScale, LinearInverse,
+                                      LinearHalfOffset, RealInputMap,
+                                      RealOutputMap,     SteepMap,
+                                      NonMonotonicMap };
+
+// Check that the input stage matches MapValue() for every possible input
+TEST( LinearMapper, MapValueToLinearMatchesMapValue )
+{
+    for ( const uint16_t* map : MapCorpus )
+    {
+        for ( uint32_t value = 0; value <= 0xFFFF; value++ )
+        {
+            uint16_t expected = MapValue( value, map, LinearFullScale );
+            uint16_t actual = MapValueToLinear( value, map );
+            if ( actual != expected )
+            {
+                FAIL() << "Mismatch for value 0x" << std::hex << value
+                       << " map starting 0x" << map[ 0 ] << ": expected 0x"
+                       << expected << " got 0x" << actual;
+            }
+        }
+    }
+}
+
+// Check that the output stage matches MapValue() for every possible input
+TEST( LinearMapper, MapLinearValueMatchesMapValue )
+{
+    for ( const uint16_t* map : MapCorpus )
+    {
+        for ( uint32_t value = 0; value <= 0xFFFF; value++ )
+        {
+            uint16_t expected = MapValue( value, LinearFullScale, map );
+            uint16_t actual = MapLinearValue( value, map );
+            if ( actual != expected )
+            {
+                FAIL() << "Mismatch for value 0x" << std::hex << value
+                       << " map starting 0x" << map[ 0 ] << ": expected 0x"
+                       << expected << " got 0x" << actual;
+            }
+        }
+    }
+}
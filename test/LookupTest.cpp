@@ -0,0 +1,143 @@
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \file
+//! \brief  Unit test the flash lookup table
+//!
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2019 David J. Fiddes
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "DummyHal.h"
+#include "lookup.h"
+#include "mapper.h"
+
+#include "gtest/gtest.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+const uint16_t LinearFullScale[ MAPSIZE ] = { 0x0000, 0x2000, 0x4000,
+                                              0x6000, 0x8000, 0xA000,
+                                              0xC000, 0xE000, 0xFFFF };
+
+const uint16_t LinearInverse[ MAPSIZE ] = { 0xFFFF, 0xE000, 0xC000,
+                                            0xA000, 0x8000, 0x6000,
+                                            0x4000, 0x2000, 0x0000 };
+
+const uint16_t RealInputMap[ MAPSIZE ] = { 0xbb9f, 0xb6b9, 0xa2e1,
+                                           0x8f39, 0x7abc, 0x667b,
+                                           0x4d7e, 0x2cfc, 0x0bfb };
+
+const uint16_t RealOutputMap[ MAPSIZE ] = { 0x1900, 0x3a40, 0x5200,
+                                            0x6d80, 0x8640, 0x9f00,
+                                            0xb7c0, 0xd540, 0xf000 };
+
+//
+//! The table is coarse so segment corners falling between entries are cut.
+//! Allow for about 1% of full scale which is well within the accuracy of a
+//! hot-wire gauge
+//
+const int MaxTableError = 0x0290;
+
+// Check that building a table fills the flash and matches the map
+TEST( Lookup, Build )
+{
+    CompiledMap map;
+    CompileMap( &map, RealInputMap, RealOutputMap );
+
+    EraseFlash();
+    EXPECT_FALSE( CheckLookupTable( &map ) );
+
+    BuildLookupTable( &map );
+
+    EXPECT_EQ( g_flashWrites, LOOKUP_STORAGE_SIZE );
+    EXPECT_TRUE( CheckLookupTable( &map ) );
+
+    CompiledMap otherMap;
+    CompileMap( &otherMap, RealInputMap, LinearFullScale );
+    EXPECT_FALSE( CheckLookupTable( &otherMap ) );
+
+    //
+    // The real input map runs from full at low tank values to empty
+    //
+    EXPECT_EQ( g_flash[ 0 ], 0xf000 >> LOOKUP_ENTRY_SHIFT );
+    EXPECT_EQ( g_flash[ LOOKUP_TABLE_SIZE - 1 ], 0x1900 >> LOOKUP_ENTRY_SHIFT );
+}
+
+// Check that a change to any single entry is caught
+TEST( Lookup, CheckEveryEntry )
+{
+    CompiledMap map;
+    CompileMap( &map, RealInputMap, RealOutputMap );
+    BuildLookupTable( &map );
+
+    for ( uint16_t i = 0; i < LOOKUP_TABLE_SIZE; i++ )
+    {
+        uint16_t entry = g_flash[ i ];
+        g_flash[ i ] = entry ^ 1;
+        EXPECT_FALSE( CheckLookupTable( &map ) ) << "Entry " << i;
+        g_flash[ i ] = entry;
+    }
+
+    EXPECT_TRUE( CheckLookupTable( &map ) );
+}
+
+// Check the blend between entries for a simple linear map
+TEST( Lookup, LinearBlend )
+{
+    CompiledMap map;
+    CompileMap( &map, LinearFullScale, LinearInverse );
+    BuildLookupTable( &map );
+
+    EXPECT_EQ( LookupValue( 0x0000 ), 0xfffc );
+    EXPECT_EQ( LookupValue( 0x1234 ), 0xedcc );
+    EXPECT_EQ( LookupValue( 0x8000 ), 0x8000 );
+    EXPECT_EQ( LookupValue( 0xc100 ), 0x3f00 );
+    EXPECT_EQ( LookupValue( 0xff00 ), 0x0100 );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Find the largest difference between the lookup table and the
+//!         composite map it was built from
+//!
+///////////////////////////////////////////////////////////////////////////////
+static int MaxLookupError( const uint16_t* inputMap, const uint16_t* outputMap )
+{
+    CompiledMap map;
+    CompileMap( &map, inputMap, outputMap );
+    BuildLookupTable( &map );
+
+    int maxError = 0;
+    for ( uint32_t value = 0; value <= 0xFFFF; value++ )
+    {
+        int error =
+            abs( LookupValue( value ) - MapCompiledValue( value, &map ) );
+        if ( error > maxError )
+        {
+            maxError = error;
+        }
+    }
+
+    return maxError;
+}
+
+// Check the table is accurate enough for real maps
+TEST( Lookup, Accuracy )
+{
+    EXPECT_LT( MaxLookupError( LinearFullScale, LinearFullScale ), MaxTableError );
+    EXPECT_LT( MaxLookupError( LinearFullScale, LinearInverse ), MaxTableError );
+    EXPECT_LT( MaxLookupError( RealInputMap, RealOutputMap ), MaxTableError );
+    EXPECT_LT( MaxLookupError( RealInputMap, LinearInverse ), MaxTableError );
+}
@@ -0,0 +1,210 @@
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \file
+//! \brief  Unit test the mapper and command processor with any map size
+//!
+//! These tests don't depend on the number of map bins so are also built
+//! against the library with each of the other supported map sizes.
+//!
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2019 David J. Fiddes
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "DummyHal.h"
+#include "gtest/gtest.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "command.h"
+#include "mapper.h"
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  A set of maps generated for the current map size
+//!
+///////////////////////////////////////////////////////////////////////////////
+struct SizedMaps
+{
+    uint16_t linear[ MAPSIZE ];
+    uint16_t inverse[ MAPSIZE ];
+    uint16_t sender[ MAPSIZE ];
+    uint16_t gauge[ MAPSIZE ];
+
+    SizedMaps()
+    {
+        for ( int i = 0; i < MAPSIZE; i++ )
+        {
+            double x = (double)i / ( MAPSIZE - 1 );
+
+            linear[ i ] = LINEAR_BIN_VALUE( i );
+            inverse[ i ] = 0xFFFF - linear[ i ];
+
+            //
+            // A curved sender that falls away quickly near empty and a gauge
+            // with a bowed scale like the real ones
+            //
+            sender[ i ] = 0xbb9f - lround( ( 0xbb9f - 0x0bfb ) * pow( x, 0.8 ) );
+            gauge[ i ] = 0x1900 + lround( ( 0xf000 - 0x1900 ) * sin( x * 1.5 ) /
+                                          sin( 1.5 ) );
+        }
+    }
+};
+
+static const SizedMaps s_maps;
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Map a value by scanning for the bounding bins as MapValue() used to
+//!
+///////////////////////////////////////////////////////////////////////////////
+static uint16_t ScanMapValue(
+    uint16_t        value,
+    const uint16_t* inputMap,
+    const uint16_t* outputMap )
+{
+    bool increasing = inputMap[ 0 ] < inputMap[ MAPSIZE - 1 ];
+
+    if ( increasing ? value < inputMap[ 0 ] : value > inputMap[ 0 ] )
+    {
+        return outputMap[ 0 ];
+    }
+
+    for ( int bin = 0; bin < MAPSIZE - 1; bin++ )
+    {
+        bool found = increasing
+            ? value >= inputMap[ bin ] && value < inputMap[ bin + 1 ]
+            : value <= inputMap[ bin ] && value > inputMap[ bin + 1 ];
+
+        if ( found )
+        {
+            int32_t valueDiff = (int32_t)value - inputMap[ bin ];
+            int32_t inputBinDiff =
+                (int32_t)inputMap[ bin + 1 ] - inputMap[ bin ];
+            int32_t outputBinDiff =
+                (int32_t)outputMap[ bin + 1 ] - outputMap[ bin ];
+
+            return outputMap[ bin ] + valueDiff * outputBinDiff / inputBinDiff;
+        }
+    }
+
+    return outputMap[ MAPSIZE - 1 ];
+}
+
+// Check the binary search finds the same bins as a scan for every input
+TEST( MapSize, BinarySearchMatchesScan )
+{
+    const uint16_t* maps[] = { s_maps.linear, s_maps.inverse, s_maps.sender,
+                               s_maps.gauge };
+
+    for ( const uint16_t* inputMap : maps )
+    {
+        for ( uint32_t value = 0; value <= 0xFFFF; value++ )
+        {
+            uint16_t expected = ScanMapValue( value, inputMap, s_maps.gauge );
+            uint16_t actual = MapValue( value, inputMap, s_maps.gauge );
+            if ( actual != expected )
+            {
+                FAIL() << "Mismatch for value 0x" << std::hex << value
+                       << " map starting 0x" << inputMap[ 0 ]
+                       << ": expected 0x" << expected << " got 0x" << actual;
+            }
+        }
+    }
+}
+
+// Check the LinearFullScale mapping functions still match MapValue()
+TEST( MapSize, LinearMappingMatchesMapValue )
+{
+    for ( uint32_t value = 0; value <= 0xFFFF; value++ )
+    {
+        ASSERT_EQ(
+            MapValueToLinear( value, s_maps.sender ),
+            MapValue( value, s_maps.sender, s_maps.linear ) )
+            << "Value 0x" << std::hex << value;
+        ASSERT_EQ(
+            MapLinearValue( value, s_maps.gauge ),
+            MapValue( value, s_maps.linear, s_maps.gauge ) )
+            << "Value 0x" << std::hex << value;
+    }
+}
+
+// Check the composite map stays close to mapping through both stages
+TEST( MapSize, CompositeAccuracy )
+{
+    CompiledMap map;
+    CompileMap( &map, s_maps.sender, s_maps.gauge );
+
+    for ( uint32_t value = 0; value <= 0xFFFF; value++ )
+    {
+        uint16_t actual = MapValue( value, s_maps.sender, s_maps.linear );
+        uint16_t expected = MapValue( actual, s_maps.linear, s_maps.gauge );
+        ASSERT_LE( abs( MapCompiledValue( value, &map ) - expected ), 2 )
+            << "Value 0x" << std::hex << value;
+    }
+}
+
+// Check every bin can be edited and saved but no more
+TEST( MapSize, ModifyMap )
+{
+    memcpy( g_inputMap, s_maps.sender, sizeof( g_inputMap ) );
+    memcpy( g_outputMap, s_maps.gauge, sizeof( g_outputMap ) );
+    InitialiseGauge();
+
+    std::string lastBin = std::to_string( MAPSIZE - 1 );
+    std::string pastLastBin = std::to_string( MAPSIZE );
+
+    EXPECT_TRUE( ProcessCommand( ( "i " + lastBin + " 0123" ).c_str() ) );
+    EXPECT_TRUE( ProcessCommand( ( "o " + lastBin + " fedc" ).c_str() ) );
+    EXPECT_FALSE( ProcessCommand( ( "i " + pastLastBin + " 0123" ).c_str() ) );
+    EXPECT_FALSE( ProcessCommand( ( "o " + pastLastBin + " fedc" ).c_str() ) );
+
+    //
+    // Bin numbers that would wrap around a byte are still out of range
+    //
+    EXPECT_FALSE( ProcessCommand( "i 259 0123" ) );
+
+    EXPECT_TRUE( ProcessCommand( "s" ) );
+    EXPECT_EQ( g_inputMap[ MAPSIZE - 1 ], 0x0123 );
+    EXPECT_EQ( g_outputMap[ MAPSIZE - 1 ], 0xfedc );
+    EXPECT_EQ( g_inputMap[ MAPSIZE - 2 ], s_maps.sender[ MAPSIZE - 2 ] );
+    EXPECT_EQ( g_outputMap[ MAPSIZE - 2 ], s_maps.gauge[ MAPSIZE - 2 ] );
+}
+
+// Check the map display lists every bin
+TEST( MapSize, MapDisplay )
+{
+    memcpy( g_inputMap, s_maps.sender, sizeof( g_inputMap ) );
+    memcpy( g_outputMap, s_maps.gauge, sizeof( g_outputMap ) );
+    InitialiseGauge();
+
+    g_output.clear();
+    EXPECT_TRUE( ProcessCommand( "m" ) );
+    ASSERT_EQ( g_output.size(), 2 * MAPSIZE + 3 );
+
+    char expected[ 64 ];
+    snprintf(
+        expected, sizeof( expected ), "Input[%d] : 0x%04x : 0xffff",
+        MAPSIZE - 1, s_maps.sender[ MAPSIZE - 1 ] );
+    EXPECT_EQ( g_output[ MAPSIZE - 1 ], expected );
+
+    snprintf(
+        expected, sizeof( expected ), "Output[%d] : 0x%04x : 0x%04x",
+        MAPSIZE - 2, LINEAR_BIN_VALUE( MAPSIZE - 2 ),
+        s_maps.gauge[ MAPSIZE - 2 ] );
+    EXPECT_EQ( g_output[ 2 * MAPSIZE - 2 ], expected );
+}
@@ -0,0 +1,237 @@
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \file
+//! \brief  Unit test the ring of tank input samples with a simulated interrupt
+//!
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2019 David J. Fiddes
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "DummyHal.h"
+#include "gtest/gtest.h"
+
+#include "gtest/gtest.h"
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include "filter.h"
+#include "sampler.h"
+
+// Check samples come out in order and a full ring drops new samples
+TEST( Sampler, PushAndTake )
+{
+    SampleRing ring = {};
+    uint16_t   sample;
+
+    EXPECT_FALSE( TakeSample( &ring, &sample ) );
+
+    for ( uint16_t i = 0; i < SAMPLE_RING_SIZE; i++ )
+    {
+        EXPECT_TRUE( PushSample( &ring, 0x1000 + i ) );
+    }
+    EXPECT_FALSE( PushSample( &ring, 0x2000 ) );
+
+    for ( uint16_t i = 0; i < SAMPLE_RING_SIZE; i++ )
+    {
+        ASSERT_TRUE( TakeSample( &ring, &sample ) );
+        EXPECT_EQ( sample, 0x1000 + i );
+    }
+    EXPECT_FALSE( TakeSample( &ring, &sample ) );
+}
+
+// Check the counts wrap around cleanly at every fill level
+TEST( Sampler, CountWrap )
+{
+    SampleRing ring = {};
+    uint16_t   next = 0;
+    uint16_t   expected = 0;
+
+    for ( int pass = 0; pass < 1000; pass++ )
+    {
+        int fill = pass % ( SAMPLE_RING_SIZE + 1 );
+        for ( int i = 0; i < fill; i++ )
+        {
+            ASSERT_TRUE( PushSample( &ring, next++ ) );
+        }
+        for ( int i = 0; i < fill; i++ )
+        {
+            uint16_t sample;
+            ASSERT_TRUE( TakeSample( &ring, &sample ) );
+            ASSERT_EQ( sample, expected++ );
+        }
+    }
+    EXPECT_EQ( ring.head, ring.tail );
+}
+
+// Check a drain filters every waiting sample and keeps the last result
+TEST( Sampler, Drain )
+{
+    SampleRing ring = {};
+    TankFilter filter = {};
+    uint16_t   tankInput = 0x1234;
+    SetTankFilter( &filter, 0 );
+
+    EXPECT_EQ( DrainSamples( &ring, &filter, &tankInput ), 0 );
+    EXPECT_EQ( tankInput, 0x1234 );
+
+    for ( uint16_t i = 1; i <= 5; i++ )
+    {
+        PushSample( &ring, 0x4000 * i / 2 );
+    }
+    EXPECT_EQ( DrainSamples( &ring, &filter, &tankInput ), 5 );
+    EXPECT_EQ( tankInput, 0xA000 );
+    EXPECT_EQ( DrainSamples( &ring, &filter, &tankInput ), 0 );
+    EXPECT_EQ( ring.head, ring.tail );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  A sampling interrupt at a fixed period feeding a main loop that
+//!         drains the ring when it gets round to it
+//!
+//! The interrupt runs whenever the simulated time passes one of its periods
+//! and stamps each sample with the time it was taken. Samples are a count so
+//! any that are lost or repeated show up.
+//!
+///////////////////////////////////////////////////////////////////////////////
+struct InterruptSim
+{
+    SampleRing              ring;
+    uint32_t                timeUs;
+    uint32_t                nextUs;
+    uint16_t                count;
+    unsigned                dropped;
+    std::vector< uint32_t > takenUs;
+    std::vector< uint16_t > drained;
+
+    InterruptSim() : ring(), timeUs( 0 ), nextUs( 1024 ), count( 0 ), dropped( 0 )
+    {
+    }
+
+    void Advance( uint32_t us )
+    {
+        timeUs += us;
+        while ( nextUs <= timeUs )
+        {
+            if ( PushSample( &ring, count ) )
+            {
+                takenUs.push_back( nextUs );
+            }
+            else
+            {
+                dropped++;
+            }
+            count++;
+            nextUs += 1024;
+        }
+    }
+
+    void Drain()
+    {
+        uint16_t sample;
+        while ( TakeSample( &ring, &sample ) )
+        {
+            drained.push_back( sample );
+        }
+    }
+};
+
+// Check an irregular main loop gets every sample in order, evenly spaced
+TEST( Sampler, IrregularLoop )
+{
+    InterruptSim sim;
+    uint32_t     seed = 0x2468ace0;
+    uint32_t     drainUs = 0;
+
+    for ( int pass = 0; pass < 100000; pass++ )
+    {
+        //
+        // Most passes are short but now and again one prints a few characters
+        //
+        seed = seed * 1664525 + 1013904223;
+        sim.Advance( pass % 50 == 0 ? 3000 : 20 + ( seed >> 28 ) * 5 );
+        if ( sim.timeUs >= drainUs )
+        {
+            sim.Drain();
+            drainUs = sim.timeUs + SAMPLE_DRAIN_TICKS * 1024;
+        }
+    }
+    sim.Drain();
+
+    EXPECT_EQ( sim.dropped, 0 );
+    ASSERT_EQ( sim.drained.size(), sim.count );
+    for ( size_t i = 0; i < sim.drained.size(); i++ )
+    {
+        ASSERT_EQ( sim.drained[ i ], (uint16_t)i );
+    }
+    for ( size_t i = 1; i < sim.takenUs.size(); i++ )
+    {
+        ASSERT_EQ( sim.takenUs[ i ] - sim.takenUs[ i - 1 ], 1024 );
+    }
+}
+
+// Check a stalled main loop keeps the oldest samples and loses the rest
+TEST( Sampler, StalledLoop )
+{
+    InterruptSim sim;
+
+    sim.Advance( 100 * 1024 );
+    sim.Drain();
+
+    EXPECT_EQ( sim.dropped, 100 - SAMPLE_RING_SIZE );
+    ASSERT_EQ( sim.drained.size(), SAMPLE_RING_SIZE );
+    EXPECT_EQ( sim.drained.back(), SAMPLE_RING_SIZE - 1 );
+
+    //
+    // Sampling carries on as soon as there is room
+    //
+    sim.Advance( 1024 );
+    sim.Drain();
+    EXPECT_EQ( sim.drained.back(), 100 );
+}
+
+// Check the producer is told to skip ticks once the filters back off and to
+// sample every tick again after a step
+TEST( Sampler, Backoff )
+{
+    SampleRing ring = {};
+    TankFilter filter = {};
+    uint16_t   tankInput;
+    SetTankFilter( &filter, FILTER_BACKOFF_FLAG | FILTER_DEFAULT_K );
+    SeedTankFilter( &filter, 0x8000 );
+
+    for ( uint16_t tick = 0; tick < 8; tick++ )
+    {
+        EXPECT_TRUE( SampleDue( &ring, tick ) );
+    }
+
+    for ( int i = 0; i < 1000; i++ )
+    {
+        PushSample( &ring, 0x8000 );
+        DrainSamples( &ring, &filter, &tankInput );
+    }
+    unsigned due = 0;
+    for ( uint16_t tick = 0xFFF0; tick != 0x0010; tick++ )
+    {
+        due += SampleDue( &ring, tick );
+    }
+    EXPECT_EQ( due, 32 >> SAMPLE_BACKOFF_MAX );
+    EXPECT_TRUE( SampleDue( &ring, 0 ) );
+
+    PushSample( &ring, 0x4000 );
+    DrainSamples( &ring, &filter, &tankInput );
+    EXPECT_TRUE( SampleDue( &ring, 1 ) );
+}
@@ -0,0 +1,366 @@
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \file
+//! \brief  Unit test the scheduler and the gauge tasks in simulated time
+//!
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2019 David J. Fiddes
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "DummyHal.h"
+#include "gtest/gtest.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "command.h"
+#include "filter.h"
+#include "hal.h"
+#include "sampler.h"
+#include "scheduler.h"
+
+//
+//! Simulated time taken by each pass of the main loop
+//
+const uint32_t LoopUs = 50;
+
+//
+//! Number of times each test task has run
+//
+static unsigned s_runs[ 3 ];
+
+static void FirstTask()
+{
+    s_runs[ 0 ]++;
+}
+
+static void SecondTask()
+{
+    s_runs[ 1 ]++;
+}
+
+static void ThirdTask()
+{
+    s_runs[ 2 ]++;
+}
+
+static const Task s_testTasks[] = {
+    { FirstTask, 0 },
+    { SecondTask, 1 },
+    { ThirdTask, 250 },
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Run the test tasks for a while in simulated time
+//!
+///////////////////////////////////////////////////////////////////////////////
+static void RunTestTasks( uint16_t* due, uint32_t us )
+{
+    uint32_t end = g_timeUs + us;
+    while ( g_timeUs < end )
+    {
+        RunTasks( s_testTasks, due, 3 );
+        g_timeUs += LoopUs;
+    }
+}
+
+// Check each task runs at its own period
+TEST( Scheduler, Periods )
+{
+    uint16_t due[ 3 ];
+    g_timeUs = 0;
+    memset( s_runs, 0, sizeof( s_runs ) );
+    StartTasks( due, 3 );
+
+    RunTestTasks( due, 1000000 );
+
+    EXPECT_EQ( s_runs[ 0 ], 1000000 / LoopUs );
+    EXPECT_EQ( s_runs[ 1 ], 1000 );
+    EXPECT_EQ( s_runs[ 2 ], 4 );
+}
+
+// Check the periods carry on across the ticks wrapping around
+TEST( Scheduler, TickWrap )
+{
+    uint16_t due[ 3 ];
+    g_timeUs = 65000000;
+    memset( s_runs, 0, sizeof( s_runs ) );
+    StartTasks( due, 3 );
+
+    RunTestTasks( due, 1000000 );
+
+    EXPECT_EQ( s_runs[ 1 ], 1000 );
+    EXPECT_EQ( s_runs[ 2 ], 4 );
+}
+
+// Check a task that falls behind skips the runs it missed rather than
+// catching up all at once, and can be woken early
+TEST( Scheduler, FallingBehind )
+{
+    uint16_t due[ 3 ];
+    g_timeUs = 0;
+    memset( s_runs, 0, sizeof( s_runs ) );
+    StartTasks( due, 3 );
+    RunTasks( s_testTasks, due, 3 );
+
+    g_timeUs += 100000;
+    RunTasks( s_testTasks, due, 3 );
+    RunTasks( s_testTasks, due, 3 );
+    EXPECT_EQ( s_runs[ 1 ], 2 );
+    EXPECT_EQ( s_runs[ 2 ], 1 );
+
+    WakeTask( &due[ 2 ] );
+    RunTasks( s_testTasks, due, 3 );
+    EXPECT_EQ( s_runs[ 2 ], 2 );
+    RunTestTasks( due, 250000 );
+    EXPECT_EQ( s_runs[ 2 ], 2 );
+    RunTestTasks( due, 1000 );
+    EXPECT_EQ( s_runs[ 2 ], 3 );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Power on the gauge with a one to one mapping and the tank input
+//!         filters simulated
+//!
+///////////////////////////////////////////////////////////////////////////////
+static void StartGauge( uint16_t tank )
+{
+    for ( int i = 0; i < MAPSIZE; i++ )
+    {
+        g_inputMap[ i ] = LINEAR_BIN_VALUE( i );
+        g_outputMap[ i ] = LINEAR_BIN_VALUE( i );
+    }
+    g_filterSetting = FILTER_DEFAULT_K;
+    g_mappingTicks = 0;
+    g_outputTicks = 0;
+    g_lowFuelLevel = 0x1000;
+    g_tank = tank;
+    g_timeUs = 0;
+    g_output.clear();
+    g_currentLine.clear();
+    g_input.clear();
+    ResetSerial();
+    g_simulateTankFilter = true;
+    ResetTankFilter();
+
+    InitialiseGauge();
+    g_timeUs = 0;
+    StartGaugeTasks();
+    g_tankSamples = 0;
+    g_droppedSamples = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Run the gauge's tasks for a while in simulated time and record
+//!         when the low fuel light changes
+//!
+///////////////////////////////////////////////////////////////////////////////
+static void RunGaugeFor( uint32_t us, std::vector< uint32_t >* changes = NULL )
+{
+    uint32_t end = g_timeUs + us;
+    bool     light = g_lowFuelState;
+    while ( g_timeUs < end )
+    {
+        RunGaugeTasks();
+        if ( changes && g_lowFuelState != light )
+        {
+            changes->push_back( g_timeUs );
+            light = g_lowFuelState;
+        }
+        g_timeUs += LoopUs;
+    }
+}
+
+// Check the tank input is sampled at the same rate with and without a fault
+TEST( Scheduler, GaugeSampleRate )
+{
+    StartGauge( 0x8000 );
+
+    RunGaugeFor( 1000000 );
+    EXPECT_NEAR( g_tankSamples, 1000, SAMPLE_DRAIN_TICKS );
+    EXPECT_EQ( g_gauge, 0x8000 );
+
+    g_tank = 0xFFFF;
+    RunGaugeFor( 1000000 );
+    EXPECT_NEAR( g_tankSamples, 2000, SAMPLE_DRAIN_TICKS );
+    EXPECT_EQ( g_droppedSamples, 0 );
+
+    g_simulateTankFilter = false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Run the gauge for a second with a tank input that changes every
+//!         tick and count the mappings and gauge writes
+//!
+///////////////////////////////////////////////////////////////////////////////
+static void CountGaugeRates( unsigned* mappings, unsigned* writes )
+{
+    g_simulateTankFilter = false;
+    g_output.clear();
+    ProcessCommand( "x" );
+    unsigned startMappings = 0;
+    sscanf( g_output[ 0 ].c_str(), "Samples: 0x%x", &startMappings );
+    unsigned startWrites = g_gaugeWrites;
+
+    uint32_t end = g_timeUs + 1000000;
+    while ( g_timeUs < end )
+    {
+        g_tank = 0x4000 + ( g_timeUs / TICK_US ) * 0x10;
+        RunGaugeTasks();
+        g_timeUs += LoopUs;
+    }
+
+    g_output.clear();
+    ProcessCommand( "x" );
+    sscanf( g_output[ 0 ].c_str(), "Samples: 0x%x", mappings );
+    *mappings -= startMappings;
+    *writes = g_gaugeWrites - startWrites;
+}
+
+// Check the input is mapped and the gauge written at their own saved rates
+TEST( Scheduler, GaugeRates )
+{
+    unsigned mappings;
+    unsigned writes;
+
+    StartGauge( 0x8000 );
+    CountGaugeRates( &mappings, &writes );
+    EXPECT_NEAR( mappings, 1000 / DEFAULT_MAPPING_TICKS, 1 );
+    EXPECT_NEAR( writes, 1000 / DEFAULT_OUTPUT_TICKS, 1 );
+
+    //
+    // New rates take effect as soon as the gauge is back in run mode
+    //
+    ASSERT_TRUE( ProcessCommand( "p" ) );
+    ASSERT_TRUE( ProcessCommand( "e 5 32" ) );
+    ASSERT_TRUE( ProcessCommand( "r" ) );
+    CountGaugeRates( &mappings, &writes );
+    EXPECT_NEAR( mappings, 200, 1 );
+    EXPECT_NEAR( writes, 20, 1 );
+}
+
+// Check continuous logging, which prints more than the serial port can send,
+// still has every tank input sample filtered while printing waits
+TEST( Scheduler, GaugeLoggingSamples )
+{
+    StartGauge( 0x8000 );
+    ASSERT_TRUE( ProcessCommand( "c" ) );
+
+    RunGaugeFor( 1000000 );
+    EXPECT_NEAR( g_tankSamples, 1000, SAMPLE_DRAIN_TICKS );
+    EXPECT_EQ( g_droppedSamples, 0 );
+    EXPECT_GT( g_output.size(), 10 );
+
+    ASSERT_TRUE( ProcessCommand( "c" ) );
+    ResetSerial();
+    g_simulateTankFilter = false;
+}
+
+// Check a steady tank input is sampled less often and a change brings the
+// full rate back
+TEST( Scheduler, GaugeSampleBackoff )
+{
+    StartGauge( 0x8000 );
+    ASSERT_TRUE( ProcessCommand( "p" ) );
+    ASSERT_TRUE( ProcessCommand( "k 18" ) );
+    ASSERT_TRUE( ProcessCommand( "r" ) );
+
+    RunGaugeFor( 2000000 );
+    g_tankSamples = 0;
+    RunGaugeFor( 1000000 );
+    EXPECT_NEAR(
+        g_tankSamples, 1000 >> SAMPLE_BACKOFF_MAX, SAMPLE_DRAIN_TICKS );
+    EXPECT_EQ( g_gauge, 0x8000 );
+
+    g_tank = 0x4000;
+    RunGaugeFor( 100000 );
+    g_tankSamples = 0;
+    RunGaugeFor( 100000 );
+    EXPECT_NEAR( g_tankSamples, 100, SAMPLE_DRAIN_TICKS );
+
+    RunGaugeFor( 3000000 );
+    EXPECT_EQ( g_gauge, 0x4000 );
+    EXPECT_EQ( g_droppedSamples, 0 );
+
+    g_simulateTankFilter = false;
+}
+
+// Check a tank input error flashes the low fuel light straight away at a
+// steady rate and the light goes back to showing the fuel level afterwards
+TEST( Scheduler, GaugeErrorFlash )
+{
+    StartGauge( 0x8000 );
+    RunGaugeFor( 100000 );
+    EXPECT_FALSE( g_lowFuelState );
+
+    //
+    // The light goes off and on each second from when the fault is found
+    //
+    std::vector< uint32_t > changes;
+    uint32_t                faultUs = g_timeUs;
+    g_tank = 0xFFFF;
+    RunGaugeFor( 5500000, &changes );
+
+    ASSERT_EQ( changes.size(), 6 );
+    EXPECT_LE( changes[ 0 ] - faultUs, 20000 );
+    for ( size_t i = 1; i < changes.size(); i++ )
+    {
+        EXPECT_EQ( changes[ i ] - changes[ i - 1 ], 1000000 );
+    }
+
+    //
+    // Once the sender is back the light shows the fuel level again, even if
+    // the flash left it off
+    //
+    g_tank = 0x0800;
+    RunGaugeFor( 3000000 );
+    EXPECT_TRUE( g_lowFuelState );
+
+    g_simulateTankFilter = false;
+}
+
+// Check commands typed at the console are echoed and run
+TEST( Scheduler, GaugeConsole )
+{
+    StartGauge( 0x8000 );
+    RunGaugeFor( 100000 );
+
+    g_input = "d\r";
+    RunGaugeFor( 200000 );
+    ASSERT_EQ( g_output.size(), 3 );
+    EXPECT_EQ( g_output[ 0 ], "d" );
+    EXPECT_EQ(
+        g_output[ 1 ],
+        "Tank: 0x8000 Gauge: 0x8000 Actual: 0x8000 Burn: 0x0000 Mode: Run" );
+    EXPECT_EQ( g_output[ 2 ], "OK" );
+
+    g_output.clear();
+    g_input = "q\r";
+    RunGaugeFor( 200000 );
+    g_input = std::string( 12, 'x' );
+    RunGaugeFor( 200000 );
+    ASSERT_EQ( g_output.size(), 4 );
+    EXPECT_EQ( g_output[ 1 ], "Command Error" );
+    EXPECT_EQ( g_output[ 2 ], std::string( 12, 'x' ) );
+    EXPECT_EQ( g_output[ 3 ], "Line too long" );
+
+    g_simulateTankFilter = false;
+}
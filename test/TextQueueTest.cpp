@@ -0,0 +1,173 @@
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \file
+//! \brief  Unit test the serial port queues and how the gauge uses them
+//!
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2019 David J. Fiddes
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "DummyHal.h"
+#include "gtest/gtest.h"
+
+#include "DummyHal.h"
+#include "gtest/gtest.h"
+#include <stdint.h>
+#include <string>
+
+#include "command.h"
+#include "hal.h"
+#include "textqueue.h"
+
+// Check characters come out in order and a full queue drops and counts them
+TEST( TextQueue, PutAndGet )
+{
+    char      buffer[ 4 ];
+    TextQueue queue = TEXT_QUEUE( buffer );
+    char      character;
+
+    EXPECT_FALSE( GetCharacter( &queue, &character ) );
+    EXPECT_EQ( TextQueueSpace( &queue ), 4 );
+
+    for ( char c : std::string( "abcd" ) )
+    {
+        EXPECT_TRUE( PutCharacter( &queue, c ) );
+    }
+    EXPECT_EQ( TextQueueSpace( &queue ), 0 );
+    EXPECT_FALSE( PutCharacter( &queue, 'e' ) );
+    EXPECT_FALSE( PutCharacter( &queue, 'f' ) );
+    EXPECT_EQ( queue.lost, 2 );
+
+    std::string text;
+    while ( GetCharacter( &queue, &character ) )
+    {
+        text.push_back( character );
+    }
+    EXPECT_EQ( text, "abcd" );
+    EXPECT_EQ( TextQueueSpace( &queue ), 4 );
+}
+
+// Check the counts wrap around cleanly for the biggest queue
+TEST( TextQueue, CountWrap )
+{
+    char      buffer[ 128 ];
+    TextQueue queue = TEXT_QUEUE( buffer );
+    uint8_t   next = 0;
+    uint8_t   expected = 0;
+
+    for ( int pass = 0; pass < 100; pass++ )
+    {
+        int fill = ( pass * 37 ) % 129;
+        for ( int i = 0; i < fill; i++ )
+        {
+            ASSERT_TRUE( PutCharacter( &queue, (char)next++ ) );
+        }
+        EXPECT_EQ( TextQueueSpace( &queue ), 128 - fill );
+        for ( int i = 0; i < fill; i++ )
+        {
+            char character;
+            ASSERT_TRUE( GetCharacter( &queue, &character ) );
+            ASSERT_EQ( (uint8_t)character, expected++ );
+        }
+    }
+    EXPECT_EQ( queue.lost, 0 );
+}
+
+// Check the lost count stops rather than wrapping back to zero
+TEST( TextQueue, LostSaturates )
+{
+    char      buffer[ 2 ];
+    TextQueue queue = TEXT_QUEUE( buffer );
+
+    for ( int i = 0; i < 300; i++ )
+    {
+        PutCharacter( &queue, 'x' );
+    }
+    EXPECT_EQ( queue.lost, 0xFF );
+    LoseCharacter( &queue );
+    EXPECT_EQ( queue.lost, 0xFF );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Start the gauge running with empty serial port queues
+//!
+///////////////////////////////////////////////////////////////////////////////
+static void StartConsole()
+{
+    g_timeUs = 0;
+    g_output.clear();
+    g_currentLine.clear();
+    g_input.clear();
+    ResetSerial();
+    InitialiseGauge();
+    StartGaugeTasks();
+}
+
+// Check printing only waits once the transmit queue is full
+TEST( TextQueue, PrintDoesNotWait )
+{
+    StartConsole();
+    uint32_t startUs = g_timeUs;
+
+    HAL_PrintText( "OK" );
+    HAL_PrintNewline();
+    EXPECT_EQ( g_timeUs, startUs );
+    EXPECT_EQ( PendingCharacters(), 4 );
+
+    //
+    // A display line is longer than the queue so waits for the rest to fit
+    //
+    EXPECT_TRUE( ProcessCommand( "d" ) );
+    unsigned lineLength = g_output.back().size() + 2;
+    EXPECT_GT( g_timeUs, startUs );
+    EXPECT_LE( g_timeUs - startUs, ( lineLength + 4 - 8 ) * CHARACTER_US );
+    EXPECT_EQ( PendingCharacters(), 8 );
+
+    //
+    // The queue empties in the background
+    //
+    g_timeUs += 8 * CHARACTER_US;
+    EXPECT_EQ( PendingCharacters(), 0 );
+}
+
+// Check characters typed while the main loop is held up are kept until the
+// receive queue is full and the rest are counted as lost
+TEST( TextQueue, TypingWhileBusy )
+{
+    StartConsole();
+
+    g_input = "kkkkkkkkkkkk";
+    g_timeUs += 20000;
+    RunGaugeTasks();
+    g_input = "\r";
+    for ( int pass = 0; pass < 400; pass++ )
+    {
+        RunGaugeTasks();
+        g_timeUs += 50;
+    }
+
+    EXPECT_EQ( HAL_GetLostCharacters(), 8 );
+    ASSERT_GE( g_output.size(), 2 );
+    EXPECT_EQ( g_output[ 0 ], "kkkk" );
+    EXPECT_EQ( g_output[ 1 ], "Command Error" );
+
+    g_output.clear();
+    EXPECT_TRUE( ProcessCommand( "x" ) );
+    ASSERT_EQ( g_output.size(), 1 );
+    EXPECT_NE( g_output[ 0 ].find( "Lost: 0x0008" ), std::string::npos );
+
+    ResetSerial();
+}
@@ -0,0 +1,360 @@
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \file
+//! \brief  Exhaustively verify the accuracy and cost of MapValue() on the host
+//!
+//! Every possible input is mapped through each pair of maps in a corpus of
+//! real and synthetic maps and compared with a double precision reference.
+//! The map pairs are shared out between the host's cores. A report of the
+//! maximum and mean error, monotonicity violations and time per call is
+//! printed and the run fails if the accuracy baseline isn't met.
+//!
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2019 David J. Fiddes
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mapper.h"
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  A named map in the corpus
+//!
+///////////////////////////////////////////////////////////////////////////////
+struct CorpusMap
+{
+    std::string name;
+    uint16_t    bins[ MAPSIZE ];
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  The results of sweeping every input through one pair of maps
+//!
+///////////////////////////////////////////////////////////////////////////////
+struct SweepResult
+{
+    double   maxError;
+    double   meanError;
+    uint32_t violations;
+    double   nsPerCall;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Fraction of a horizontal cylindrical tank that is full at a
+//!         fraction of its height
+//!
+///////////////////////////////////////////////////////////////////////////////
+static double CylinderVolume( double height )
+{
+    double x = 1.0 - 2.0 * height;
+    return ( acos( x ) - x * sqrt( 1.0 - x * x ) ) / M_PI;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Build a map by sampling a curve between two end values
+//!
+///////////////////////////////////////////////////////////////////////////////
+template < typename Curve >
+static CorpusMap SampledMap(
+    const std::string& name,
+    double             first,
+    double             last,
+    Curve              curve )
+{
+    CorpusMap map;
+    map.name = name;
+
+    for ( int bin = 0; bin < MAPSIZE; bin++ )
+    {
+        double x = (double)bin / ( MAPSIZE - 1 );
+        map.bins[ bin ] = lround( first + ( last - first ) * curve( x ) );
+    }
+
+    return map;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Build a repeatable random map with increasing or decreasing bins
+//!
+///////////////////////////////////////////////////////////////////////////////
+static CorpusMap RandomMap( const std::string& name, uint32_t seed, bool up )
+{
+    CorpusMap map;
+    map.name = name;
+
+    for ( int bin = 0; bin < MAPSIZE; bin++ )
+    {
+        seed = seed * 1664525 + 1013904223;
+        map.bins[ bin ] = seed >> 16;
+    }
+
+    std::sort( map.bins, map.bins + MAPSIZE );
+    if ( !up )
+    {
+        std::reverse( map.bins, map.bins + MAPSIZE );
+    }
+
+    return map;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Build the corpus of maps. Each is used as both an input and an
+//!         output map.
+//!
+///////////////////////////////////////////////////////////////////////////////
+static std::vector< CorpusMap > BuildCorpus()
+{
+    std::vector< CorpusMap > corpus;
+
+    corpus.push_back( SampledMap(
+        "Linear", 0x0000, 0xFFFF, []( double x ) { return x; } ) );
+    corpus.push_back( SampledMap(
+        "Inverse", 0xFFFF, 0x0000, []( double x ) { return x; } ) );
+    corpus.push_back( SampledMap(
+        "Half", 0x0000, 0x8000, []( double x ) { return x; } ) );
+
+#if MAPSIZE_BITS == 3
+    //
+    // Calibrations taken from a real tank and gauge
+    //
+    corpus.push_back( { "RealInput",
+                        { 0xbb9f, 0xb6b9, 0xa2e1, 0x8f39, 0x7abc, 0x667b,
+                          0x4d7e, 0x2cfc, 0x0bfb } } );
+    corpus.push_back( { "RealOutput",
+                        { 0x1900, 0x3a40, 0x5200, 0x6d80, 0x8640, 0x9f00,
+                          0xb7c0, 0xd540, 0xf000 } } );
+#endif
+
+    corpus.push_back( SampledMap(
+        "Sender", 0xbb9f, 0x0bfb, []( double x ) { return pow( x, 0.8 ); } ) );
+    corpus.push_back( SampledMap( "Gauge", 0x1900, 0xf000, []( double x ) {
+        return sin( x * 1.5 ) / sin( 1.5 );
+    } ) );
+    corpus.push_back(
+        SampledMap( "Cylinder", 0x0000, 0xFFFF, CylinderVolume ) );
+    corpus.push_back( SampledMap(
+        "Steep", 0x0000, 0xFFFF, []( double x ) { return pow( x, 4.0 ); } ) );
+    corpus.push_back( SampledMap( "FlatSpot", 0x0400, 0xF000, []( double x ) {
+        return x < 0.25 ? 0.2 : x < 0.75 ? 0.6 : x;
+    } ) );
+    corpus.push_back( SampledMap(
+        "Zero", 0x0000, 0x0000, []( double x ) { return x; } ) );
+    corpus.push_back( SampledMap( "Folded", 0x1000, 0xe000, []( double x ) {
+        return x + 0.15 * sin( x * 6 * M_PI );
+    } ) );
+    corpus.push_back( RandomMap( "RandomUp", 0x12345678, true ) );
+    corpus.push_back( RandomMap( "RandomDown", 0x87654321, false ) );
+
+    return corpus;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Check a map never runs against the direction of its ends
+//!
+///////////////////////////////////////////////////////////////////////////////
+static bool IsMonotonic( const uint16_t* map )
+{
+    bool increasing = map[ 0 ] < map[ MAPSIZE - 1 ];
+
+    for ( int bin = 0; bin < MAPSIZE - 1; bin++ )
+    {
+        if ( increasing ? map[ bin + 1 ] < map[ bin ]
+                        : map[ bin + 1 ] > map[ bin ] )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Map a value in double precision following MapValue()'s rules
+//!
+//! The bins are found with a scan in the direction of the map's ends so this
+//! is only a true reference for monotonic input maps.
+//!
+///////////////////////////////////////////////////////////////////////////////
+static double ReferenceMapValue(
+    uint16_t        value,
+    const uint16_t* inputMap,
+    const uint16_t* outputMap )
+{
+    bool increasing = inputMap[ 0 ] < inputMap[ MAPSIZE - 1 ];
+
+    if ( increasing ? value < inputMap[ 0 ] : value > inputMap[ 0 ] )
+    {
+        return outputMap[ 0 ];
+    }
+
+    for ( int bin = 0; bin < MAPSIZE - 1; bin++ )
+    {
+        double lower = inputMap[ bin ];
+        double upper = inputMap[ bin + 1 ];
+
+        bool found = increasing ? value >= lower && value < upper
+                                : value <= lower && value > upper;
+
+        if ( found )
+        {
+            return outputMap[ bin ] + ( value - lower ) *
+                ( outputMap[ bin + 1 ] - outputMap[ bin ] ) / ( upper - lower );
+        }
+    }
+
+    return outputMap[ MAPSIZE - 1 ];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Sweep every input through a pair of maps
+//!
+///////////////////////////////////////////////////////////////////////////////
+static SweepResult Sweep( const uint16_t* inputMap, const uint16_t* outputMap )
+{
+    static thread_local std::vector< uint16_t > results( 0x10000 );
+
+    //
+    // Time the sweep on its own so the reference doesn't count
+    //
+    auto start = std::chrono::steady_clock::now();
+    for ( uint32_t value = 0; value <= 0xFFFF; value++ )
+    {
+        results[ value ] = MapValue( value, inputMap, outputMap );
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    SweepResult result = {};
+    result.nsPerCall =
+        std::chrono::duration< double, std::nano >( end - start ).count() /
+        0x10000;
+
+    //
+    // The output should only ever move one way as the input rises
+    //
+    bool rising = ReferenceMapValue( 0x0000, inputMap, outputMap ) <
+        ReferenceMapValue( 0xFFFF, inputMap, outputMap );
+
+    double totalError = 0.0;
+    for ( uint32_t value = 0; value <= 0xFFFF; value++ )
+    {
+        double error = fabs(
+            results[ value ] -
+            ReferenceMapValue( value, inputMap, outputMap ) );
+        result.maxError = std::max( result.maxError, error );
+        totalError += error;
+
+        if ( value > 0 && ( rising ? results[ value ] < results[ value - 1 ]
+                                   : results[ value ] > results[ value - 1 ] ) )
+        {
+            result.violations++;
+        }
+    }
+    result.meanError = totalError / 0x10000;
+
+    return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//!
+//! \brief  Sweep every pair of maps in the corpus across all host cores and
+//!         report the results
+//!
+///////////////////////////////////////////////////////////////////////////////
+int main()
+{
+    std::vector< CorpusMap >   corpus = BuildCorpus();
+    size_t                     pairs = corpus.size() * corpus.size();
+    std::vector< SweepResult > results( pairs );
+    std::atomic< size_t >      nextPair( 0 );
+
+    unsigned threadCount = std::max( 1u, std::thread::hardware_concurrency() );
+    std::vector< std::thread > threads;
+
+    for ( unsigned i = 0; i < threadCount; i++ )
+    {
+        threads.emplace_back( [&]() {
+            for ( size_t pair = nextPair++; pair < pairs; pair = nextPair++ )
+            {
+                const CorpusMap& input = corpus[ pair / corpus.size() ];
+                const CorpusMap& output = corpus[ pair % corpus.size() ];
+                results[ pair ] = Sweep( input.bins, output.bins );
+            }
+        } );
+    }
+
+    for ( std::thread& thread : threads )
+    {
+        thread.join();
+    }
+
+    printf(
+        "MapValue() sweep of %zu map pairs with MAPSIZE %d on %u threads\n\n",
+        pairs, MAPSIZE, threadCount );
+    printf(
+        "%-12s %-12s %10s %10s %10s %8s\n", "Input", "Output", "MaxError",
+        "MeanError", "Violations", "ns/call" );
+
+    bool   passed = true;
+    double totalNs = 0.0;
+
+    for ( size_t pair = 0; pair < pairs; pair++ )
+    {
+        const CorpusMap&   input = corpus[ pair / corpus.size() ];
+        const CorpusMap&   output = corpus[ pair % corpus.size() ];
+        const SweepResult& result = results[ pair ];
+
+        //
+        // MapValue() truncates so must be within a count of the reference.
+        // Maps that turn back on themselves have no single right answer so
+        // are only reported.
+        //
+        bool checked = IsMonotonic( input.bins );
+        bool failed = checked &&
+            ( result.maxError >= 1.0 ||
+              ( IsMonotonic( output.bins ) && result.violations > 0 ) );
+
+        printf(
+            "%-12s %-12s %10.4f %10.4f %10u %8.2f%s\n", input.name.c_str(),
+            output.name.c_str(), result.maxError, result.meanError,
+            result.violations, result.nsPerCall,
+            failed ? " FAIL" : checked ? "" : " (not checked)" );
+
+        passed = passed && !failed;
+        totalNs += result.nsPerCall;
+    }
+
+    printf( "\nMean %.2f ns/call\n", totalNs / pairs );
+    printf( "%s\n", passed ? "PASSED" : "FAILED" );
+
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}